@@ -0,0 +1,581 @@
+/*
+ * bench.c -- Microbenchmark of crypto kernels on the host
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Each benchmark runs a kernel N times in a sample.  N is calibrated
+ * so that a sample takes at least MIN_SAMPLE_MSEC.  The median over
+ * the samples is reported as ns/op (and cycles/op by the time stamp
+ * counter, on x86), with the minimum and the median absolute
+ * deviation (MAD) in percent, for stability.  A result with MAD over
+ * 5% is marked with "*"; run it again on a quiet machine.
+ *
+ * With -j FILE, results are written in JSON, too; compare.py
+ * compares two of them.
+ *
+ * When built with OP_COUNT=1, -c runs each kernel once and shows the
+ * numbers of field operations (see opcount.h) instead of timing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "bn.h"
+#include "mod.h"
+#include "modp256r1.h"
+#include "modp256k1.h"
+#include "mod25638.h"
+#include "affine.h"
+#include "ec_p256r1.h"
+#include "ec_p256k1.h"
+#include "sha256.h"
+#include "sha512.h"
+#include "aes.h"
+#include "polarssl/bignum.h"
+#include "opcount.h"
+
+#define UNSTABLE_MAD_PCT 5.0
+
+void bench_compute_nQ (bn256 *res, const bn256 *n, const bn256 *q_x);
+void bench_compute_kG_25519 (ac *X, const bn256 *K);
+int eddsa_sign_25519 (const uint8_t *input, size_t ilen, uint32_t *out,
+		      const bn256 *a, const uint8_t *seed, const bn256 *pk);
+void eddsa_compute_public_25519 (const uint8_t *kd, uint8_t *pubkey);
+
+/*
+ * Environment expected by the kernels.
+ */
+void *
+gnuk_malloc (size_t size)
+{
+  return malloc (size);
+}
+
+void
+gnuk_free (void *p)
+{
+  free (p);
+}
+
+void *
+gnuk_scratch_alloc (size_t size)
+{
+  return malloc (size);
+}
+
+void
+gnuk_scratch_free (void *p)
+{
+  free (p);
+}
+
+/* Deterministic, for reproducible inputs.  Not for security.  */
+static uint32_t rnd_state = 0x2545f491;
+
+static uint32_t
+rnd32 (void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static void
+rnd_fill (void *p, size_t len)
+{
+  uint8_t *b = p;
+
+  while (len--)
+    *b++ = rnd32 ();
+}
+
+static uint8_t random_word[32];
+
+const uint8_t *
+random_bytes_get (void)
+{
+  rnd_fill (random_word, sizeof random_word);
+  return random_word;
+}
+
+void
+random_bytes_free (const uint8_t *p)
+{
+  (void)p;
+}
+
+/*
+ * Inputs and outputs of kernels.
+ */
+static bn256 a[1], b[1], c[1], k[1];
+static bn512 w[1];
+static ac P[1], P_k1[1], Q[1];
+static uint8_t msg[1024], digest[64];
+static uint32_t sig[64/4];
+static struct AES_ctx aes;
+static uint8_t aes_buf[AES_BLOCKLEN];
+
+/* P-256 order and MU for mod_reduce.  */
+static const bn256 N_p256r1[1] = {
+  {{ 0xfc632551, 0xf3b9cac2, 0xa7179e84, 0xbce6faad,
+     0xffffffff, 0xffffffff, 0x00000000, 0xffffffff }}
+};
+static const bn256 MU_lower_p256r1[1] = {
+  {{ 0xeedf9bfe, 0x012ffd85, 0xdf1a6c21, 0x43190552,
+     0xffffffff, 0xfffffffe, 0xffffffff, 0x00000000 }}
+};
+
+/* Ed25519 secret: clamped scalar, seed and public key.  */
+static bn256 ed_a[1], ed_pk[1];
+static uint8_t ed_seed[32];
+
+static mpi mpi_A, mpi_E, mpi_N, mpi_X, mpi_RR;
+
+static void
+mpi_setup (int bits)
+{
+  uint8_t buf[512];
+  int len = bits / 8;
+
+  rnd_fill (buf, len);
+  buf[0] |= 0x80;
+  buf[len - 1] |= 1;		/* N should be odd.  */
+  mpi_read_binary (&mpi_N, buf, len);
+  rnd_fill (buf, len);
+  buf[0] &= 0x7f;
+  mpi_read_binary (&mpi_A, buf, len);
+  rnd_fill (buf, len);
+  buf[0] |= 0x80;
+  mpi_read_binary (&mpi_E, buf, len);
+  mpi_free (&mpi_RR);
+  mpi_init (&mpi_RR);
+}
+
+static void
+setup (void)
+{
+  uint8_t kd[64];
+
+  rnd_fill (a, sizeof a);
+  rnd_fill (b, sizeof b);
+  rnd_fill (k, sizeof k);
+  k->word[7] &= 0x7fffffff;	/* Less than the order.  */
+  rnd_fill (msg, sizeof msg);
+  bn256_mul (w, a, b);
+  compute_kG_p256r1 (P, k);
+  compute_kG_p256k1 (P_k1, k);
+
+  rnd_fill (ed_seed, sizeof ed_seed);
+  sha512 (ed_seed, 32, kd);
+  kd[0] &= 248;
+  kd[31] &= 127;
+  kd[31] |= 64;
+  memcpy (ed_a, kd, sizeof (bn256));
+  memcpy (ed_seed, kd + 32, 32);
+  eddsa_compute_public_25519 ((const uint8_t *)ed_a, (uint8_t *)ed_pk);
+
+  rnd_fill (digest, sizeof digest);
+  AES_init_ctx (&aes, digest);
+
+  mpi_init (&mpi_A);
+  mpi_init (&mpi_E);
+  mpi_init (&mpi_N);
+  mpi_init (&mpi_X);
+  mpi_init (&mpi_RR);
+}
+
+/*
+ * Benchmarks: run the kernel N times.
+ */
+#define BENCH(name) static void name (uint32_t n)
+
+BENCH (b_bn256_mul) { while (n--) bn256_mul (w, a, b); }
+BENCH (b_bn256_sqr) { while (n--) bn256_sqr (w, a); }
+BENCH (b_modp256r1_add) { while (n--) modp256r1_add (c, a, b); }
+BENCH (b_modp256r1_mul) { while (n--) modp256r1_mul (c, a, b); }
+BENCH (b_modp256r1_sqr) { while (n--) modp256r1_sqr (c, a); }
+BENCH (b_modp256r1_reduce) { while (n--) modp256r1_reduce (c, w); }
+BENCH (b_modp256k1_add) { while (n--) modp256k1_add (c, a, b); }
+BENCH (b_modp256k1_mul) { while (n--) modp256k1_mul (c, a, b); }
+BENCH (b_modp256k1_sqr) { while (n--) modp256k1_sqr (c, a); }
+BENCH (b_modp256k1_reduce) { while (n--) modp256k1_reduce (c, w); }
+BENCH (b_mod25638_add) { while (n--) mod25638_add (c, a, b); }
+BENCH (b_mod25638_mul) { while (n--) mod25638_mul (c, a, b); }
+BENCH (b_mod25638_sqr) { while (n--) mod25638_sqr (c, a); }
+BENCH (b_mod_reduce)
+{
+  while (n--)
+    mod_reduce (c, w, N_p256r1, MU_lower_p256r1);
+}
+BENCH (b_mod_inv) { while (n--) mod_inv (c, a, P256R1); }
+
+BENCH (b_compute_kG_p256r1) { while (n--) compute_kG_p256r1 (Q, k); }
+BENCH (b_compute_kP_p256r1) { while (n--) compute_kP_p256r1 (Q, k, P); }
+BENCH (b_compute_kG_p256k1) { while (n--) compute_kG_p256k1 (Q, k); }
+BENCH (b_compute_kP_p256k1) { while (n--) compute_kP_p256k1 (Q, k, P_k1); }
+BENCH (b_ecdsa_p256r1) { while (n--) ecdsa_p256r1 (c, c, a, k); }
+BENCH (b_compute_kG_25519) { while (n--) bench_compute_kG_25519 (Q, k); }
+BENCH (b_compute_nQ) { while (n--) bench_compute_nQ (c, ed_a, a); }
+BENCH (b_eddsa_sign_25519)
+{
+  while (n--)
+    eddsa_sign_25519 (msg, 32, sig, ed_a, ed_seed, ed_pk);
+}
+
+BENCH (b_sha256_64) { while (n--) sha256 (msg, 64, digest); }
+BENCH (b_sha256_1k) { while (n--) sha256 (msg, 1024, digest); }
+BENCH (b_sha512_128) { while (n--) sha512 (msg, 128, digest); }
+BENCH (b_sha512_1k) { while (n--) sha512 (msg, 1024, digest); }
+BENCH (b_aes128_ecb) { while (n--) AES_ECB_encrypt (&aes, aes_buf); }
+BENCH (b_aes128_cfb_1k) { while (n--) AES_CFB_encrypt (&aes, msg, 1024); }
+
+BENCH (b_mpi_exp_mod_1024)
+{
+  while (n--)
+    mpi_exp_mod (&mpi_X, &mpi_A, &mpi_E, &mpi_N, &mpi_RR);
+}
+#define b_mpi_exp_mod_2048 b_mpi_exp_mod_1024
+
+static void s_mpi_1024 (void) { mpi_setup (1024); }
+static void s_mpi_2048 (void) { mpi_setup (2048); }
+
+struct bench {
+  const char *name;
+  void (*func) (uint32_t n);
+  void (*setup) (void);
+};
+
+static const struct bench bench_table[] = {
+  { "bn256_mul", b_bn256_mul, NULL },
+  { "bn256_sqr", b_bn256_sqr, NULL },
+  { "modp256r1_add", b_modp256r1_add, NULL },
+  { "modp256r1_mul", b_modp256r1_mul, NULL },
+  { "modp256r1_sqr", b_modp256r1_sqr, NULL },
+  { "modp256r1_reduce", b_modp256r1_reduce, NULL },
+  { "modp256k1_add", b_modp256k1_add, NULL },
+  { "modp256k1_mul", b_modp256k1_mul, NULL },
+  { "modp256k1_sqr", b_modp256k1_sqr, NULL },
+  { "modp256k1_reduce", b_modp256k1_reduce, NULL },
+  { "mod25638_add", b_mod25638_add, NULL },
+  { "mod25638_mul", b_mod25638_mul, NULL },
+  { "mod25638_sqr", b_mod25638_sqr, NULL },
+  { "mod_reduce", b_mod_reduce, NULL },
+  { "mod_inv", b_mod_inv, NULL },
+  { "compute_kG_p256r1", b_compute_kG_p256r1, NULL },
+  { "compute_kP_p256r1", b_compute_kP_p256r1, NULL },
+  { "compute_kG_p256k1", b_compute_kG_p256k1, NULL },
+  { "compute_kP_p256k1", b_compute_kP_p256k1, NULL },
+  { "ecdsa_p256r1", b_ecdsa_p256r1, NULL },
+  { "compute_kG_25519", b_compute_kG_25519, NULL },
+  { "compute_nQ", b_compute_nQ, NULL },
+  { "eddsa_sign_25519", b_eddsa_sign_25519, NULL },
+  { "sha256/64", b_sha256_64, NULL },
+  { "sha256/1024", b_sha256_1k, NULL },
+  { "sha512/128", b_sha512_128, NULL },
+  { "sha512/1024", b_sha512_1k, NULL },
+  { "aes128_ecb", b_aes128_ecb, NULL },
+  { "aes128_cfb/1024", b_aes128_cfb_1k, NULL },
+  { "mpi_exp_mod/1024", b_mpi_exp_mod_1024, s_mpi_1024 },
+  { "mpi_exp_mod/2048", b_mpi_exp_mod_2048, s_mpi_2048 },
+};
+
+#define NUM_BENCH (sizeof bench_table / sizeof bench_table[0])
+
+/*
+ * Measurement.
+ */
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+now_cycles (void)
+{
+#ifdef HAVE_TSC
+  return __rdtsc ();
+#else
+  return 0;
+#endif
+}
+
+struct result {
+  const char *name;
+  uint32_t iterations;
+  double ns_per_op;
+  double min_ns_per_op;
+  double cycles_per_op;
+  double mad_pct;
+};
+
+static int
+cmp_double (const void *p0, const void *p1)
+{
+  double d0 = *(const double *)p0;
+  double d1 = *(const double *)p1;
+
+  return (d0 > d1) - (d0 < d1);
+}
+
+static double
+median (double *v, int n)
+{
+  qsort (v, n, sizeof (double), cmp_double);
+  return (n & 1) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void
+run_bench (const struct bench *bp, int num_samples, uint64_t min_sample_ns,
+	   struct result *r)
+{
+  double ns[num_samples], cyc[num_samples], dev[num_samples];
+  uint32_t n = 1;
+  uint64_t t;
+  int i;
+
+  if (bp->setup)
+    bp->setup ();
+
+  /* Warm up, and calibrate N.  */
+  for (;;)
+    {
+      t = now_ns ();
+      bp->func (n);
+      t = now_ns () - t;
+      if (t >= min_sample_ns || n >= 0x40000000)
+	break;
+      if (t < min_sample_ns / 16)
+	n *= 16;
+      else
+	n = (uint32_t)((double)n * min_sample_ns / t * 1.1) + 1;
+    }
+
+  for (i = 0; i < num_samples; i++)
+    {
+      uint64_t c0, c1, t0, t1;
+
+      c0 = now_cycles ();
+      t0 = now_ns ();
+      bp->func (n);
+      t1 = now_ns ();
+      c1 = now_cycles ();
+      ns[i] = (double)(t1 - t0) / n;
+      cyc[i] = (double)(c1 - c0) / n;
+    }
+
+  r->name = bp->name;
+  r->iterations = n;
+  r->cycles_per_op = median (cyc, num_samples);
+  r->ns_per_op = median (ns, num_samples);
+  r->min_ns_per_op = ns[0];
+  for (i = 0; i < num_samples; i++)
+    dev[i] = ns[i] > r->ns_per_op ? ns[i] - r->ns_per_op
+				     : r->ns_per_op - ns[i];
+  r->mad_pct = median (dev, num_samples) * 100 / r->ns_per_op;
+}
+
+static void
+print_result (const struct result *r)
+{
+  printf ("%-20s %14.1f %14.1f %14.1f %6.2f%s %10u\n",
+	  r->name, r->ns_per_op, r->cycles_per_op, r->min_ns_per_op,
+	  r->mad_pct, r->mad_pct > UNSTABLE_MAD_PCT ? "*" : " ",
+	  r->iterations);
+  fflush (stdout);
+}
+
+#ifdef OP_COUNT
+uint32_t opcount[OPC_NUM];
+
+static const char *opcount_name[OPC_NUM] = {
+  "mul", "sqr", "add", "reduce", "inv", "mod_reduce", "montmul"
+};
+
+static void
+run_opcount (const struct bench *bp)
+{
+  int i;
+
+  if (bp->setup)
+    bp->setup ();
+
+  memset (opcount, 0, sizeof opcount);
+  bp->func (1);
+
+  printf ("%-20s", bp->name);
+  for (i = 0; i < OPC_NUM; i++)
+    printf (" %10u", opcount[i]);
+  putchar ('\n');
+}
+#endif
+
+static int
+write_json (const char *path, const struct result *results, int num,
+	    int num_samples)
+{
+  FILE *fp = fopen (path, "w");
+  int i;
+
+  if (fp == NULL)
+    {
+      perror (path);
+      return -1;
+    }
+
+  fprintf (fp, "{\n  \"version\": 1,\n  \"samples\": %d,\n", num_samples);
+  fprintf (fp, "  \"cycles\": %s,\n",
+#ifdef HAVE_TSC
+	   "\"tsc\""
+#else
+	   "null"
+#endif
+	   );
+  fprintf (fp, "  \"results\": [\n");
+  for (i = 0; i < num; i++)
+    fprintf (fp, "    { \"name\": \"%s\", \"ns_per_op\": %.3f,"
+	     " \"cycles_per_op\": %.3f, \"min_ns_per_op\": %.3f,"
+	     " \"mad_pct\": %.3f, \"iterations\": %u }%s\n",
+	     results[i].name, results[i].ns_per_op, results[i].cycles_per_op,
+	     results[i].min_ns_per_op, results[i].mad_pct,
+	     results[i].iterations, i == num - 1 ? "" : ",");
+  fprintf (fp, "  ]\n}\n");
+  fclose (fp);
+  return 0;
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr, "Usage: %s [-l] [-f FILTER] [-n SAMPLES] [-t MSEC]"
+	   " [-j FILE]%s\n", prog,
+#ifdef OP_COUNT
+	   " [-c]"
+#else
+	   ""
+#endif
+	   );
+  fprintf (stderr, "  -l  list benchmarks\n");
+  fprintf (stderr, "  -f  run benchmarks whose name contains FILTER\n");
+  fprintf (stderr, "  -n  number of samples [15]\n");
+  fprintf (stderr, "  -t  minimum time of a sample in msec [20]\n");
+  fprintf (stderr, "  -j  write results in JSON to FILE\n");
+#ifdef OP_COUNT
+  fprintf (stderr, "  -c  count field operations of a run\n");
+#endif
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct result results[NUM_BENCH];
+  const char *filter = NULL;
+  const char *json = NULL;
+  int num_samples = 15;
+  int min_sample_msec = 20;
+  int num = 0;
+#ifdef OP_COUNT
+  int count_ops = 0;
+#endif
+  int opt;
+  size_t i;
+
+  while ((opt = getopt (argc, argv, "lf:n:t:j:c")) != -1)
+    switch (opt)
+      {
+      case 'l':
+	for (i = 0; i < NUM_BENCH; i++)
+	  puts (bench_table[i].name);
+	return 0;
+      case 'f':
+	filter = optarg;
+	break;
+      case 'n':
+	num_samples = atoi (optarg);
+	break;
+      case 't':
+	min_sample_msec = atoi (optarg);
+	break;
+      case 'j':
+	json = optarg;
+	break;
+#ifdef OP_COUNT
+      case 'c':
+	count_ops = 1;
+	break;
+#endif
+      default:
+	usage (argv[0]);
+	return 1;
+      }
+
+  if (optind != argc || num_samples < 1 || min_sample_msec < 1)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  setup ();
+
+#ifdef OP_COUNT
+  if (count_ops)
+    {
+      printf ("%-20s", "benchmark");
+      for (i = 0; i < OPC_NUM; i++)
+	printf (" %10s", opcount_name[i]);
+      putchar ('\n');
+      for (i = 0; i < NUM_BENCH; i++)
+	if (filter == NULL || strstr (bench_table[i].name, filter))
+	  run_opcount (&bench_table[i]);
+      return 0;
+    }
+#endif
+
+  printf ("%-20s %14s %14s %14s %7s %10s\n",
+	  "benchmark", "ns/op", "cycles/op", "min ns/op", "MAD%", "iter");
+  for (i = 0; i < NUM_BENCH; i++)
+    {
+      if (filter && strstr (bench_table[i].name, filter) == NULL)
+	continue;
+
+      run_bench (&bench_table[i], num_samples,
+		 (uint64_t)min_sample_msec * 1000000, &results[num]);
+      print_result (&results[num]);
+      num++;
+    }
+
+  if (json && write_json (json, results, num, num_samples) < 0)
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#! /usr/bin/python3
+
+"""
+compare.py - compare two results of bench, for regression
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# A benchmark regresses when it's slower than the threshold, and the
+# difference is larger than three times of MAD (of either result), so
+# that noise is not counted.  Exit status is 1 when any regresses.
+
+import sys, json
+
+def load(filename):
+    with open(filename) as f:
+        data = json.load(f)
+    return dict([ (r['name'], r) for r in data['results'] ])
+
+def main(base_file, new_file, threshold):
+    base = load(base_file)
+    new = load(new_file)
+    regressed = 0
+    print("%-20s %14s %14s %8s" % ("benchmark", "base ns/op", "new ns/op",
+                                     "change"))
+    for name in new:
+        if name not in base:
+            continue
+        b = base[name]['ns_per_op']
+        n = new[name]['ns_per_op']
+        change = (n - b) * 100.0 / b
+        noise = 3 * max(base[name]['mad_pct'], new[name]['mad_pct'])
+        mark = ""
+        if change > max(threshold, noise):
+            mark = "  REGRESSION"
+            regressed += 1
+        elif change < -max(threshold, noise):
+            mark = "  improved"
+        print("%-20s %14.1f %14.1f %+7.1f%%%s" % (name, b, n, change, mark))
+    return 1 if regressed else 0
+
+if __name__ == '__main__':
+    threshold = 5.0
+    args = sys.argv[1:]
+    if len(args) > 1 and args[0] == '-t':
+        threshold = float(args[1])
+        args = args[2:]
+    if len(args) != 2:
+        print("Usage: %s [-t PERCENT] BASE.json NEW.json" % sys.argv[0])
+        print("  -t  threshold of regression in percent [5]")
+        sys.exit(2)
+    sys.exit(main(args[0], args[1], threshold))
@@ -0,0 +1,29 @@
+/*
+ * kernel-edwards.c -- Expose static functions of ecc-edwards.c to bench
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ecc-edwards.c"
+
+void
+bench_compute_kG_25519 (ac *X, const bn256 *K)
+{
+  compute_kG_25519 (X, K);
+}
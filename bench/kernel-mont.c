@@ -0,0 +1,29 @@
+/*
+ * kernel-mont.c -- Expose static functions of ecc-mont.c to bench
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ecc-mont.c"
+
+void
+bench_compute_nQ (bn256 *res, const bn256 *n, const bn256 *q_x)
+{
+  compute_nQ (res, n, q_x);
+}
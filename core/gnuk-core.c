@@ -0,0 +1,383 @@
+/*
+ * gnuk-core.c -- Gnuk OpenPGP card engine as a library
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * This file replaces the parts of Gnuk which the OpenPGP card engine
+ * (openpgp.c, openpgp-do.c, ac.c, flash.c and crypto) expects from
+ * its environment: the CCID layer (APDU buffer), main.c (heap, LED,
+ * fatal), random.c, and flash routines and threads of Chopstx.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <chopstx.h>
+#include <eventflag.h>
+
+#include "config.h"
+
+#include "gnuk.h"
+#include "gnuk-core.h"
+
+#define CMD_APDU_HEAD_SIZE 5
+
+struct apdu apdu;
+
+static uint8_t apdu_buffer[CMD_APDU_HEAD_SIZE + MAX_CMD_APDU_DATA_SIZE
+			   + MAX_RES_APDU_DATA_SIZE];
+static uint16_t chained_len;
+static uint8_t chained_cls_ins_p1_p2[4];
+
+uint8_t *flash_addr_key_storage_start;
+uint8_t *flash_addr_data_storage_start;
+
+static struct gnuk_core_flash core_flash;
+static gnuk_core_rng_t core_rng;
+static void *core_rng_arg;
+
+static uint8_t core_device_id[12];
+
+static jmp_buf fatal_jmp;
+static int core_initialized;
+
+/*
+ * Flash routines; ADDR is an address in the image.
+ */
+int
+flash_program_halfword (uintptr_t addr, uint16_t data)
+{
+  return core_flash.program_halfword (core_flash.arg, (uint8_t *)addr, data);
+}
+
+int
+flash_erase_page (uintptr_t addr)
+{
+  return core_flash.erase_page (core_flash.arg, (uint8_t *)addr);
+}
+
+int
+flash_check_blank (const uint8_t *p_start, size_t size)
+{
+  const uint8_t *p;
+
+  for (p = p_start; p < p_start + size; p++)
+    if (*p != 0xff)
+      return 0;
+
+  return 1;
+}
+
+/*
+ * Random numbers by the callback.
+ */
+#define RANDOM_BYTES_LENGTH 32
+static uint8_t random_word[RANDOM_BYTES_LENGTH];
+
+static void
+random_fill (uint8_t *p, size_t len)
+{
+  if (core_rng (core_rng_arg, p, len) != 0)
+    fatal (FATAL_RANDOM);
+}
+
+const uint8_t *
+random_bytes_get (void)
+{
+  random_fill (random_word, RANDOM_BYTES_LENGTH);
+  return random_word;
+}
+
+void
+random_bytes_free (const uint8_t *p)
+{
+  (void)p;
+  memset (random_word, 0, RANDOM_BYTES_LENGTH);
+}
+
+void
+random_get_salt (uint8_t *p)
+{
+  random_fill (p, 8);
+}
+
+int
+random_gen (void *arg, unsigned char *out, size_t out_len)
+{
+  (void)arg;
+  random_fill (out, out_len);
+  return 0;
+}
+
+void
+neug_flush (void)
+{
+}
+
+/*
+ * Heap: PolarSSL's allocation goes to the C library.
+ */
+void *
+gnuk_malloc (size_t size)
+{
+  return malloc (size);
+}
+
+void
+gnuk_free (void *p)
+{
+  free (p);
+}
+
+/*
+ * Scratch memory for crypto temporaries: from the C library too.  A
+ * chunk is cleared when freed, since it may hold key material.
+ */
+void *
+gnuk_scratch_alloc (size_t size)
+{
+  size_t *p = malloc (sizeof (size_t) + size);
+
+  if (p == NULL)
+    return NULL;
+
+  *p = size;
+  return p + 1;
+}
+
+void
+gnuk_scratch_free (void *p)
+{
+  size_t *q;
+
+  if (p == NULL)
+    return;
+
+  q = (size_t *)p - 1;
+  memset (p, 0, *q);
+  free (q);
+}
+
+void
+gnuk_scratch_reset (void)
+{
+}
+
+const uint8_t *
+unique_device_id (void)
+{
+  return core_device_id;
+}
+
+void
+led_blink (int spec)
+{
+  (void)spec;
+}
+
+void
+fatal (uint8_t code)
+{
+  longjmp (fatal_jmp, code);
+}
+
+/*
+ * The engine runs in the caller's thread; cancellation is not a thing.
+ */
+int
+chopstx_setcancelstate (int cancel_disable)
+{
+  (void)cancel_disable;
+  return 1;
+}
+
+static struct chx_cleanup *cleanup_list;
+
+void
+chopstx_cleanup_push (struct chx_cleanup *clp)
+{
+  clp->next = cleanup_list;
+  cleanup_list = clp;
+}
+
+void
+chopstx_cleanup_pop (int execute)
+{
+  struct chx_cleanup *clp = cleanup_list;
+
+  if (clp)
+    {
+      cleanup_list = clp->next;
+      if (execute)
+	(clp->routine) (clp->arg);
+    }
+}
+
+void
+eventflag_signal (struct eventflag *ev, eventmask_t m)
+{
+  (void)ev;
+  (void)m;
+}
+
+/* Only for openpgp_card_thread, which is not used.  */
+eventmask_t
+eventflag_wait (struct eventflag *ev)
+{
+  (void)ev;
+  return EV_EXIT;
+}
+
+
+int
+gnuk_core_init (const struct gnuk_core_flash *flash,
+		gnuk_core_rng_t rng, void *rng_arg,
+		const uint8_t *device_id)
+{
+  if (flash == NULL || flash->image == NULL
+      || flash->program_halfword == NULL || flash->erase_page == NULL
+      || rng == NULL)
+    return -1;
+
+  core_flash = *flash;
+  core_rng = rng;
+  core_rng_arg = rng_arg;
+  if (device_id)
+    memcpy (core_device_id, device_id, sizeof core_device_id);
+  else
+    memset (core_device_id, 0, sizeof core_device_id);
+
+  flash_addr_key_storage_start = flash->image;
+  flash_addr_data_storage_start = flash->image + 4096;
+
+  if (setjmp (fatal_jmp))
+    return -1;
+
+  openpgp_card_init ();
+  chained_len = 0;
+  core_initialized = 1;
+  return 0;
+}
+
+void
+gnuk_core_fini (void)
+{
+  if (!core_initialized)
+    return;
+
+  openpgp_card_fini ();
+  core_initialized = 0;
+}
+
+/*
+ * Parse a short APDU (as the CCID layer does), run it, and build
+ * the response.
+ */
+int
+gnuk_core_apdu (const uint8_t *cmd, size_t cmd_len,
+		uint8_t *res, size_t *res_len_p)
+{
+  uint8_t *head = apdu_buffer;
+  uint8_t *data = apdu_buffer + CMD_APDU_HEAD_SIZE;
+  size_t lc, le;
+  int chaining;
+
+  if (!core_initialized || cmd_len < 4)
+    return -1;
+
+  /* Case 1, 2, 3, and 4 of ISO 7816-4 (short length only).  */
+  if (cmd_len == 4)
+    lc = le = 0;
+  else if (cmd_len == 5)
+    {
+      lc = 0;
+      le = cmd[4] ? cmd[4] : 256;
+    }
+  else
+    {
+      lc = cmd[4];
+      if (lc == 0 || cmd_len < 5 + lc || cmd_len > 5 + lc + 1)
+	return -1;
+      if (cmd_len == 5 + lc + 1)
+	le = cmd[5 + lc] ? cmd[5 + lc] : 256;
+      else
+	le = 0;
+    }
+
+  chaining = (cmd[0] & 0x10) != 0;
+
+  if (chained_len
+      && (chained_cls_ins_p1_p2[0] != (cmd[0] & ~0x10)
+	  || memcmp (chained_cls_ins_p1_p2 + 1, cmd + 1, 3) != 0))
+    /* Host stops command chaining, and starts another command.  */
+    chained_len = 0;
+
+  if (chained_len + lc > MAX_CMD_APDU_DATA_SIZE)
+    {
+      chained_len = 0;
+      return -1;
+    }
+
+  memcpy (data + chained_len, cmd + 5, lc);
+  chained_len += lc;
+
+  if (chaining)
+    {
+      chained_cls_ins_p1_p2[0] = cmd[0] & ~0x10;
+      memcpy (chained_cls_ins_p1_p2 + 1, cmd + 1, 3);
+      res[0] = 0x90;
+      res[1] = 0x00;
+      *res_len_p = 2;
+      return 0;
+    }
+
+  head[0] = cmd[0];
+  head[1] = cmd[1];
+  head[2] = cmd[2];
+  head[3] = cmd[3];
+  head[4] = 0;
+
+  apdu.seq = 0;
+  apdu.cmd_apdu_head = head;
+  apdu.cmd_apdu_data = data;
+  apdu.cmd_apdu_data_len = chained_len;
+  apdu.expected_res_size = le;
+  apdu.sw = 0x9000;
+  apdu.res_apdu_data_len = 0;
+  apdu.res_apdu_data = data;
+  chained_len = 0;
+
+  if (setjmp (fatal_jmp))
+    {
+      cleanup_list = NULL;
+      core_initialized = 0;
+      return -1;
+    }
+
+  openpgp_card_process ();
+
+  memcpy (res, apdu.res_apdu_data, apdu.res_apdu_data_len);
+  res[apdu.res_apdu_data_len] = apdu.sw >> 8;
+  res[apdu.res_apdu_data_len + 1] = apdu.sw & 0xff;
+  *res_len_p = apdu.res_apdu_data_len + 2;
+  return 0;
+}
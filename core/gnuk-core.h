@@ -0,0 +1,55 @@
+/*
+ * gnuk-core.h -- Gnuk OpenPGP card engine as a library
+ *
+ * The engine runs synchronously in the caller's thread: a command APDU
+ * goes in, a response APDU (data followed by SW1 SW2) comes out.
+ * There is no USB, no CCID, and no Chopstx thread.
+ *
+ * Flash memory is supplied by the caller.  The layout of the image is
+ * same as the one of the GNU/Linux emulation: key storage at the
+ * beginning, then data storage, GNUK_CORE_FLASH_IMAGE_SIZE bytes in
+ * total.  The engine reads the image directly and writes it only
+ * through the callbacks, with the semantics of NOR flash (a halfword
+ * can be programmed once after erase, erase is per page).
+ *
+ * Only a single instance is supported, and calls must not be made
+ * concurrently.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GNUK_CORE_FLASH_IMAGE_SIZE 8192
+#define GNUK_CORE_FLASH_PAGE_SIZE  1024
+
+struct gnuk_core_flash {
+  uint8_t *image;
+  void *arg;
+  /* Return 0 on success.  */
+  int (*program_halfword) (void *arg, uint8_t *addr, uint16_t data);
+  int (*erase_page) (void *arg, uint8_t *addr);
+};
+
+/* Fill BUF with LEN random bytes, return 0 on success.  */
+typedef int (*gnuk_core_rng_t) (void *arg, uint8_t *buf, size_t len);
+
+/*
+ * DEVICE_ID is 12-byte unique ID of the token (last four bytes are
+ * used for the serial number of the card), or NULL for all zero.
+ */
+int gnuk_core_init (const struct gnuk_core_flash *flash,
+		    gnuk_core_rng_t rng, void *rng_arg,
+		    const uint8_t *device_id);
+void gnuk_core_fini (void);
+
+/*
+ * Process a command APDU.  RES should have room for
+ * GNUK_CORE_RES_APDU_MAX bytes.  Command chaining is handled here;
+ * responses are never split by GET RESPONSE.
+ *
+ * Return 0 on success, -1 when the command APDU is malformed.
+ */
+#define GNUK_CORE_RES_APDU_MAX (5+9+512+2)
+
+int gnuk_core_apdu (const uint8_t *cmd, size_t cmd_len,
+		    uint8_t *res, size_t *res_len_p);
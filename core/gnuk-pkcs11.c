@@ -0,0 +1,1585 @@
+/*
+ * gnuk-pkcs11.c -- PKCS#11 module running Gnuk's OpenPGP card engine
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * A single slot with a single token, which is the OpenPGP card engine
+ * of libgnuk-core over a flash image file (same format as the one of
+ * the GNU/Linux emulation).  The file is $GNUK_PKCS11_FLASH_IMAGE, or
+ * $HOME/.gnuk-flash-image.
+ *
+ * Objects are the three keys of the card (ID 01: signature, 02:
+ * decryption, 03: authentication), each as a private key and a public
+ * key.  Operations are mapped to APDUs:
+ *
+ *   C_Login (CKU_USER)      VERIFY 81 and VERIFY 82
+ *   C_Login (CKU_CONTEXT_SPECIFIC)  VERIFY 81 again
+ *   C_Sign with key 01      PSO: COMPUTE DIGITAL SIGNATURE
+ *   C_Sign with key 03      INTERNAL AUTHENTICATE
+ *   C_Decrypt with key 02   PSO: DECIPHER  (RSA only)
+ *
+ * The PIN is not kept by the module.  When PW1 is valid for one
+ * signature only (the first PW status byte of DO C4 is 0), the
+ * signature key has CKA_ALWAYS_AUTHENTICATE, and the application
+ * logs in with CKU_CONTEXT_SPECIFIC before each C_Sign with it.
+ *
+ * Sessions are independent, but the engine is single instance: calls
+ * into it are serialized by a lock.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <p11-kit/pkcs11.h>
+
+#include "gnuk-core.h"
+
+#ifndef CKK_EC_MONTGOMERY
+#define CKK_EC_MONTGOMERY 0x41UL
+#endif
+
+#define FLASH_IMAGE_NAME ".gnuk-flash-image"
+#define FLASH_IMAGE_DATA_STORAGE_OFFSET 4096
+
+#define GNUK_SLOT_ID 0
+#define MAX_SESSIONS 64
+#define MAX_PIN_LEN 127
+
+#define OPENPGP_ALGO_RSA   0x01
+#define OPENPGP_ALGO_ECDH  0x12
+#define OPENPGP_ALGO_ECDSA 0x13
+#define OPENPGP_ALGO_EDDSA 0x16
+
+#define SW_SUCCESS                0x9000
+#define SW_SECURITY_FAILURE       0x6982
+#define SW_AUTH_BLOCKED           0x6983
+#define SW_CONDITION_NOT_SATISFIED 0x6985
+
+enum {
+  KEY_SIG, KEY_DEC, KEY_AUT, NUM_KEYS
+};
+
+struct key_info {
+  int present;
+  uint8_t algo;
+  CK_KEY_TYPE key_type;
+  CK_ULONG modulus_bits;
+  /* CKA_MODULUS or CKA_EC_POINT (DER encoded) */
+  uint8_t pub[520];
+  CK_ULONG pub_len;
+  /* CKA_PUBLIC_EXPONENT or CKA_EC_PARAMS (DER encoded) */
+  uint8_t param[16];
+  CK_ULONG param_len;
+};
+
+static const uint8_t key_crt_tag[NUM_KEYS] = { 0xb6, 0xb8, 0xa4 };
+static const uint8_t key_algo_tag[NUM_KEYS] = { 0xc1, 0xc2, 0xc3 };
+static const char *const key_label[NUM_KEYS] = {
+  "Signature key", "Encryption key", "Authentication key"
+};
+
+enum {
+  OP_NONE, OP_SIGN, OP_DECRYPT
+};
+
+struct session {
+  int in_use;
+  CK_FLAGS flags;
+  /* C_FindObjects */
+  int find_active;
+  CK_OBJECT_HANDLE found[NUM_KEYS * 2];
+  int found_num, found_pos;
+  /* C_Sign or C_Decrypt */
+  int op;
+  int op_key;
+  CK_MECHANISM_TYPE op_mech;
+};
+
+static pthread_mutex_t p11_lock = PTHREAD_MUTEX_INITIALIZER;
+static int p11_initialized;
+
+static int image_fd = -1;
+static uint8_t *image;
+
+static struct session sessions[MAX_SESSIONS];
+static int num_sessions;
+
+static int logged_in;
+static int pw1_lifetime_once;
+
+static char serial_number[8];
+static struct key_info keys[NUM_KEYS];
+
+static uint8_t card_res[GNUK_CORE_RES_APDU_MAX];
+static size_t card_res_len;
+
+
+/*
+ * Flash image file.
+ */
+static int
+image_program_halfword (void *arg, uint8_t *addr, uint16_t data)
+{
+  (void)arg;
+  /* Like NOR flash, only zero can be written over programmed data.  */
+  if ((addr[0] != 0xff || addr[1] != 0xff) && data != 0)
+    return 1;
+
+  addr[0] = data & 0xff;
+  addr[1] = data >> 8;
+  return 0;
+}
+
+static int
+image_erase_page (void *arg, uint8_t *addr)
+{
+  (void)arg;
+  memset (addr, 0xff, GNUK_CORE_FLASH_PAGE_SIZE);
+  return 0;
+}
+
+static int
+image_rng (void *arg, uint8_t *buf, size_t len)
+{
+  (void)arg;
+  while (len)
+    {
+      ssize_t r = getrandom (buf, len, 0);
+
+      if (r < 0)
+	return -1;
+      buf += r;
+      len -= r;
+    }
+  return 0;
+}
+
+static int
+image_open (void)
+{
+  const char *path = getenv ("GNUK_PKCS11_FLASH_IMAGE");
+  char path_buf[4096];
+  struct stat st;
+
+  if (path == NULL)
+    {
+      const char *home = getenv ("HOME");
+
+      if (home == NULL)
+	return -1;
+      snprintf (path_buf, sizeof path_buf, "%s/" FLASH_IMAGE_NAME, home);
+      path = path_buf;
+    }
+
+  image_fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (image_fd < 0)
+    return -1;
+
+  /* The image must not be shared with another process (or emulator).  */
+  if (flock (image_fd, LOCK_EX | LOCK_NB) < 0
+      || fstat (image_fd, &st) < 0)
+    goto error;
+
+  if (st.st_size == 0)
+    {
+      /* New image: all erased, but the data pool of generation 0.  */
+      uint8_t blank[GNUK_CORE_FLASH_IMAGE_SIZE];
+
+      memset (blank, 0xff, sizeof blank);
+      blank[FLASH_IMAGE_DATA_STORAGE_OFFSET] = 0;
+      blank[FLASH_IMAGE_DATA_STORAGE_OFFSET + 1] = 0;
+      if (write (image_fd, blank, sizeof blank) != sizeof blank)
+	goto error;
+    }
+  else if (st.st_size != GNUK_CORE_FLASH_IMAGE_SIZE)
+    goto error;
+
+  image = mmap (NULL, GNUK_CORE_FLASH_IMAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_SHARED, image_fd, 0);
+  if (image == MAP_FAILED)
+    {
+      image = NULL;
+      goto error;
+    }
+
+  return 0;
+
+ error:
+  close (image_fd);
+  image_fd = -1;
+  return -1;
+}
+
+static void
+image_close (void)
+{
+  if (image)
+    {
+      msync (image, GNUK_CORE_FLASH_IMAGE_SIZE, MS_SYNC);
+      munmap (image, GNUK_CORE_FLASH_IMAGE_SIZE);
+      image = NULL;
+    }
+
+  if (image_fd >= 0)
+    {
+      close (image_fd);
+      image_fd = -1;
+    }
+}
+
+
+/*
+ * Send a command to the engine, with command chaining when DATA is
+ * longer than 255.  The response is in CARD_RES (without SW).
+ * Return SW, or -1 on error.
+ */
+static int
+card_transmit (uint8_t ins, uint8_t p1, uint8_t p2,
+	       const uint8_t *data, size_t len)
+{
+  uint8_t cmd[5 + 255 + 1];
+  size_t cmd_len;
+  size_t n;
+  uint8_t cla;
+
+  do
+    {
+      n = len > 255 ? 255 : len;
+      cla = len > 255 ? 0x10 : 0x00;
+
+      cmd[0] = cla;
+      cmd[1] = ins;
+      cmd[2] = p1;
+      cmd[3] = p2;
+      cmd_len = 4;
+      if (n)
+	{
+	  cmd[cmd_len++] = n;
+	  memcpy (cmd + cmd_len, data, n);
+	  cmd_len += n;
+	}
+      if (cla == 0)
+	cmd[cmd_len++] = 0;	/* Le = 256 */
+
+      if (gnuk_core_apdu (cmd, cmd_len, card_res, &card_res_len) < 0
+	  || card_res_len < 2)
+	return -1;
+
+      data += n;
+      len -= n;
+    }
+  while (cla);
+
+  card_res_len -= 2;
+  return (card_res[card_res_len] << 8) | card_res[card_res_len + 1];
+}
+
+static int
+card_get_data (uint16_t tag)
+{
+  return card_transmit (0xca, tag >> 8, tag & 0xff, NULL, 0);
+}
+
+static int
+card_verify (uint8_t who, const uint8_t *pin, size_t pin_len)
+{
+  return card_transmit (0x20, 0x00, who, pin, pin_len);
+}
+
+static void
+card_reset_status (void)
+{
+  card_transmit (0x20, 0xff, 0x81, NULL, 0);
+  card_transmit (0x20, 0xff, 0x82, NULL, 0);
+}
+
+/* Read the length of TLV at *P, and advance *P.  */
+static size_t
+tlv_len (const uint8_t **p)
+{
+  const uint8_t *s = *p;
+  size_t len;
+
+  if (s[0] == 0x81)
+    {
+      len = s[1];
+      s += 2;
+    }
+  else if (s[0] == 0x82)
+    {
+      len = (s[1] << 8) | s[2];
+      s += 3;
+    }
+  else
+    len = *s++;
+
+  *p = s;
+  return len;
+}
+
+static void
+key_read (int k)
+{
+  struct key_info *ki = &keys[k];
+  const uint8_t *p, *end;
+  size_t len;
+  uint8_t oid[16];
+  size_t oid_len = 0;
+  int sw;
+
+  memset (ki, 0, sizeof (struct key_info));
+
+  sw = card_get_data (key_algo_tag[k]);
+  if (sw != SW_SUCCESS || card_res_len < 1)
+    return;
+
+  ki->algo = card_res[0];
+  if (ki->algo == OPENPGP_ALGO_RSA)
+    {
+      if (card_res_len < 3)
+	return;
+      ki->key_type = CKK_RSA;
+      ki->modulus_bits = (card_res[1] << 8) | card_res[2];
+    }
+  else
+    {
+      oid_len = card_res_len - 1;
+      if (oid_len > sizeof oid - 2)
+	return;
+      memcpy (oid, card_res + 1, oid_len);
+
+      if (ki->algo == OPENPGP_ALGO_EDDSA)
+	ki->key_type = CKK_EC_EDWARDS;
+      else if (ki->algo == OPENPGP_ALGO_ECDH && oid_len == 10)
+	ki->key_type = CKK_EC_MONTGOMERY;	/* Curve25519 */
+      else
+	ki->key_type = CKK_EC;
+    }
+
+  sw = card_transmit (0x47, 0x81, 0x00, &key_crt_tag[k], 1);
+  if (sw != SW_SUCCESS || card_res_len < 4
+      || card_res[0] != 0x7f || card_res[1] != 0x49)
+    return;
+
+  p = card_res + 2;
+  len = tlv_len (&p);
+  end = p + len;
+  if (end > card_res + card_res_len)
+    return;
+
+  while (p < end)
+    {
+      uint8_t tag = *p++;
+
+      len = tlv_len (&p);
+      if (p + len > end)
+	return;
+
+      if (tag == 0x81 && len <= sizeof ki->pub)
+	{			/* Modulus */
+	  memcpy (ki->pub, p, len);
+	  ki->pub_len = len;
+	}
+      else if (tag == 0x82 && len <= sizeof ki->param)
+	{			/* Exponent */
+	  memcpy (ki->param, p, len);
+	  ki->param_len = len;
+	}
+      else if (tag == 0x86 && len < 128)
+	{			/* EC point as OCTET STRING */
+	  ki->pub[0] = 0x04;
+	  ki->pub[1] = len;
+	  memcpy (ki->pub + 2, p, len);
+	  ki->pub_len = len + 2;
+	  /* Curve as OBJECT IDENTIFIER */
+	  ki->param[0] = 0x06;
+	  ki->param[1] = oid_len;
+	  memcpy (ki->param + 2, oid, oid_len);
+	  ki->param_len = oid_len + 2;
+	  ki->modulus_bits = (len == 65) ? 256 : len * 8;
+	}
+
+      p += len;
+    }
+
+  if (ki->pub_len && ki->param_len)
+    ki->present = 1;
+}
+
+static void
+token_read (void)
+{
+  static const uint8_t openpgp_aid[] = {
+    0xd2, 0x76, 0x00, 0x01, 0x24, 0x01
+  };
+  int k;
+
+  memset (serial_number, '0', sizeof serial_number);
+  if (card_transmit (0xa4, 0x04, 0x00, openpgp_aid, sizeof openpgp_aid)
+      != SW_SUCCESS)
+    return;
+
+  if (card_get_data (0x004f) == SW_SUCCESS && card_res_len >= 14)
+    {
+      static const char hex[] = "0123456789ABCDEF";
+      int i;
+
+      for (i = 0; i < 4; i++)
+	{
+	  serial_number[i*2] = hex[card_res[10 + i] >> 4];
+	  serial_number[i*2 + 1] = hex[card_res[10 + i] & 0x0f];
+	}
+    }
+
+  /* PW status bytes: PW1 is valid for one signature when the first is 0.  */
+  if (card_get_data (0x00c4) == SW_SUCCESS && card_res_len >= 7)
+    pw1_lifetime_once = (card_res[0] == 0);
+
+  for (k = 0; k < NUM_KEYS; k++)
+    key_read (k);
+}
+
+static CK_RV
+sw_to_rv (int sw, CK_RV rv_bad_input)
+{
+  if (sw == SW_SUCCESS)
+    return CKR_OK;
+  else if (sw == SW_SECURITY_FAILURE)
+    return CKR_USER_NOT_LOGGED_IN;
+  else if (sw == SW_AUTH_BLOCKED)
+    return CKR_PIN_LOCKED;
+  else if (sw == SW_CONDITION_NOT_SATISFIED)
+    return rv_bad_input;
+  else
+    return CKR_DEVICE_ERROR;
+}
+
+static void
+logout (void)
+{
+  card_reset_status ();
+  logged_in = 0;
+}
+
+
+/*
+ * Sessions and objects.
+ *
+ * Object handle is 1 + 2*K for the private key K, 2 + 2*K for the
+ * public key K.
+ */
+static struct session *
+session_get (CK_SESSION_HANDLE h)
+{
+  if (h < 1 || h > MAX_SESSIONS || !sessions[h - 1].in_use)
+    return NULL;
+  return &sessions[h - 1];
+}
+
+static void
+session_close (struct session *s)
+{
+  memset (s, 0, sizeof (struct session));
+  if (--num_sessions == 0 && logged_in)
+    logout ();
+}
+
+static int
+object_key (CK_OBJECT_HANDLE h, int *is_private_p)
+{
+  int k;
+
+  if (h < 1 || h > NUM_KEYS * 2)
+    return -1;
+
+  k = (h - 1) / 2;
+  if (!keys[k].present)
+    return -1;
+
+  *is_private_p = (h % 2) == 1;
+  if (*is_private_p && !logged_in)
+    return -1;
+
+  return k;
+}
+
+static void
+set_padded (CK_UTF8CHAR *dst, size_t size, const char *s)
+{
+  size_t len = strlen (s);
+
+  memset (dst, ' ', size);
+  memcpy (dst, s, len < size ? len : size);
+}
+
+/*
+ * Get the value of attribute TYPE of the object of key K.  Store the
+ * pointer to the value (or NULL) in *VALUE_P and its length in *LEN_P.
+ */
+static CK_RV
+object_attribute (int k, int is_private, CK_ATTRIBUTE_TYPE type,
+		  const void **value_p, CK_ULONG *len_p)
+{
+  static CK_OBJECT_CLASS class_private = CKO_PRIVATE_KEY;
+  static CK_OBJECT_CLASS class_public = CKO_PUBLIC_KEY;
+  static CK_BBOOL b_true = CK_TRUE;
+  static CK_BBOOL b_false = CK_FALSE;
+  static CK_BYTE ids[NUM_KEYS] = { 1, 2, 3 };
+  struct key_info *ki = &keys[k];
+  int is_rsa = ki->key_type == CKK_RSA;
+  CK_BBOOL *usable = &b_false;
+
+#define RETURN_VALUE(v, l) do { *value_p = (v); *len_p = (l); \
+    return CKR_OK; } while (0)
+
+  switch (type)
+    {
+    case CKA_CLASS:
+      RETURN_VALUE (is_private ? &class_private : &class_public,
+		    sizeof (CK_OBJECT_CLASS));
+    case CKA_KEY_TYPE:
+      RETURN_VALUE (&ki->key_type, sizeof (CK_KEY_TYPE));
+    case CKA_ID:
+      RETURN_VALUE (&ids[k], 1);
+    case CKA_LABEL:
+      RETURN_VALUE (key_label[k], strlen (key_label[k]));
+    case CKA_TOKEN:
+      RETURN_VALUE (&b_true, sizeof (CK_BBOOL));
+    case CKA_PRIVATE:
+    case CKA_SENSITIVE:
+    case CKA_ALWAYS_SENSITIVE:
+      RETURN_VALUE (is_private ? &b_true : &b_false, sizeof (CK_BBOOL));
+    case CKA_ALWAYS_AUTHENTICATE:
+      if (is_private && k == KEY_SIG && pw1_lifetime_once)
+	usable = &b_true;
+      RETURN_VALUE (usable, sizeof (CK_BBOOL));
+    case CKA_MODIFIABLE:
+    case CKA_EXTRACTABLE:
+    case CKA_SIGN_RECOVER:
+    case CKA_VERIFY_RECOVER:
+    case CKA_WRAP:
+    case CKA_UNWRAP:
+      RETURN_VALUE (&b_false, sizeof (CK_BBOOL));
+    case CKA_SIGN:
+    case CKA_VERIFY:
+      if (is_private == (type == CKA_SIGN) && k != KEY_DEC)
+	usable = &b_true;
+      RETURN_VALUE (usable, sizeof (CK_BBOOL));
+    case CKA_DECRYPT:
+    case CKA_ENCRYPT:
+      if (is_private == (type == CKA_DECRYPT) && k == KEY_DEC && is_rsa)
+	usable = &b_true;
+      RETURN_VALUE (usable, sizeof (CK_BBOOL));
+    case CKA_DERIVE:
+      RETURN_VALUE (&b_false, sizeof (CK_BBOOL));
+    case CKA_MODULUS:
+      if (is_rsa)
+	RETURN_VALUE (ki->pub, ki->pub_len);
+      break;
+    case CKA_MODULUS_BITS:
+      if (is_rsa)
+	RETURN_VALUE (&ki->modulus_bits, sizeof (CK_ULONG));
+      break;
+    case CKA_PUBLIC_EXPONENT:
+      if (is_rsa)
+	RETURN_VALUE (ki->param, ki->param_len);
+      break;
+    case CKA_EC_PARAMS:
+      if (!is_rsa)
+	RETURN_VALUE (ki->param, ki->param_len);
+      break;
+    case CKA_EC_POINT:
+      if (!is_rsa)
+	RETURN_VALUE (ki->pub, ki->pub_len);
+      break;
+    default:
+      break;
+    }
+#undef RETURN_VALUE
+
+  *value_p = NULL;
+  *len_p = CK_UNAVAILABLE_INFORMATION;
+  return CKR_ATTRIBUTE_TYPE_INVALID;
+}
+
+static int
+object_match (int k, int is_private, CK_ATTRIBUTE_PTR templ, CK_ULONG count)
+{
+  CK_ULONG i;
+
+  for (i = 0; i < count; i++)
+    {
+      const void *value;
+      CK_ULONG len;
+
+      if (object_attribute (k, is_private, templ[i].type, &value, &len)
+	  != CKR_OK
+	  || len != templ[i].ulValueLen
+	  || memcmp (value, templ[i].pValue, len) != 0)
+	return 0;
+    }
+
+  return 1;
+}
+
+
+/*
+ * General-purpose functions.
+ */
+CK_RV
+C_Initialize (CK_VOID_PTR pInitArgs)
+{
+  CK_C_INITIALIZE_ARGS *args = pInitArgs;
+  struct gnuk_core_flash flash;
+  CK_RV rv = CKR_OK;
+
+  if (args)
+    {
+      if (args->pReserved)
+	return CKR_ARGUMENTS_BAD;
+      /* We use the lock of the OS, but can't use the callbacks.  */
+      if (args->CreateMutex && !(args->flags & CKF_OS_LOCKING_OK))
+	return CKR_CANT_LOCK;
+    }
+
+  pthread_mutex_lock (&p11_lock);
+  if (p11_initialized)
+    {
+      rv = CKR_CRYPTOKI_ALREADY_INITIALIZED;
+      goto out;
+    }
+
+  if (image_open () < 0)
+    {
+      rv = CKR_DEVICE_ERROR;
+      goto out;
+    }
+
+  flash.image = image;
+  flash.arg = NULL;
+  flash.program_halfword = image_program_halfword;
+  flash.erase_page = image_erase_page;
+  if (gnuk_core_init (&flash, image_rng, NULL, NULL) < 0)
+    {
+      image_close ();
+      rv = CKR_DEVICE_ERROR;
+      goto out;
+    }
+
+  token_read ();
+  p11_initialized = 1;
+
+ out:
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+CK_RV
+C_Finalize (CK_VOID_PTR pReserved)
+{
+  if (pReserved)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  if (!p11_initialized)
+    {
+      pthread_mutex_unlock (&p11_lock);
+      return CKR_CRYPTOKI_NOT_INITIALIZED;
+    }
+
+  memset (sessions, 0, sizeof sessions);
+  num_sessions = 0;
+  logout ();
+  gnuk_core_fini ();
+  image_close ();
+  p11_initialized = 0;
+  pthread_mutex_unlock (&p11_lock);
+  return CKR_OK;
+}
+
+CK_RV
+C_GetInfo (CK_INFO_PTR pInfo)
+{
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (pInfo == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  memset (pInfo, 0, sizeof (CK_INFO));
+  pInfo->cryptokiVersion.major = 2;
+  pInfo->cryptokiVersion.minor = 20;
+  set_padded (pInfo->manufacturerID, sizeof pInfo->manufacturerID,
+	      "Free Software Initiative of Japan");
+  set_padded (pInfo->libraryDescription,
+	      sizeof pInfo->libraryDescription, "Gnuk PKCS#11 module");
+  pInfo->libraryVersion.major = 1;
+  pInfo->libraryVersion.minor = 0;
+  return CKR_OK;
+}
+
+extern CK_FUNCTION_LIST gnuk_function_list;
+
+CK_RV
+C_GetFunctionList (CK_FUNCTION_LIST_PTR_PTR ppFunctionList)
+{
+  if (ppFunctionList == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  *ppFunctionList = &gnuk_function_list;
+  return CKR_OK;
+}
+
+
+/*
+ * Slot and token management.
+ */
+CK_RV
+C_GetSlotList (CK_BBOOL tokenPresent, CK_SLOT_ID_PTR pSlotList,
+	       CK_ULONG_PTR pulCount)
+{
+  (void)tokenPresent;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (pulCount == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  if (pSlotList)
+    {
+      if (*pulCount < 1)
+	{
+	  *pulCount = 1;
+	  return CKR_BUFFER_TOO_SMALL;
+	}
+      pSlotList[0] = GNUK_SLOT_ID;
+    }
+
+  *pulCount = 1;
+  return CKR_OK;
+}
+
+CK_RV
+C_GetSlotInfo (CK_SLOT_ID slotID, CK_SLOT_INFO_PTR pInfo)
+{
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (slotID != GNUK_SLOT_ID)
+    return CKR_SLOT_ID_INVALID;
+  if (pInfo == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  memset (pInfo, 0, sizeof (CK_SLOT_INFO));
+  set_padded (pInfo->slotDescription, sizeof pInfo->slotDescription,
+	      "Gnuk OpenPGP card engine");
+  set_padded (pInfo->manufacturerID, sizeof pInfo->manufacturerID,
+	      "Free Software Initiative of Japan");
+  pInfo->flags = CKF_TOKEN_PRESENT;
+  return CKR_OK;
+}
+
+CK_RV
+C_GetTokenInfo (CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
+{
+  char serial[sizeof serial_number + 1];
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (slotID != GNUK_SLOT_ID)
+    return CKR_SLOT_ID_INVALID;
+  if (pInfo == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  memset (pInfo, 0, sizeof (CK_TOKEN_INFO));
+  memcpy (serial, serial_number, sizeof serial_number);
+  serial[sizeof serial_number] = 0;
+  set_padded (pInfo->label, sizeof pInfo->label, "OpenPGP card (Gnuk)");
+  set_padded (pInfo->manufacturerID, sizeof pInfo->manufacturerID,
+	      "Free Software Initiative of Japan");
+  set_padded (pInfo->model, sizeof pInfo->model, "Gnuk");
+  set_padded (pInfo->serialNumber, sizeof pInfo->serialNumber, serial);
+  pInfo->flags = (CKF_TOKEN_INITIALIZED | CKF_USER_PIN_INITIALIZED
+		  | CKF_LOGIN_REQUIRED | CKF_WRITE_PROTECTED);
+
+  pthread_mutex_lock (&p11_lock);
+  /* PW status bytes: the retry counter of PW1 is at 4.  */
+  if (card_get_data (0x00c4) == SW_SUCCESS && card_res_len >= 7)
+    {
+      if (card_res[4] == 0)
+	pInfo->flags |= CKF_USER_PIN_LOCKED;
+      else if (card_res[4] == 1)
+	pInfo->flags |= CKF_USER_PIN_FINAL_TRY;
+      else if (card_res[4] < 3)
+	pInfo->flags |= CKF_USER_PIN_COUNT_LOW;
+    }
+  pInfo->ulSessionCount = num_sessions;
+  pInfo->ulRwSessionCount = 0;
+  pthread_mutex_unlock (&p11_lock);
+
+  pInfo->ulMaxSessionCount = MAX_SESSIONS;
+  pInfo->ulMaxRwSessionCount = MAX_SESSIONS;
+  pInfo->ulMaxPinLen = MAX_PIN_LEN;
+  pInfo->ulMinPinLen = 6;
+  pInfo->ulTotalPublicMemory = CK_UNAVAILABLE_INFORMATION;
+  pInfo->ulFreePublicMemory = CK_UNAVAILABLE_INFORMATION;
+  pInfo->ulTotalPrivateMemory = CK_UNAVAILABLE_INFORMATION;
+  pInfo->ulFreePrivateMemory = CK_UNAVAILABLE_INFORMATION;
+  pInfo->hardwareVersion.major = 1;
+  pInfo->firmwareVersion.major = 1;
+  return CKR_OK;
+}
+
+static const CK_MECHANISM_TYPE mechanisms[] = {
+  CKM_RSA_PKCS, CKM_ECDSA, CKM_EDDSA
+};
+
+CK_RV
+C_GetMechanismList (CK_SLOT_ID slotID, CK_MECHANISM_TYPE_PTR pMechanismList,
+		    CK_ULONG_PTR pulCount)
+{
+  CK_ULONG n = sizeof mechanisms / sizeof mechanisms[0];
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (slotID != GNUK_SLOT_ID)
+    return CKR_SLOT_ID_INVALID;
+  if (pulCount == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  if (pMechanismList)
+    {
+      if (*pulCount < n)
+	{
+	  *pulCount = n;
+	  return CKR_BUFFER_TOO_SMALL;
+	}
+      memcpy (pMechanismList, mechanisms, sizeof mechanisms);
+    }
+
+  *pulCount = n;
+  return CKR_OK;
+}
+
+CK_RV
+C_GetMechanismInfo (CK_SLOT_ID slotID, CK_MECHANISM_TYPE type,
+		    CK_MECHANISM_INFO_PTR pInfo)
+{
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (slotID != GNUK_SLOT_ID)
+    return CKR_SLOT_ID_INVALID;
+  if (pInfo == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  if (type == CKM_RSA_PKCS)
+    {
+      pInfo->ulMinKeySize = 2048;
+      pInfo->ulMaxKeySize = 4096;
+      pInfo->flags = CKF_HW | CKF_SIGN | CKF_DECRYPT;
+    }
+  else if (type == CKM_ECDSA || type == CKM_EDDSA)
+    {
+      pInfo->ulMinKeySize = 256;
+      pInfo->ulMaxKeySize = 256;
+      pInfo->flags = CKF_HW | CKF_SIGN;
+    }
+  else
+    return CKR_MECHANISM_INVALID;
+
+  return CKR_OK;
+}
+
+
+/*
+ * Session management.
+ */
+CK_RV
+C_OpenSession (CK_SLOT_ID slotID, CK_FLAGS flags, CK_VOID_PTR pApplication,
+	       CK_NOTIFY Notify, CK_SESSION_HANDLE_PTR phSession)
+{
+  int i;
+
+  (void)pApplication;
+  (void)Notify;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (slotID != GNUK_SLOT_ID)
+    return CKR_SLOT_ID_INVALID;
+  if (!(flags & CKF_SERIAL_SESSION))
+    return CKR_SESSION_PARALLEL_NOT_SUPPORTED;
+  if (phSession == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  for (i = 0; i < MAX_SESSIONS; i++)
+    if (!sessions[i].in_use)
+      break;
+
+  if (i == MAX_SESSIONS)
+    {
+      pthread_mutex_unlock (&p11_lock);
+      return CKR_SESSION_COUNT;
+    }
+
+  memset (&sessions[i], 0, sizeof (struct session));
+  sessions[i].in_use = 1;
+  sessions[i].flags = flags;
+  num_sessions++;
+  *phSession = i + 1;
+  pthread_mutex_unlock (&p11_lock);
+  return CKR_OK;
+}
+
+CK_RV
+C_CloseSession (CK_SESSION_HANDLE hSession)
+{
+  struct session *s;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+  pthread_mutex_lock (&p11_lock);
+  s = session_get (hSession);
+  if (s)
+    session_close (s);
+  pthread_mutex_unlock (&p11_lock);
+  return s ? CKR_OK : CKR_SESSION_HANDLE_INVALID;
+}
+
+CK_RV
+C_CloseAllSessions (CK_SLOT_ID slotID)
+{
+  int i;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (slotID != GNUK_SLOT_ID)
+    return CKR_SLOT_ID_INVALID;
+
+  pthread_mutex_lock (&p11_lock);
+  for (i = 0; i < MAX_SESSIONS; i++)
+    if (sessions[i].in_use)
+      session_close (&sessions[i]);
+  pthread_mutex_unlock (&p11_lock);
+  return CKR_OK;
+}
+
+CK_RV
+C_GetSessionInfo (CK_SESSION_HANDLE hSession, CK_SESSION_INFO_PTR pInfo)
+{
+  struct session *s;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (pInfo == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  s = session_get (hSession);
+  if (s)
+    {
+      pInfo->slotID = GNUK_SLOT_ID;
+      pInfo->flags = s->flags;
+      pInfo->ulDeviceError = 0;
+      if (s->flags & CKF_RW_SESSION)
+	pInfo->state = logged_in ? CKS_RW_USER_FUNCTIONS : CKS_RW_PUBLIC_SESSION;
+      else
+	pInfo->state = logged_in ? CKS_RO_USER_FUNCTIONS : CKS_RO_PUBLIC_SESSION;
+    }
+  pthread_mutex_unlock (&p11_lock);
+  return s ? CKR_OK : CKR_SESSION_HANDLE_INVALID;
+}
+
+CK_RV
+C_Login (CK_SESSION_HANDLE hSession, CK_USER_TYPE userType,
+	 CK_UTF8CHAR_PTR pPin, CK_ULONG ulPinLen)
+{
+  CK_RV rv = CKR_OK;
+  int sw;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (userType != CKU_USER && userType != CKU_CONTEXT_SPECIFIC)
+    return CKR_USER_TYPE_INVALID;
+  if (pPin == NULL)
+    return CKR_ARGUMENTS_BAD;
+  if (ulPinLen < 6 || ulPinLen > MAX_PIN_LEN)
+    return CKR_PIN_LEN_RANGE;
+
+  pthread_mutex_lock (&p11_lock);
+  if (session_get (hSession) == NULL)
+    {
+      rv = CKR_SESSION_HANDLE_INVALID;
+      goto out;
+    }
+
+  if (userType == CKU_USER && logged_in)
+    {
+      rv = CKR_USER_ALREADY_LOGGED_IN;
+      goto out;
+    }
+  else if (userType == CKU_CONTEXT_SPECIFIC && !logged_in)
+    {
+      rv = CKR_USER_NOT_LOGGED_IN;
+      goto out;
+    }
+
+  sw = card_verify (0x81, pPin, ulPinLen);
+  if (sw == SW_SUCCESS && userType == CKU_USER)
+    sw = card_verify (0x82, pPin, ulPinLen);
+
+  if (sw == SW_SUCCESS)
+    logged_in = 1;
+  else
+    {
+      card_reset_status ();
+      if (sw == SW_SECURITY_FAILURE)
+	rv = CKR_PIN_INCORRECT;
+      else
+	rv = sw_to_rv (sw, CKR_PIN_INCORRECT);
+    }
+
+ out:
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+CK_RV
+C_Logout (CK_SESSION_HANDLE hSession)
+{
+  CK_RV rv = CKR_OK;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+  pthread_mutex_lock (&p11_lock);
+  if (session_get (hSession) == NULL)
+    rv = CKR_SESSION_HANDLE_INVALID;
+  else if (!logged_in)
+    rv = CKR_USER_NOT_LOGGED_IN;
+  else
+    logout ();
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+
+/*
+ * Object management.
+ */
+CK_RV
+C_GetAttributeValue (CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject,
+		     CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
+{
+  CK_RV rv = CKR_OK;
+  CK_ULONG i;
+  int k, is_private;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (pTemplate == NULL && ulCount)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  if (session_get (hSession) == NULL)
+    {
+      rv = CKR_SESSION_HANDLE_INVALID;
+      goto out;
+    }
+
+  k = object_key (hObject, &is_private);
+  if (k < 0)
+    {
+      rv = CKR_OBJECT_HANDLE_INVALID;
+      goto out;
+    }
+
+  for (i = 0; i < ulCount; i++)
+    {
+      const void *value;
+      CK_ULONG len;
+
+      if (object_attribute (k, is_private, pTemplate[i].type, &value, &len)
+	  != CKR_OK)
+	{
+	  pTemplate[i].ulValueLen = CK_UNAVAILABLE_INFORMATION;
+	  rv = CKR_ATTRIBUTE_TYPE_INVALID;
+	}
+      else if (pTemplate[i].pValue == NULL)
+	pTemplate[i].ulValueLen = len;
+      else if (pTemplate[i].ulValueLen < len)
+	{
+	  pTemplate[i].ulValueLen = CK_UNAVAILABLE_INFORMATION;
+	  rv = CKR_BUFFER_TOO_SMALL;
+	}
+      else
+	{
+	  memcpy (pTemplate[i].pValue, value, len);
+	  pTemplate[i].ulValueLen = len;
+	}
+    }
+
+ out:
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+CK_RV
+C_FindObjectsInit (CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate,
+		   CK_ULONG ulCount)
+{
+  CK_RV rv = CKR_OK;
+  struct session *s;
+  CK_OBJECT_HANDLE h;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (pTemplate == NULL && ulCount)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  s = session_get (hSession);
+  if (s == NULL)
+    rv = CKR_SESSION_HANDLE_INVALID;
+  else if (s->find_active)
+    rv = CKR_OPERATION_ACTIVE;
+  else
+    {
+      s->find_active = 1;
+      s->found_num = s->found_pos = 0;
+      for (h = 1; h <= NUM_KEYS * 2; h++)
+	{
+	  int k, is_private;
+
+	  k = object_key (h, &is_private);
+	  if (k >= 0 && object_match (k, is_private, pTemplate, ulCount))
+	    s->found[s->found_num++] = h;
+	}
+    }
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+CK_RV
+C_FindObjects (CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE_PTR phObject,
+	       CK_ULONG ulMaxObjectCount, CK_ULONG_PTR pulObjectCount)
+{
+  CK_RV rv = CKR_OK;
+  struct session *s;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (phObject == NULL || pulObjectCount == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  s = session_get (hSession);
+  if (s == NULL)
+    rv = CKR_SESSION_HANDLE_INVALID;
+  else if (!s->find_active)
+    rv = CKR_OPERATION_NOT_INITIALIZED;
+  else
+    {
+      CK_ULONG n = 0;
+
+      while (n < ulMaxObjectCount && s->found_pos < s->found_num)
+	phObject[n++] = s->found[s->found_pos++];
+      *pulObjectCount = n;
+    }
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+CK_RV
+C_FindObjectsFinal (CK_SESSION_HANDLE hSession)
+{
+  CK_RV rv = CKR_OK;
+  struct session *s;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+
+  pthread_mutex_lock (&p11_lock);
+  s = session_get (hSession);
+  if (s == NULL)
+    rv = CKR_SESSION_HANDLE_INVALID;
+  else if (!s->find_active)
+    rv = CKR_OPERATION_NOT_INITIALIZED;
+  else
+    s->find_active = 0;
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+
+/*
+ * Signing and decryption.
+ */
+static CK_RV
+op_init (CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
+	 CK_OBJECT_HANDLE hKey, int op)
+{
+  CK_RV rv = CKR_OK;
+  struct session *s;
+  int k, is_private;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (pMechanism == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  s = session_get (hSession);
+  if (s == NULL)
+    {
+      rv = CKR_SESSION_HANDLE_INVALID;
+      goto out;
+    }
+
+  if (s->op != OP_NONE)
+    {
+      rv = CKR_OPERATION_ACTIVE;
+      goto out;
+    }
+
+  k = object_key (hKey, &is_private);
+  if (k < 0 || !is_private)
+    {
+      rv = CKR_KEY_HANDLE_INVALID;
+      goto out;
+    }
+
+  if ((op == OP_SIGN && k == KEY_DEC) || (op == OP_DECRYPT && k != KEY_DEC))
+    {
+      rv = CKR_KEY_FUNCTION_NOT_PERMITTED;
+      goto out;
+    }
+
+  if ((pMechanism->mechanism == CKM_RSA_PKCS && keys[k].key_type == CKK_RSA)
+      || (op == OP_SIGN && pMechanism->mechanism == CKM_ECDSA
+	  && keys[k].key_type == CKK_EC)
+      || (op == OP_SIGN && pMechanism->mechanism == CKM_EDDSA
+	  && keys[k].key_type == CKK_EC_EDWARDS))
+    {
+      s->op = op;
+      s->op_key = k;
+      s->op_mech = pMechanism->mechanism;
+    }
+  else
+    rv = CKR_MECHANISM_INVALID;
+
+ out:
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+/*
+ * Run the operation of session S on the engine.  When the PIN is only
+ * valid for one signature (PW status byte 0), the second signature
+ * fails with SW_SECURITY_FAILURE (CKR_USER_NOT_LOGGED_IN) until the
+ * application logs in with CKU_CONTEXT_SPECIFIC again.
+ */
+static int
+op_run (struct session *s, CK_BYTE_PTR data, CK_ULONG len)
+{
+  uint8_t buf[1 + 512];
+
+  if (s->op == OP_DECRYPT)
+    {
+      if (len > sizeof buf - 1)
+	return SW_CONDITION_NOT_SATISFIED;
+      buf[0] = 0x00;		/* Padding indicator */
+      memcpy (buf + 1, data, len);
+      return card_transmit (0x2a, 0x80, 0x86, buf, len + 1);
+    }
+  else if (s->op_key == KEY_SIG)
+    return card_transmit (0x2a, 0x9e, 0x9a, data, len);
+  else
+    return card_transmit (0x88, 0x00, 0x00, data, len);
+}
+
+CK_RV
+C_SignInit (CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
+	    CK_OBJECT_HANDLE hKey)
+{
+  return op_init (hSession, pMechanism, hKey, OP_SIGN);
+}
+
+CK_RV
+C_DecryptInit (CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
+	       CK_OBJECT_HANDLE hKey)
+{
+  return op_init (hSession, pMechanism, hKey, OP_DECRYPT);
+}
+
+static CK_RV
+op_final (CK_SESSION_HANDLE hSession, int op,
+	  CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+	  CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+  CK_RV rv;
+  struct session *s;
+  struct key_info *ki;
+  CK_ULONG out_len;
+  int sw;
+
+  if (!p11_initialized)
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  if (pIn == NULL || pulOutLen == NULL)
+    return CKR_ARGUMENTS_BAD;
+
+  pthread_mutex_lock (&p11_lock);
+  s = session_get (hSession);
+  if (s == NULL)
+    {
+      rv = CKR_SESSION_HANDLE_INVALID;
+      goto out;
+    }
+
+  if (s->op != op)
+    {
+      rv = CKR_OPERATION_NOT_INITIALIZED;
+      goto out;
+    }
+
+  ki = &keys[s->op_key];
+  if (ki->key_type == CKK_RSA)
+    out_len = (ki->modulus_bits + 7) / 8;
+  else
+    out_len = 64;
+
+  if (pOut == NULL)
+    {
+      /* Size query; the operation stays active.  */
+      *pulOutLen = out_len;
+      rv = CKR_OK;
+      goto out;
+    }
+
+  if (op == OP_SIGN && *pulOutLen < out_len)
+    {
+      *pulOutLen = out_len;
+      rv = CKR_BUFFER_TOO_SMALL;
+      goto out;
+    }
+
+  sw = op_run (s, pIn, ulInLen);
+  if (sw != SW_SUCCESS)
+    rv = sw_to_rv (sw, op == OP_SIGN ? CKR_DATA_LEN_RANGE
+		   : CKR_ENCRYPTED_DATA_LEN_RANGE);
+  else if (*pulOutLen < card_res_len)
+    {
+      /* Decrypted message is shorter than modulus, usually.  */
+      *pulOutLen = card_res_len;
+      rv = CKR_BUFFER_TOO_SMALL;
+      memset (card_res, 0, card_res_len);
+      goto out;
+    }
+  else
+    {
+      memcpy (pOut, card_res, card_res_len);
+      *pulOutLen = card_res_len;
+      rv = CKR_OK;
+    }
+
+  memset (card_res, 0, card_res_len);
+  s->op = OP_NONE;
+
+ out:
+  pthread_mutex_unlock (&p11_lock);
+  return rv;
+}
+
+CK_RV
+C_Sign (CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+	CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+  return op_final (hSession, OP_SIGN, pData, ulDataLen,
+		   pSignature, pulSignatureLen);
+}
+
+CK_RV
+C_Decrypt (CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedData,
+	   CK_ULONG ulEncryptedDataLen, CK_BYTE_PTR pData,
+	   CK_ULONG_PTR pulDataLen)
+{
+  return op_final (hSession, OP_DECRYPT, pEncryptedData, ulEncryptedDataLen,
+		   pData, pulDataLen);
+}
+
+
+/*
+ * Functions which are not supported.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+#define NOT_SUPPORTED(name, args)		\
+  CK_RV name args				\
+  {						\
+    return CKR_FUNCTION_NOT_SUPPORTED;		\
+  }
+
+NOT_SUPPORTED (C_InitToken, (CK_SLOT_ID a, CK_UTF8CHAR_PTR b, CK_ULONG c,
+			     CK_UTF8CHAR_PTR d))
+NOT_SUPPORTED (C_InitPIN, (CK_SESSION_HANDLE a, CK_UTF8CHAR_PTR b,
+			   CK_ULONG c))
+NOT_SUPPORTED (C_SetPIN, (CK_SESSION_HANDLE a, CK_UTF8CHAR_PTR b, CK_ULONG c,
+			  CK_UTF8CHAR_PTR d, CK_ULONG e))
+NOT_SUPPORTED (C_GetOperationState, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				     CK_ULONG_PTR c))
+NOT_SUPPORTED (C_SetOperationState, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				     CK_ULONG c, CK_OBJECT_HANDLE d,
+				     CK_OBJECT_HANDLE e))
+NOT_SUPPORTED (C_CreateObject, (CK_SESSION_HANDLE a, CK_ATTRIBUTE_PTR b,
+				CK_ULONG c, CK_OBJECT_HANDLE_PTR d))
+NOT_SUPPORTED (C_CopyObject, (CK_SESSION_HANDLE a, CK_OBJECT_HANDLE b,
+			      CK_ATTRIBUTE_PTR c, CK_ULONG d,
+			      CK_OBJECT_HANDLE_PTR e))
+NOT_SUPPORTED (C_DestroyObject, (CK_SESSION_HANDLE a, CK_OBJECT_HANDLE b))
+NOT_SUPPORTED (C_GetObjectSize, (CK_SESSION_HANDLE a, CK_OBJECT_HANDLE b,
+				 CK_ULONG_PTR c))
+NOT_SUPPORTED (C_SetAttributeValue, (CK_SESSION_HANDLE a, CK_OBJECT_HANDLE b,
+				     CK_ATTRIBUTE_PTR c, CK_ULONG d))
+NOT_SUPPORTED (C_EncryptInit, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+			       CK_OBJECT_HANDLE c))
+NOT_SUPPORTED (C_Encrypt, (CK_SESSION_HANDLE a, CK_BYTE_PTR b, CK_ULONG c,
+			   CK_BYTE_PTR d, CK_ULONG_PTR e))
+NOT_SUPPORTED (C_EncryptUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				 CK_ULONG c, CK_BYTE_PTR d, CK_ULONG_PTR e))
+NOT_SUPPORTED (C_EncryptFinal, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				CK_ULONG_PTR c))
+NOT_SUPPORTED (C_DecryptUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				 CK_ULONG c, CK_BYTE_PTR d, CK_ULONG_PTR e))
+NOT_SUPPORTED (C_DecryptFinal, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				CK_ULONG_PTR c))
+NOT_SUPPORTED (C_DigestInit, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b))
+NOT_SUPPORTED (C_Digest, (CK_SESSION_HANDLE a, CK_BYTE_PTR b, CK_ULONG c,
+			  CK_BYTE_PTR d, CK_ULONG_PTR e))
+NOT_SUPPORTED (C_DigestUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				CK_ULONG c))
+NOT_SUPPORTED (C_DigestKey, (CK_SESSION_HANDLE a, CK_OBJECT_HANDLE b))
+NOT_SUPPORTED (C_DigestFinal, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+			       CK_ULONG_PTR c))
+NOT_SUPPORTED (C_SignUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b, CK_ULONG c))
+NOT_SUPPORTED (C_SignFinal, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+			     CK_ULONG_PTR c))
+NOT_SUPPORTED (C_SignRecoverInit, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+				   CK_OBJECT_HANDLE c))
+NOT_SUPPORTED (C_SignRecover, (CK_SESSION_HANDLE a, CK_BYTE_PTR b, CK_ULONG c,
+			       CK_BYTE_PTR d, CK_ULONG_PTR e))
+NOT_SUPPORTED (C_VerifyInit, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+			      CK_OBJECT_HANDLE c))
+NOT_SUPPORTED (C_Verify, (CK_SESSION_HANDLE a, CK_BYTE_PTR b, CK_ULONG c,
+			  CK_BYTE_PTR d, CK_ULONG e))
+NOT_SUPPORTED (C_VerifyUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				CK_ULONG c))
+NOT_SUPPORTED (C_VerifyFinal, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+			       CK_ULONG c))
+NOT_SUPPORTED (C_VerifyRecoverInit, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+				     CK_OBJECT_HANDLE c))
+NOT_SUPPORTED (C_VerifyRecover, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				 CK_ULONG c, CK_BYTE_PTR d, CK_ULONG_PTR e))
+NOT_SUPPORTED (C_DigestEncryptUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				       CK_ULONG c, CK_BYTE_PTR d,
+				       CK_ULONG_PTR e))
+NOT_SUPPORTED (C_DecryptDigestUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				       CK_ULONG c, CK_BYTE_PTR d,
+				       CK_ULONG_PTR e))
+NOT_SUPPORTED (C_SignEncryptUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				     CK_ULONG c, CK_BYTE_PTR d,
+				     CK_ULONG_PTR e))
+NOT_SUPPORTED (C_DecryptVerifyUpdate, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				       CK_ULONG c, CK_BYTE_PTR d,
+				       CK_ULONG_PTR e))
+NOT_SUPPORTED (C_GenerateKey, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+			       CK_ATTRIBUTE_PTR c, CK_ULONG d,
+			       CK_OBJECT_HANDLE_PTR e))
+NOT_SUPPORTED (C_GenerateKeyPair, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+				   CK_ATTRIBUTE_PTR c, CK_ULONG d,
+				   CK_ATTRIBUTE_PTR e, CK_ULONG f,
+				   CK_OBJECT_HANDLE_PTR g,
+				   CK_OBJECT_HANDLE_PTR h))
+NOT_SUPPORTED (C_WrapKey, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+			   CK_OBJECT_HANDLE c, CK_OBJECT_HANDLE d,
+			   CK_BYTE_PTR e, CK_ULONG_PTR f))
+NOT_SUPPORTED (C_UnwrapKey, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+			     CK_OBJECT_HANDLE c, CK_BYTE_PTR d, CK_ULONG e,
+			     CK_ATTRIBUTE_PTR f, CK_ULONG g,
+			     CK_OBJECT_HANDLE_PTR h))
+NOT_SUPPORTED (C_DeriveKey, (CK_SESSION_HANDLE a, CK_MECHANISM_PTR b,
+			     CK_OBJECT_HANDLE c, CK_ATTRIBUTE_PTR d,
+			     CK_ULONG e, CK_OBJECT_HANDLE_PTR f))
+NOT_SUPPORTED (C_SeedRandom, (CK_SESSION_HANDLE a, CK_BYTE_PTR b, CK_ULONG c))
+NOT_SUPPORTED (C_GenerateRandom, (CK_SESSION_HANDLE a, CK_BYTE_PTR b,
+				  CK_ULONG c))
+NOT_SUPPORTED (C_WaitForSlotEvent, (CK_FLAGS a, CK_SLOT_ID_PTR b,
+				    CK_VOID_PTR c))
+
+CK_RV
+C_GetFunctionStatus (CK_SESSION_HANDLE hSession)
+{
+  return CKR_FUNCTION_NOT_PARALLEL;
+}
+
+CK_RV
+C_CancelFunction (CK_SESSION_HANDLE hSession)
+{
+  return CKR_FUNCTION_NOT_PARALLEL;
+}
+
+#pragma GCC diagnostic pop
+
+
+CK_FUNCTION_LIST gnuk_function_list = {
+  { 2, 20 },
+  C_Initialize, C_Finalize, C_GetInfo, C_GetFunctionList,
+  C_GetSlotList, C_GetSlotInfo, C_GetTokenInfo,
+  C_GetMechanismList, C_GetMechanismInfo,
+  C_InitToken, C_InitPIN, C_SetPIN,
+  C_OpenSession, C_CloseSession, C_CloseAllSessions, C_GetSessionInfo,
+  C_GetOperationState, C_SetOperationState,
+  C_Login, C_Logout,
+  C_CreateObject, C_CopyObject, C_DestroyObject, C_GetObjectSize,
+  C_GetAttributeValue, C_SetAttributeValue,
+  C_FindObjectsInit, C_FindObjects, C_FindObjectsFinal,
+  C_EncryptInit, C_Encrypt, C_EncryptUpdate, C_EncryptFinal,
+  C_DecryptInit, C_Decrypt, C_DecryptUpdate, C_DecryptFinal,
+  C_DigestInit, C_Digest, C_DigestUpdate, C_DigestKey, C_DigestFinal,
+  C_SignInit, C_Sign, C_SignUpdate, C_SignFinal,
+  C_SignRecoverInit, C_SignRecover,
+  C_VerifyInit, C_Verify, C_VerifyUpdate, C_VerifyFinal,
+  C_VerifyRecoverInit, C_VerifyRecover,
+  C_DigestEncryptUpdate, C_DecryptDigestUpdate,
+  C_SignEncryptUpdate, C_DecryptVerifyUpdate,
+  C_GenerateKey, C_GenerateKeyPair, C_WrapKey, C_UnwrapKey, C_DeriveKey,
+  C_SeedRandom, C_GenerateRandom,
+  C_GetFunctionStatus, C_CancelFunction,
+  C_WaitForSlotEvent
+};
@@ -38,6 +38,10 @@
 #include "polarssl/bn_mul.h"
 
 #include <gnuk-malloc.h>
+#if defined(CRYPTO_WORKER_SUPPORT)
+#include <crypto-worker.h>
+#endif
+#include <opcount.h>
 
 #define ciL    (sizeof(t_uint))         /* chars in limb  */
 #define biL    (ciL << 3)               /* bits  in limb  */
@@ -1454,6 +1458,8 @@ static void mpi_montmul( size_t n, const t_uint *np, t_uint mm, t_uint *d,
     size_t i;
     t_uint u0, u1, c = 0;
 
+    OPCOUNT( OPC_MONTMUL );
+
     for( i = 0; i < n; i++ )
     {
         /*
@@ -1677,17 +1683,14 @@ int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR )
 {
     int ret;
     size_t i = mpi_msb( E );
-    size_t wsize = ( i > 1024 ) ? MAX_WSIZE :
-      		   ( i > 671 ) ? 6 : ( i > 239 ) ? 5 :
+    size_t wsize = ( i > 671 ) ? 6 : ( i > 239 ) ? 5 :
                    ( i >  79 ) ? 4 : ( i >  23 ) ? 3 : 1;
     size_t wbits, one = 1;
     size_t nblimbs;
     size_t bufsize, nbits;
     t_uint ei, mm, state;
     mpi RR;
-    t_uint d[N->n*2];
-    t_uint w1[N->n];
-    t_uint wn[(one << (wsize - 1))][N->n];
+    t_uint *d, *w1, *wn;
 
     if( mpi_cmp_int( N, 0 ) < 0 || ( N->p[0] & 1 ) == 0 )
         return( POLARSSL_ERR_MPI_BAD_INPUT_DATA );
@@ -1698,6 +1701,27 @@ int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR )
     if( A->s == -1 )
         return( POLARSSL_ERR_MPI_BAD_INPUT_DATA );
 
+    /*
+     * Limited by size of the scratch memory.  On 20KB parts, it's also
+     * for 1024-bit exponent (CRT of RSA-2048): window of 6 needs 3KB
+     * more, for 2% fewer multiplications.
+     */
+#if MEMORY_SIZE >= 24
+    if( i > 1024 && wsize > MAX_WSIZE )
+#else
+    if( wsize > MAX_WSIZE )
+#endif
+        wsize = MAX_WSIZE;
+
+    /*
+     * D (two), W1 and WN (window table) from scratch memory, not stack
+     */
+    d = gnuk_scratch_alloc( ( 3 + ( one << ( wsize - 1 ) ) ) * N->n * ciL );
+    if( d == NULL )
+        return( POLARSSL_ERR_MPI_MALLOC_FAILED );
+    w1 = d + N->n * 2;
+    wn = w1 + N->n;
+
     /*
      * Init temps and window size
      */
@@ -1750,7 +1774,7 @@ int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR )
          */
         for( i = 0; i < wsize - 1; i++ )
             mpi_montsqr( N->n, N->p, mm, d );
-        memcpy (wn[0], d + N->n, N->n * ciL);
+        memcpy (wn, d + N->n, N->n * ciL);
 
         /*
          * W[i] = W[i - 1] * W[1]
@@ -1758,7 +1782,7 @@ int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR )
         for( i = 1; i < (one << (wsize - 1)); i++ )
         {
             mpi_montmul( N->n, N->p, mm, d, w1 );
-            memcpy (wn[i], d + N->n, N->n * ciL);
+            memcpy (wn + i * N->n, d + N->n, N->n * ciL);
         }
     }
 
@@ -1822,7 +1846,8 @@ int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR )
             /*
              * X = X * W[wbits] R^-1 mod N
              */
-            mpi_montmul( N->n, N->p, mm, d, wn[wbits - (one << (wsize - 1))]);
+            mpi_montmul( N->n, N->p, mm, d,
+                         wn + (wbits - (one << (wsize - 1))) * N->n );
 
             state--;
             nbits = 0;
@@ -1851,6 +1876,7 @@ int mpi_exp_mod( mpi *X, const mpi *A, const mpi *E, const mpi *N, mpi *_RR )
 
 cleanup:
 
+    gnuk_scratch_free( d );
     if( _RR == NULL )
         mpi_free( &RR );
 
@@ -2087,13 +2113,12 @@ static const int small_prime[] =
 struct jkiss_state { uint32_t x, y, z, c; };
 static struct jkiss_state jkiss_state_v;
 
-int prng_seed (int (*f_rng)(void *, unsigned char *, size_t),
-               void *p_rng)
+static int jkiss_seed (struct jkiss_state *s,
+                       int (*f_rng)(void *, unsigned char *, size_t),
+                       void *p_rng)
 {
   int ret;
 
-  struct jkiss_state *s = &jkiss_state_v;
-
   MPI_CHK ( f_rng (p_rng, (unsigned char *)s, sizeof (struct jkiss_state)) );
   while (s->y == 0)
     MPI_CHK ( f_rng (p_rng, (unsigned char *)&s->y, sizeof (uint32_t)) );
@@ -2103,6 +2128,12 @@ cleanup:
   return ret;
 }
 
+int prng_seed (int (*f_rng)(void *, unsigned char *, size_t),
+               void *p_rng)
+{
+  return jkiss_seed (&jkiss_state_v, f_rng, p_rng);
+}
+
 static uint32_t
 jkiss (struct jkiss_state *s)
 {
@@ -2119,7 +2150,8 @@ jkiss (struct jkiss_state *s)
   return s->x + s->y + s->z;
 }
 
-static int mpi_fill_pseudo_random ( mpi *X, size_t size)
+static int mpi_fill_pseudo_random ( mpi *X, size_t size,
+                                    struct jkiss_state *s )
 {
   int ret;
   uint32_t *p, *p_end;
@@ -2129,12 +2161,12 @@ static int mpi_fill_pseudo_random ( mpi *X, size_t size)
 
   /* Assume little endian.  */
   p = (uint32_t *)X->p;
-  p_end = (uint32_t *)(X->p + (size/sizeof (uint32_t)));
+  p_end = p + (size/sizeof (uint32_t));
   while (p < p_end)
-    *p++ = jkiss (&jkiss_state_v);
+    *p++ = jkiss (s);
 
   if ((size%sizeof (uint32_t)))
-    *p = jkiss (&jkiss_state_v) & ((1 << (8*(size % sizeof (uint32_t)))) - 1);
+    *p = jkiss (s) & ((1 << (8*(size % sizeof (uint32_t)))) - 1);
 
 cleanup:
   return ret;
@@ -2144,7 +2176,7 @@ cleanup:
  * Miller-Rabin primality test  (HAC 4.24)
  */
 static
-int mpi_is_prime( mpi *X)
+int mpi_is_prime( mpi *X, struct jkiss_state *s_rng )
 {
     int ret, xs;
     size_t i, j, n, s;
@@ -2216,7 +2248,7 @@ int mpi_is_prime( mpi *X)
         /*
          * pick a random A, 1 < A < |X| - 1
          */
-        MPI_CHK( mpi_fill_pseudo_random( &A, X->n * ciL ) );
+        MPI_CHK( mpi_fill_pseudo_random( &A, X->n * ciL, s_rng ) );
 
         if( mpi_cmp_mpi( &A, &W ) >= 0 )
         {
@@ -2325,6 +2357,48 @@ static const t_uint limbs_MAX_A[] = { /* Little endian */
 
 static const mpi MAX_A[1] = {{ 1, MAX_A_LIMBS, (t_uint *)limbs_MAX_A }};
 
+/*
+ * Candidate of prime: X = (MAX_A - A) * M + B, with random A.
+ * Retry until it is big enough.
+ */
+static int prime_candidate( mpi *X, const mpi *B,
+                            int (*f_rng)(void *, unsigned char *, size_t),
+                            void *p_rng )
+{
+  int ret;
+
+  do
+    {
+      MPI_CHK( mpi_fill_random( X, MAX_A_FILL_SIZE, f_rng, p_rng ) );
+      MPI_CHK ( mpi_sub_abs (X, MAX_A, X) );
+
+      MPI_CHK ( mpi_mul_mpi ( X, X, M ) );
+      MPI_CHK ( mpi_add_abs ( X, X, B ) );
+    }
+  while (X->n <= M_LIMBS || (X->p[M_LIMBS-1] & 0xc0000000) == 0);
+
+cleanup:
+  return ret;
+}
+
+#if defined(CRYPTO_WORKER_SUPPORT)
+/*
+ * Each test has its own PRNG state, so that it can run on a worker.
+ */
+struct prime_test {
+  mpi *X;
+  struct jkiss_state s;
+  int ret;
+};
+
+static void prime_test_run (void *arg)
+{
+  struct prime_test *t = (struct prime_test *)arg;
+
+  t->ret = mpi_is_prime ( t->X, &t->s );
+}
+#endif
+
 /*
  * Prime number generation
  *
@@ -2336,12 +2410,18 @@ int mpi_gen_prime( mpi *X, size_t nbits, int dh_flag,
 {
   int ret;
   mpi B[1], G[1];
+#if defined(CRYPTO_WORKER_SUPPORT)
+  mpi Y[1];
+#endif
 
   (void)dh_flag;
   if (nbits != 1024)
     return POLARSSL_ERR_MPI_BAD_INPUT_DATA;
 
   mpi_init ( B );  mpi_init ( G );
+#if defined(CRYPTO_WORKER_SUPPORT)
+  mpi_init ( Y );
+#endif
 
   /*
    * Get random value 1 to M-1 avoiding bias, and proceed when it is
@@ -2363,23 +2443,54 @@ int mpi_gen_prime( mpi *X, size_t nbits, int dh_flag,
    * Get random value avoiding bias, comput P with the value,
    * check if it's big enough, lastly, check if it's prime.
    */
+#if defined(CRYPTO_WORKER_SUPPORT)
+  /* Test two candidates at a time.  */
   while (1)
     {
-      MPI_CHK( mpi_fill_random( X, MAX_A_FILL_SIZE, f_rng, p_rng ) );
-      MPI_CHK ( mpi_sub_abs (X, MAX_A, X) );
+      struct prime_test t0, t1;
 
-      MPI_CHK ( mpi_mul_mpi ( X, X, M ) );
-      MPI_CHK ( mpi_add_abs ( X, X, B ) );
-      if (X->n <= M_LIMBS || (X->p[M_LIMBS-1] & 0xc0000000) == 0)
-        continue;
-      ret = mpi_is_prime ( X );
+      MPI_CHK ( prime_candidate ( X, B, f_rng, p_rng ) );
+      MPI_CHK ( prime_candidate ( Y, B, f_rng, p_rng ) );
+
+      /*
+       * The second test has its own state seeded by F_RNG, so that
+       * its bases are independent of the first one's.
+       */
+      t0.X = X;
+      t0.s = jkiss_state_v;
+      t1.X = Y;
+      MPI_CHK ( jkiss_seed ( &t1.s, f_rng, p_rng ) );
+      crypto_worker_run_pair (prime_test_run, &t0, prime_test_run, &t1);
+      jkiss_state_v = t0.s;
+
+      ret = t0.ret;
+      if (ret == 0 || ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE)
+        break;
+      ret = t1.ret;
+      if (ret == 0)
+        {
+          mpi_swap ( X, Y );
+          break;
+        }
+      else if (ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE)
+        break;
+    }
+#else
+  while (1)
+    {
+      MPI_CHK ( prime_candidate ( X, B, f_rng, p_rng ) );
+      ret = mpi_is_prime ( X, &jkiss_state_v );
       if (ret == 0 || ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE)
         break;
     }
+#endif
 
 cleanup:
 
   mpi_free ( B );  mpi_free ( G );
+#if defined(CRYPTO_WORKER_SUPPORT)
+  mpi_free ( Y );
+#endif
 
   return ret;
 }
@@ -41,6 +41,10 @@
 
 #include <stdio.h>
 
+#if defined(CRYPTO_WORKER_SUPPORT)
+#include <crypto-worker.h>
+#endif
+
 /*
  * Initialize an RSA context
  */
@@ -251,6 +255,92 @@ cleanup:
     return( 0 );
 }
 
+#if defined(CRYPTO_WORKER_SUPPORT)
+/*
+ * The two halves of CRT are independent; compute them concurrently.
+ */
+struct exp_mod_job
+{
+    mpi *X;
+    const mpi *A, *E, *N;
+    mpi *RR;
+    int ret;
+};
+
+static void exp_mod_job_run( void *arg )
+{
+    struct exp_mod_job *j = (struct exp_mod_job *)arg;
+
+    j->ret = mpi_exp_mod( j->X, j->A, j->E, j->N, j->RR );
+}
+#endif
+
+#if !defined(POLARSSL_RSA_NO_CRT)
+/*
+ * Generate or update blinding values, see section 10 of:
+ *  KOCHER, Paul C. Timing attacks on implementations of Diffie-Hellman, RSA,
+ *  DSS, and other systems. In : Advances in Cryptology-CRYPTO'96. Springer
+ *  Berlin Heidelberg, 1996. p. 104-113.
+ *
+ * A fresh pair costs an exponentiation, so it is kept in the context and
+ * updated by squaring, for later operations.  On error, the pair is
+ * cleared.
+ */
+static int rsa_prepare_blinding( rsa_context *ctx,
+                 int (*f_rng)(void *, unsigned char *, size_t), void *p_rng )
+{
+    int ret, count = 0;
+    mpi T;
+
+    mpi_init( &T );
+
+    if( ctx->Vf.p != NULL )
+    {
+        /*
+         * (Vi^2, Vf^2) is a pair, too.  Copy back from T, so that the
+         * pair keeps the size of N.
+         */
+        MPI_CHK( mpi_mul_mpi( &T, &ctx->Vi, &ctx->Vi ) );
+        MPI_CHK( mpi_mod_mpi( &T, &T, &ctx->N ) );
+        mpi_free( &ctx->Vi );
+        MPI_CHK( mpi_copy( &ctx->Vi, &T ) );
+
+        MPI_CHK( mpi_mul_mpi( &T, &ctx->Vf, &ctx->Vf ) );
+        MPI_CHK( mpi_mod_mpi( &T, &T, &ctx->N ) );
+        mpi_free( &ctx->Vf );
+        MPI_CHK( mpi_copy( &ctx->Vf, &T ) );
+        goto cleanup;
+    }
+
+    /* Unblinding value: Vf = random number, invertible mod N */
+    do {
+        if( count++ > 10 )
+        {
+            ret = POLARSSL_ERR_RSA_RNG_FAILED;
+            goto cleanup;
+        }
+
+        MPI_CHK( mpi_fill_random( &ctx->Vf, ctx->len - 1, f_rng, p_rng ) );
+        MPI_CHK( mpi_gcd( &T, &ctx->Vf, &ctx->N ) );
+    } while( mpi_cmp_int( &T, 1 ) != 0 );
+
+    /* Blinding value: Vi =  Vf^(-e) mod N */
+    MPI_CHK( mpi_inv_mod( &T, &ctx->Vf, &ctx->N ) );
+    MPI_CHK( mpi_exp_mod( &T, &T, &ctx->E, &ctx->N, &ctx->RN ) );
+    MPI_CHK( mpi_copy( &ctx->Vi, &T ) );
+
+cleanup:
+    mpi_free( &T );
+
+    if( ret != 0 )
+    {
+        mpi_free( &ctx->Vi ); mpi_free( &ctx->Vf );
+    }
+
+    return( ret );
+}
+#endif
+
 /*
  * Do an RSA private key operation
  */
@@ -262,10 +352,9 @@ int rsa_private( rsa_context *ctx,
 {
     int ret;
     size_t olen;
-    mpi T, T1, T2, Vi, Vf;
+    mpi T, T1, T2;
 
     mpi_init( &T ); mpi_init( &T1 ); mpi_init( &T2 );
-    mpi_init( &Vi ); mpi_init( &Vf );
 
     MPI_CHK( mpi_read_binary( &T, input, ctx->len ) );
 
@@ -288,19 +377,8 @@ int rsa_private( rsa_context *ctx,
          * Blinding
          * T = T * Vi mod N
          */
-        /* Unblinding value: Vf = random number */
-        MPI_CHK( mpi_fill_random( &Vf, ctx->len - 1, f_rng, p_rng ) );
-
-        /* Mathematically speaking, the algorithm should check Vf
-         * against 0, P and Q (Vf should be relatively prime to N, and 0 < Vf < N),
-         * so that Vf^-1 exists.
-         */
-
-        /* Blinding value: Vi =  Vf^(-e) mod N */
-        MPI_CHK( mpi_inv_mod( &Vi, &Vf, &ctx->N ) );
-        MPI_CHK( mpi_exp_mod( &Vi, &Vi, &ctx->E, &ctx->N, &ctx->RN ) );
-
-        MPI_CHK( mpi_mul_mpi( &T, &T, &Vi ) );
+        MPI_CHK( rsa_prepare_blinding( ctx, f_rng, p_rng ) );
+        MPI_CHK( mpi_mul_mpi( &T, &T, &ctx->Vi ) );
         MPI_CHK( mpi_mod_mpi( &T, &T, &ctx->N ) );
     }
 
@@ -310,8 +388,19 @@ int rsa_private( rsa_context *ctx,
      * T1 = input ^ dP mod P
      * T2 = input ^ dQ mod Q
      */
+#if defined(CRYPTO_WORKER_SUPPORT)
+    {
+        struct exp_mod_job j1 = { &T1, &T, &ctx->DP, &ctx->P, &ctx->RP, 0 };
+        struct exp_mod_job j2 = { &T2, &T, &ctx->DQ, &ctx->Q, &ctx->RQ, 0 };
+
+        crypto_worker_run_pair( exp_mod_job_run, &j1, exp_mod_job_run, &j2 );
+        MPI_CHK( j1.ret );
+        MPI_CHK( j2.ret );
+    }
+#else
     MPI_CHK( mpi_exp_mod( &T1, &T, &ctx->DP, &ctx->P, &ctx->RP ) );
     MPI_CHK( mpi_exp_mod( &T2, &T, &ctx->DQ, &ctx->Q, &ctx->RQ ) );
+#endif
 
     /*
      * T = (T1 - T2) * (Q^-1 mod P) mod P
@@ -332,7 +421,7 @@ int rsa_private( rsa_context *ctx,
          * Unblind
          * T = T * Vf mod N
          */
-        MPI_CHK( mpi_mul_mpi( &T, &T, &Vf ) );
+        MPI_CHK( mpi_mul_mpi( &T, &T, &ctx->Vf ) );
         MPI_CHK( mpi_mod_mpi( &T, &T, &ctx->N ) );
     }
 #endif
@@ -343,7 +432,6 @@ int rsa_private( rsa_context *ctx,
 cleanup:
 
     mpi_free( &T ); mpi_free( &T1 ); mpi_free( &T2 );
-    mpi_free( &Vi ); mpi_free( &Vf );
 
     if( ret != 0 )
         return( POLARSSL_ERR_RSA_PRIVATE_FAILED + ret );
@@ -1330,6 +1418,7 @@ int rsa_pkcs1_verify( rsa_context *ctx,
  */
 void rsa_free( rsa_context *ctx )
 {
+    mpi_free( &ctx->Vi ); mpi_free( &ctx->Vf );
     mpi_free( &ctx->RQ ); mpi_free( &ctx->RP ); mpi_free( &ctx->RN );
     mpi_free( &ctx->QP ); mpi_free( &ctx->DQ ); mpi_free( &ctx->DP );
     mpi_free( &ctx->Q  ); mpi_free( &ctx->P  ); mpi_free( &ctx->D );
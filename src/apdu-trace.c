@@ -0,0 +1,160 @@
+/*
+ * apdu-trace.c -- APDU trace of GNU/Linux emulation
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * A line is written for each command given to the OpenPGP thread,
+ * when its execution is finished:
+ *
+ *   TIME LATENCY CLA-INS-P1-P2 DATA LE RES-DATA SW
+ *
+ * TIME is when the command is received (since the start of the
+ * trace), LATENCY is the time of the execution, both in microseconds.
+ * DATA is after command chaining, LE is in decimal.  Empty DATA or
+ * RES-DATA is "-".  PINs and private keys are masked by "xx".  So is
+ * RES-DATA of DECIPHER (the session key), GET CHALLENGE (random
+ * numbers) and INTERNAL AUTHENTICATE (the response is a credential
+ * for the challenge).
+ *
+ * tool/gnuk_replay.py replays the trace.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "gnuk.h"
+
+static FILE *apdu_trace_fp;
+static uint64_t apdu_trace_start;
+static uint64_t apdu_trace_cmd_time;
+static char apdu_trace_cmd[(4 + MAX_CMD_APDU_DATA_SIZE) * 2 + 16];
+static char apdu_trace_res[MAX_RES_APDU_DATA_SIZE * 2 + 2];
+static int apdu_trace_res_masked;
+
+static uint64_t
+apdu_trace_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int
+apdu_trace_open (const char *path)
+{
+  apdu_trace_fp = fopen (path, "w");
+  if (apdu_trace_fp == NULL)
+    return -1;
+
+  fputs ("# Gnuk APDU trace 1\n", apdu_trace_fp);
+  apdu_trace_start = apdu_trace_now ();
+  return 0;
+}
+
+static int
+apdu_trace_secret (const uint8_t *head)
+{
+  uint8_t ins = head[1];
+
+  return (ins == 0x20		/* VERIFY */
+	  || ins == 0x24	/* CHANGE REFERENCE DATA */
+	  || ins == 0x2c	/* RESET RETRY COUNTER */
+	  || ins == 0xdb	/* PUT DATA (key import) */
+	  || (ins == 0xda && head[2] == 0x00 && head[3] == 0xd3));
+}
+
+static int
+apdu_trace_secret_response (const uint8_t *head)
+{
+  uint8_t ins = head[1];
+
+  return ((ins == 0x2a && head[2] == 0x80 && head[3] == 0x86) /* DECIPHER */
+	  || ins == 0x84	/* GET CHALLENGE */
+	  || ins == 0x88);	/* INTERNAL AUTHENTICATE */
+}
+
+static char *
+apdu_trace_hex (char *s, const uint8_t *p, size_t len, int masked)
+{
+  static const char hex[] = "0123456789abcdef";
+  size_t i;
+
+  if (len == 0)
+    *s++ = '-';
+
+  for (i = 0; i < len; i++)
+    if (masked)
+      {
+	*s++ = 'x';
+	*s++ = 'x';
+      }
+    else
+      {
+	*s++ = hex[p[i] >> 4];
+	*s++ = hex[p[i] & 0x0f];
+      }
+
+  *s = 0;
+  return s;
+}
+
+/*
+ * Called when a command is given to the OpenPGP thread.  The command
+ * is formatted here, as the buffer will be overwritten by response.
+ */
+void
+apdu_trace_command (const struct apdu *a)
+{
+  char *s = apdu_trace_cmd;
+
+  if (apdu_trace_fp == NULL)
+    return;
+
+  apdu_trace_cmd_time = apdu_trace_now ();
+  s = apdu_trace_hex (s, a->cmd_apdu_head, 4, 0);
+  *s++ = ' ';
+  s = apdu_trace_hex (s, a->cmd_apdu_data, a->cmd_apdu_data_len,
+		      apdu_trace_secret (a->cmd_apdu_head));
+  sprintf (s, " %u", a->expected_res_size);
+  apdu_trace_res_masked = apdu_trace_secret_response (a->cmd_apdu_head);
+}
+
+void
+apdu_trace_response (const struct apdu *a)
+{
+  uint64_t now;
+
+  if (apdu_trace_fp == NULL)
+    return;
+
+  now = apdu_trace_now ();
+  apdu_trace_hex (apdu_trace_res, a->res_apdu_data, a->res_apdu_data_len,
+		  apdu_trace_res_masked);
+  fprintf (apdu_trace_fp, "%llu %llu %s %s %04x\n",
+	   (unsigned long long)(apdu_trace_cmd_time - apdu_trace_start),
+	   (unsigned long long)(now - apdu_trace_cmd_time),
+	   apdu_trace_cmd, apdu_trace_res, a->sw);
+  fflush (apdu_trace_fp);
+}
@@ -34,9 +34,52 @@
 #include "polarssl/config.h"
 #include "polarssl/rsa.h"
 
+extern void neug_flush (void);
+
 static rsa_context rsa_ctx;
 static struct chx_cleanup clp;
 
+/*
+ * Blinding pair (see rsa_private) of each key.  It is created by the
+ * first private key operation with the key, and then updated by
+ * squaring for each operation.  It is kept while the key is cleared
+ * from memory (e.g., after each signature by the lifetime of PW1),
+ * and discarded when the key is deleted or replaced, or when the data
+ * objects are scanned again.  On parts with MEMORY_SIZE < 32, it is
+ * discarded when the key is cleared (see gpg_do_clear_prvkey).
+ *
+ * While the operation, it is moved to RSA_CTX; it is lost when the
+ * operation fails or is canceled, and a new one will be created.
+ */
+struct rsa_blinding {
+  mpi Vi, Vf;
+};
+
+static struct rsa_blinding rsa_blinding[3];
+
+static struct rsa_blinding *
+rsa_blinding_get (const struct key_data *kd_p)
+{
+  return &rsa_blinding[kd_p - kd];
+}
+
+static void
+rsa_blinding_swap (struct rsa_blinding *b)
+{
+  mpi_swap (&rsa_ctx.Vi, &b->Vi);
+  mpi_swap (&rsa_ctx.Vf, &b->Vf);
+}
+
+/*
+ * Clear the blinding pair of the key KK.
+ */
+void
+rsa_blinding_clear (enum kind_of_key kk)
+{
+  mpi_free (&rsa_blinding[kk].Vi);
+  mpi_free (&rsa_blinding[kk].Vf);
+}
+
 static void
 rsa_cleanup (void *arg)
 {
@@ -51,7 +94,13 @@ rsa_sign (const uint8_t *raw_message, uint8_t *output, int msg_len,
 {
   mpi P1, Q1, H;
   int ret = 0;
-  unsigned char temp[pubkey_len];
+  unsigned char *temp;
+  struct rsa_blinding *b = rsa_blinding_get (kd);
+  uint8_t index = 0;
+
+  temp = gnuk_scratch_alloc (pubkey_len);
+  if (temp == NULL)
+    return -1;
 
   rsa_init (&rsa_ctx, RSA_PKCS_V15, 0);
 
@@ -62,9 +111,7 @@ rsa_sign (const uint8_t *raw_message, uint8_t *output, int msg_len,
   MPI_CHK( mpi_read_binary (&rsa_ctx.P, &kd->data[0], pubkey_len / 2) );
   MPI_CHK( mpi_read_binary (&rsa_ctx.Q, &kd->data[pubkey_len / 2],
 			    pubkey_len / 2) );
-#if 0
   MPI_CHK( mpi_mul_mpi (&rsa_ctx.N, &rsa_ctx.P, &rsa_ctx.Q) );
-#endif
   MPI_CHK( mpi_sub_int (&P1, &rsa_ctx.P, 1) );
   MPI_CHK( mpi_sub_int (&Q1, &rsa_ctx.Q, 1) );
   MPI_CHK( mpi_mul_mpi (&H, &P1, &Q1) );
@@ -84,14 +131,20 @@ rsa_sign (const uint8_t *raw_message, uint8_t *output, int msg_len,
       clp.arg = NULL;
       chopstx_cleanup_push (&clp);
       cs = chopstx_setcancelstate (0); /* Allow cancellation.  */
-      ret = rsa_rsassa_pkcs1_v15_sign (&rsa_ctx, NULL, NULL,
+      rsa_blinding_swap (b);
+      ret = rsa_rsassa_pkcs1_v15_sign (&rsa_ctx, random_gen, &index,
 				       RSA_PRIVATE, SIG_RSA_RAW,
 				       msg_len, raw_message, temp);
+      if (ret == 0)
+	rsa_blinding_swap (b);
+      if (index)		/* Don't leave used random bytes.  */
+	neug_flush ();
       memcpy (output, temp, pubkey_len);
       chopstx_setcancelstate (cs);
       chopstx_cleanup_pop (0);
     }
 
+  gnuk_scratch_free (temp);
   rsa_free (&rsa_ctx);
   if (ret != 0)
     {
@@ -136,6 +189,8 @@ rsa_decrypt (const uint8_t *input, uint8_t *output, int msg_len,
 {
   mpi P1, Q1, H;
   int ret;
+  struct rsa_blinding *b = rsa_blinding_get (kd);
+  uint8_t index = 0;
 #ifdef GNU_LINUX_EMULATION
   size_t output_len;
 #endif
@@ -152,9 +207,7 @@ rsa_decrypt (const uint8_t *input, uint8_t *output, int msg_len,
   MPI_CHK( mpi_lset (&rsa_ctx.E, 0x10001) );
   MPI_CHK( mpi_read_binary (&rsa_ctx.P, &kd->data[0], msg_len / 2) );
   MPI_CHK( mpi_read_binary (&rsa_ctx.Q, &kd->data[msg_len / 2], msg_len / 2) );
-#if 0
   MPI_CHK( mpi_mul_mpi (&rsa_ctx.N, &rsa_ctx.P, &rsa_ctx.Q) );
-#endif
   MPI_CHK( mpi_sub_int (&P1, &rsa_ctx.P, 1) );
   MPI_CHK( mpi_sub_int (&Q1, &rsa_ctx.Q, 1) );
   MPI_CHK( mpi_mul_mpi (&H, &P1, &Q1) );
@@ -174,16 +227,21 @@ rsa_decrypt (const uint8_t *input, uint8_t *output, int msg_len,
       clp.arg = NULL;
       chopstx_cleanup_push (&clp);
       cs = chopstx_setcancelstate (0); /* Allow cancellation.  */
+      rsa_blinding_swap (b);
 #ifdef GNU_LINUX_EMULATION
-      ret = rsa_rsaes_pkcs1_v15_decrypt (&rsa_ctx, NULL, NULL,
+      ret = rsa_rsaes_pkcs1_v15_decrypt (&rsa_ctx, random_gen, &index,
 					 RSA_PRIVATE, &output_len, input,
 					 output, MAX_RES_APDU_DATA_SIZE);
       *output_len_p = (unsigned int)output_len;
 #else
-      ret = rsa_rsaes_pkcs1_v15_decrypt (&rsa_ctx, NULL, NULL,
+      ret = rsa_rsaes_pkcs1_v15_decrypt (&rsa_ctx, random_gen, &index,
 					 RSA_PRIVATE, output_len_p, input,
 					 output, MAX_RES_APDU_DATA_SIZE);
 #endif
+      if (ret == 0)
+	rsa_blinding_swap (b);
+      if (index)		/* Don't leave used random bytes.  */
+	neug_flush ();
       chopstx_setcancelstate (cs);
       chopstx_cleanup_pop (0);
     }
@@ -247,7 +305,6 @@ rsa_genkey (int pubkey_len, uint8_t *pubkey, uint8_t *p_q)
 
   extern int prng_seed (int (*f_rng)(void *, unsigned char *, size_t),
 			void *p_rng);
-  extern void neug_flush (void);
 
   neug_flush ();
   prng_seed (random_gen, &index);
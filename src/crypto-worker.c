@@ -0,0 +1,177 @@
+/*
+ * crypto-worker.c -- Worker threads for crypto computation (emulation)
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Worker threads are host threads, not Chopstx threads.  They must
+ * not call any Chopstx API.  The only shared resource they touch
+ * is the heap (through PolarSSL's mpi), and gnuk_malloc serializes
+ * host threads by its own lock.
+ *
+ * A Chopstx thread which hands a job to a worker doesn't block the
+ * host thread while waiting; it polls by chopstx_usec_wait, so that
+ * other Chopstx threads (CCID, USB) keep running.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <chopstx.h>
+
+#include "crypto-worker.h"
+
+#define CRYPTO_WORKER_MAX 8
+#define CRYPTO_WORKER_POLL_USEC 50
+
+struct crypto_job {
+  struct crypto_job *next;
+  void (*func) (void *);
+  void *arg;
+  int done;
+};
+
+static pthread_t worker_thread[CRYPTO_WORKER_MAX];
+static int num_workers;
+static int worker_exit;
+static __thread int in_worker;
+
+static pthread_mutex_t queue_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct crypto_job *queue_head;
+static struct crypto_job **queue_tail = &queue_head;
+
+static void *
+crypto_worker (void *arg)
+{
+  (void)arg;
+
+  in_worker = 1;
+  while (1)
+    {
+      struct crypto_job *job;
+
+      pthread_mutex_lock (&queue_mtx);
+      while (queue_head == NULL && !worker_exit)
+	pthread_cond_wait (&queue_cond, &queue_mtx);
+      if (worker_exit)
+	{
+	  pthread_mutex_unlock (&queue_mtx);
+	  break;
+	}
+      job = queue_head;
+      queue_head = job->next;
+      if (queue_head == NULL)
+	queue_tail = &queue_head;
+      pthread_mutex_unlock (&queue_mtx);
+
+      job->func (job->arg);
+      __atomic_store_n (&job->done, 1, __ATOMIC_RELEASE);
+    }
+
+  return NULL;
+}
+
+/*
+ * One worker per core, minus the one which runs Chopstx.
+ */
+void
+crypto_worker_init (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  sigset_t set, oldset;
+  int i;
+
+  if (n > CRYPTO_WORKER_MAX + 1)
+    n = CRYPTO_WORKER_MAX + 1;
+
+  /* Timer and I/O signals are for Chopstx; workers never take them.  */
+  sigfillset (&set);
+  pthread_sigmask (SIG_SETMASK, &set, &oldset);
+  for (i = 0; i < n - 1; i++)
+    if (pthread_create (&worker_thread[i], NULL, crypto_worker, NULL) != 0)
+      break;
+  pthread_sigmask (SIG_SETMASK, &oldset, NULL);
+
+  num_workers = i;
+}
+
+void
+crypto_worker_fini (void)
+{
+  int i;
+
+  pthread_mutex_lock (&queue_mtx);
+  worker_exit = 1;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_mtx);
+
+  for (i = 0; i < num_workers; i++)
+    pthread_join (worker_thread[i], NULL);
+
+  num_workers = 0;
+}
+
+int
+crypto_worker_self (void)
+{
+  return in_worker;
+}
+
+void
+crypto_worker_run_pair (void (*func0) (void *), void *arg0,
+			void (*func1) (void *), void *arg1)
+{
+  struct crypto_job job;
+  int cs;
+
+  if (num_workers == 0)
+    {
+      func0 (arg0);
+      func1 (arg1);
+      return;
+    }
+
+  job.next = NULL;
+  job.func = func1;
+  job.arg = arg1;
+  job.done = 0;
+
+  /*
+   * The worker refers objects owned by this thread; don't allow
+   * cancellation until it finishes.
+   */
+  cs = chopstx_setcancelstate (1);
+
+  pthread_mutex_lock (&queue_mtx);
+  *queue_tail = &job;
+  queue_tail = &job.next;
+  pthread_cond_signal (&queue_cond);
+  pthread_mutex_unlock (&queue_mtx);
+
+  func0 (arg0);
+
+  while (!__atomic_load_n (&job.done, __ATOMIC_ACQUIRE))
+    chopstx_usec_wait (CRYPTO_WORKER_POLL_USEC);
+
+  chopstx_setcancelstate (cs);
+}
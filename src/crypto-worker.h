@@ -0,0 +1,17 @@
+/*
+ * Crypto worker threads for GNU/Linux emulation.
+ *
+ * Independent halves of a computation (e.g., two exponentiations of
+ * RSA CRT) can be run on host threads, so that a single token uses
+ * more than one core.
+ */
+
+void crypto_worker_init (void);
+void crypto_worker_fini (void);
+
+/* Return non-zero when called on a worker thread.  */
+int crypto_worker_self (void);
+
+/* Run FUNC0 (ARG0) and FUNC1 (ARG1) concurrently, return when both done.  */
+void crypto_worker_run_pair (void (*func0) (void *), void *arg0,
+			     void (*func1) (void *), void *arg1);
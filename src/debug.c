@@ -1,7 +1,7 @@
 /*
  * debug.c -- Debuging with virtual COM port
  *
- * Copyright (C) 2010 Free Software Initiative of Japan
+ * Copyright (C) 2010, 2026 Free Software Initiative of Japan
  * Author: NIIBE Yutaka <gniibe@fsij.org>
  *
  * This file is a part of Gnuk, a GnuPG USB Token implementation.
@@ -21,106 +21,354 @@
  *
  */
 
+/*
+ * Debug functions only put a record into the ring buffer, and return.
+ * They never block, and don't call Chopstx API (except on Cortex-M0,
+ * see below), so that they can be used anywhere, even by host threads
+ * of the emulation.  Formatting and output (to virtual COM port, or
+ * to stderr for the emulation) are done by a thread of low priority.
+ *
+ * When the ring buffer is full, records are dropped and counted.  The
+ * count is shown in the output, like "[12 dropped]".
+ */
+
 #include <stdint.h>
 #include <string.h>
+#include <chopstx.h>
+
+#include "config.h"
+
+#ifdef GNU_LINUX_EMULATION
+#include <stdio.h>
+#define DEBUG_RING_SIZE 4096	/* Must be power of two.  */
+#else
+#define DEBUG_RING_SIZE 128
+#endif
+
+#define DEBUG_DRAIN_USEC (10*1000)
 
 extern void _write (const char *s, int len);
 
-static void
-put_hex (uint8_t nibble)
+enum debug_rec_type {
+  DEBUG_REC_STRING = 1,
+  DEBUG_REC_BYTE,
+  DEBUG_REC_BYTE_NO_NL,
+  DEBUG_REC_SHORT,
+  DEBUG_REC_WORD,
+  DEBUG_REC_INT,
+  DEBUG_REC_BINARY,
+};
+
+#define DEBUG_BIN_CHUNK 8
+#define DEBUG_BIN_LAST  0x80
+
+struct debug_rec {
+  volatile uint8_t ready;
+  uint8_t type;
+  uint8_t len;			/* For binary */
+  uint8_t flags;		/* For binary: column and DEBUG_BIN_LAST */
+  union {
+    const char *s;
+    uint32_t v;
+    uint8_t b[DEBUG_BIN_CHUNK];
+  } u;
+};
+
+static struct debug_rec debug_ring[DEBUG_RING_SIZE];
+static uint32_t debug_head;	/* Next to be reserved by producers */
+static uint32_t debug_tail;	/* Next to be drained */
+static uint32_t debug_dropped;
+
+#if defined(__ARM_ARCH_6M__)
+/*
+ * Cortex-M0 has no exclusive access instructions.  Reservation of a
+ * slot is serialized by a mutex, instead; it's held only for an update
+ * of the index, never for output.
+ */
+static chopstx_mutex_t debug_mutex;
+
+static struct debug_rec *
+debug_rec_get (void)
 {
-  uint8_t c;
+  struct debug_rec *r = NULL;
 
-  if (nibble < 0x0a)
-    c = '0' + nibble;
+  chopstx_mutex_lock (&debug_mutex);
+  if (debug_head - debug_tail < DEBUG_RING_SIZE)
+    r = &debug_ring[debug_head++ & (DEBUG_RING_SIZE - 1)];
   else
-    c = 'a' + nibble - 0x0a;
+    debug_dropped++;
+  chopstx_mutex_unlock (&debug_mutex);
+  return r;
+}
+#else
+static struct debug_rec *
+debug_rec_get (void)
+{
+  uint32_t head = __atomic_load_n (&debug_head, __ATOMIC_RELAXED);
 
-  _write ((const char *)&c, 1);
+  do
+    if (head - __atomic_load_n (&debug_tail, __ATOMIC_ACQUIRE)
+	>= DEBUG_RING_SIZE)
+      {
+	__atomic_fetch_add (&debug_dropped, 1, __ATOMIC_RELAXED);
+	return NULL;
+      }
+  while (!__atomic_compare_exchange_n (&debug_head, &head, head + 1, 1,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  return &debug_ring[head & (DEBUG_RING_SIZE - 1)];
+}
+#endif
+
+static void
+debug_rec_put (struct debug_rec *r)
+{
+  __atomic_store_n (&r->ready, 1, __ATOMIC_RELEASE);
+}
+
+static void
+put_value (enum debug_rec_type type, uint32_t v)
+{
+  struct debug_rec *r = debug_rec_get ();
+
+  if (r == NULL)
+    return;
+
+  r->type = type;
+  r->u.v = v;
+  debug_rec_put (r);
 }
 
 void
 put_byte (uint8_t b)
 {
-  put_hex (b >> 4);
-  put_hex (b &0x0f);
-  _write ("\r\n", 2);
+  put_value (DEBUG_REC_BYTE, b);
 }
 
 void
 put_byte_with_no_nl (uint8_t b)
 {
-  _write (" ", 1);
-  put_hex (b >> 4);
-  put_hex (b &0x0f);
+  put_value (DEBUG_REC_BYTE_NO_NL, b);
 }
 
 void
 put_short (uint16_t x)
 {
-  put_hex (x >> 12);
-  put_hex ((x >> 8)&0x0f);
-  put_hex ((x >> 4)&0x0f);
-  put_hex (x & 0x0f);
-  _write ("\r\n", 2);
+  put_value (DEBUG_REC_SHORT, x);
 }
 
 void
 put_word (uint32_t x)
 {
-  put_hex (x >> 28);
-  put_hex ((x >> 24)&0x0f);
-  put_hex ((x >> 20)&0x0f);
-  put_hex ((x >> 16)&0x0f);
-  put_hex ((x >> 12)&0x0f);
-  put_hex ((x >> 8)&0x0f);
-  put_hex ((x >> 4)&0x0f);
-  put_hex (x & 0x0f);
-  _write ("\r\n", 2);
+  put_value (DEBUG_REC_WORD, x);
 }
 
 void
 put_int (uint32_t x)
+{
+  put_value (DEBUG_REC_INT, x);
+}
+
+void
+put_binary (const char *s, int len)
+{
+  int i = 0;
+
+  do
+    {
+      struct debug_rec *r = debug_rec_get ();
+      int n = len - i;
+
+      if (n > DEBUG_BIN_CHUNK)
+	n = DEBUG_BIN_CHUNK;
+
+      if (r)
+	{
+	  r->type = DEBUG_REC_BINARY;
+	  r->len = n;
+	  r->flags = (i & 0x0f) | (i + n == len ? DEBUG_BIN_LAST : 0);
+	  memcpy (r->u.b, s + i, n);
+	  debug_rec_put (r);
+	}
+
+      i += n;
+    }
+  while (i < len);
+}
+
+/* S is not copied; it should be a string constant.  */
+void
+put_string (const char *s)
+{
+  struct debug_rec *r = debug_rec_get ();
+
+  if (r == NULL)
+    return;
+
+  r->type = DEBUG_REC_STRING;
+  r->u.s = s;
+  debug_rec_put (r);
+}
+
+
+static void
+debug_output (const char *s, int len)
+{
+#ifdef GNU_LINUX_EMULATION
+  fwrite (s, 1, len, stderr);
+#else
+  _write (s, len);
+#endif
+}
+
+static char *
+fmt_hex (char *p, uint32_t v, int digits)
+{
+  while (digits--)
+    {
+      uint8_t nibble = (v >> (digits * 4)) & 0x0f;
+
+      *p++ = nibble < 0x0a ? '0' + nibble : 'a' + nibble - 0x0a;
+    }
+
+  return p;
+}
+
+static char *
+fmt_int (char *p, uint32_t x)
 {
   char s[10];
-  int i;
+  int i = 0;
 
-  for (i = 0; i < 10; i++)
+  do
     {
-      s[i] = '0' + (x % 10);
+      s[i++] = '0' + (x % 10);
       x /= 10;
-      if (x == 0)
-	break;
     }
+  while (x);
 
   while (i)
-    {
-      _write (s+i, 1);
-      i--;
-    }
+    *p++ = s[--i];
 
-  _write (s, 1);
-  _write ("\r\n", 2);
+  return p;
 }
 
-void
-put_binary (const char *s, int len)
+static void
+debug_format (const struct debug_rec *r)
 {
+  char buf[DEBUG_BIN_CHUNK * 3 + 4];
+  char *p = buf;
   int i;
 
-  for (i = 0; i < len; i++)
+  switch (r->type)
     {
-      put_byte_with_no_nl (s[i]);
-      if ((i & 0x0f) == 0x0f)
-	_write ("\r\n", 2);
-      }
-  _write ("\r\n", 2);
+    case DEBUG_REC_STRING:
+      debug_output (r->u.s, strlen (r->u.s));
+      return;
+    case DEBUG_REC_BYTE:
+      p = fmt_hex (p, r->u.v, 2);
+      break;
+    case DEBUG_REC_BYTE_NO_NL:
+      *p++ = ' ';
+      p = fmt_hex (p, r->u.v, 2);
+      debug_output (buf, p - buf);
+      return;
+    case DEBUG_REC_SHORT:
+      p = fmt_hex (p, r->u.v, 4);
+      break;
+    case DEBUG_REC_WORD:
+      p = fmt_hex (p, r->u.v, 8);
+      break;
+    case DEBUG_REC_INT:
+      p = fmt_int (p, r->u.v);
+      break;
+    case DEBUG_REC_BINARY:
+      for (i = 0; i < r->len; i++)
+	{
+	  *p++ = ' ';
+	  p = fmt_hex (p, r->u.b[i], 2);
+	  if (((r->flags + i) & 0x0f) == 0x0f)
+	    {
+	      debug_output (buf, p - buf);
+	      p = buf;
+	      *p++ = '\r';
+	      *p++ = '\n';
+	    }
+	}
+      if (!(r->flags & DEBUG_BIN_LAST))
+	{
+	  debug_output (buf, p - buf);
+	  return;
+	}
+      break;
+    default:
+      return;
+    }
+
+  *p++ = '\r';
+  *p++ = '\n';
+  debug_output (buf, p - buf);
 }
 
-void
-put_string (const char *s)
+static void
+debug_report_dropped (void)
+{
+  static uint32_t dropped_reported;
+  uint32_t dropped = __atomic_load_n (&debug_dropped, __ATOMIC_RELAXED);
+  char buf[24];
+  char *p = buf;
+
+  if (dropped == dropped_reported)
+    return;
+
+  *p++ = '[';
+  p = fmt_int (p, dropped - dropped_reported);
+  memcpy (p, " dropped]\r\n", 11);
+  debug_output (buf, p - buf + 11);
+  dropped_reported = dropped;
+}
+
+static void *
+debug_drain (void *arg)
 {
-  _write (s, strlen (s));
+  (void)arg;
+
+  while (1)
+    {
+      struct debug_rec *r = &debug_ring[debug_tail & (DEBUG_RING_SIZE - 1)];
+
+      if (!__atomic_load_n (&r->ready, __ATOMIC_ACQUIRE))
+	{
+	  debug_report_dropped ();
+#ifdef GNU_LINUX_EMULATION
+	  fflush (stderr);
+#endif
+	  chopstx_usec_wait (DEBUG_DRAIN_USEC);
+	  continue;
+	}
+
+      debug_format (r);
+      r->ready = 0;
+      __atomic_store_n (&debug_tail, debug_tail + 1, __ATOMIC_RELEASE);
+    }
+
+  return NULL;
 }
 
+#define STACK_PROCESS_4
+#include "stack-def.h"
+#define STACK_ADDR_DEBUG ((uintptr_t)process4_base)
+#define STACK_SIZE_DEBUG (sizeof process4_base)
+
+#define PRIO_DEBUG 1
 
+void
+debug_init (void)
+{
+#if defined(__ARM_ARCH_6M__)
+  chopstx_mutex_init (&debug_mutex);
+#endif
+  STACK_REGISTER ("debug", STACK_ADDR_DEBUG, STACK_SIZE_DEBUG);
+  chopstx_create (PRIO_DEBUG, STACK_ADDR_DEBUG, STACK_SIZE_DEBUG,
+		  debug_drain, NULL);
+}
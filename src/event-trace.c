@@ -0,0 +1,154 @@
+/*
+ * event-trace.c -- Time stamped trace of stages of command processing
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Stages of processing (USB, CCID, OpenPGP thread, crypto and flash)
+ * record events with time stamps into a ring buffer, which keeps the
+ * last EVENT_TRACE_SIZE events.  It's for attributing latency to each
+ * stage; tool/gnuk_evtrace.py decodes it into a timeline.
+ *
+ * The trace can be read by GET DATA of the tag 0x0112, and cleared by
+ * PUT DATA of it (with no data, admin authorized).  Its format (in big
+ * endian) is:
+ *
+ *   TIMESTAMP_PER_USEC (2 bytes), EVENT_TRACE_SIZE (2 bytes),
+ *   COUNT of recorded events (4 bytes),
+ *   records from the oldest: TIME (4), EVENT (1), SEQ (1), ARG (2)
+ *
+ * TIME is by timestamp_get, in microseconds; TIMESTAMP_PER_USEC is
+ * kept in the format for tools, and it's 1 now.
+ *
+ * The buffer in RAM has a header with magic, so that it can be found
+ * in a memory dump (by tool/dump_mem.py) as well.  It's in little
+ * endian there, records in the ring order.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "gnuk.h"
+
+#define EVENT_TRACE_SIZE 64	/* Must be power of 2 */
+#define EVENT_TRACE_MAGIC 0x52545645 /* "EVTR" */
+
+struct event_rec {
+  uint32_t time;
+  uint8_t ev;
+  uint8_t seq;			/* Low byte of index; finds the oldest.  */
+  uint16_t arg;
+};
+
+struct event_trace {
+  uint32_t magic;
+  uint16_t per_usec;
+  uint16_t size;
+  uint32_t count;
+  struct event_rec rec[EVENT_TRACE_SIZE];
+};
+
+static struct event_trace event_trace_buf = {
+  EVENT_TRACE_MAGIC, TIMESTAMP_PER_USEC, EVENT_TRACE_SIZE, 0, { { 0 } }
+};
+
+/*
+ * Called by any thread.  Concurrent callers get different slots.  A
+ * record may be read while it's being written; it's a trace, and
+ * that's acceptable.
+ */
+void
+event_trace (uint8_t ev, uint16_t arg)
+{
+  struct event_rec *r;
+  uint32_t i;
+
+#if defined(__ARM_ARCH_6M__)
+  /* No exclusive access; an event may be lost by a race.  */
+  i = event_trace_buf.count++;
+#else
+  i = __atomic_fetch_add (&event_trace_buf.count, 1, __ATOMIC_RELAXED);
+#endif
+  r = &event_trace_buf.rec[i & (EVENT_TRACE_SIZE - 1)];
+  r->time = timestamp_get ();
+  r->ev = ev;
+  r->seq = i & 0xff;
+  r->arg = arg;
+}
+
+static int
+event_trace_num (uint32_t count)
+{
+  return count < EVENT_TRACE_SIZE ? (int)count : EVENT_TRACE_SIZE;
+}
+
+int
+event_trace_size (void)
+{
+  return 8 + event_trace_num (event_trace_buf.count) * 8;
+}
+
+/*
+ * Copy the trace to P, and return the end.  P should have
+ * event_trace_size () bytes, the number of records is determined by
+ * the value at the call of it.
+ */
+uint8_t *
+event_trace_copy (uint8_t *p)
+{
+  uint32_t count = event_trace_buf.count;
+  int num = event_trace_num (count);
+  int i;
+
+  *p++ = TIMESTAMP_PER_USEC >> 8;
+  *p++ = TIMESTAMP_PER_USEC & 0xff;
+  *p++ = EVENT_TRACE_SIZE >> 8;
+  *p++ = EVENT_TRACE_SIZE & 0xff;
+  *p++ = count >> 24;
+  *p++ = (count >> 16) & 0xff;
+  *p++ = (count >> 8) & 0xff;
+  *p++ = count & 0xff;
+
+  for (i = 0; i < num; i++)
+    {
+      const struct event_rec *r
+	= &event_trace_buf.rec[(count - num + i) & (EVENT_TRACE_SIZE - 1)];
+
+      *p++ = r->time >> 24;
+      *p++ = (r->time >> 16) & 0xff;
+      *p++ = (r->time >> 8) & 0xff;
+      *p++ = r->time & 0xff;
+      *p++ = r->ev;
+      *p++ = r->seq;
+      *p++ = r->arg >> 8;
+      *p++ = r->arg & 0xff;
+    }
+
+  return p;
+}
+
+void
+event_trace_clear (void)
+{
+  event_trace_buf.count = 0;
+  memset (event_trace_buf.rec, 0, sizeof event_trace_buf.rec);
+}
@@ -54,13 +54,14 @@
  * ch_certificate_startp
  *         <2048 bytes>
  * _keystore_pool
- *         Three flash pages for keystore
- *         a page contains a key data of:
+ *         Three flash pages for keystore, shared by keys
+ *         a key data is:
  *              For RSA-2048: 512-byte (p, q and N)
  *              For RSA-4096: 1024-byte (p, q and N)
- *              For ECDSA/ECDH and EdDSA, there is padding after public key
+ *              For ECDSA/ECDH and EdDSA: private key and public key
  * _data_pool
  *	   <two pages>
+ *         <a page for digital signature counter>
  */
 
 #define FLASH_DATA_POOL_HEADER_SIZE	2
@@ -69,6 +70,13 @@
 static uint16_t flash_page_size;
 static const uint8_t *data_pool;
 static uint8_t *last_p;
+static const uint16_t *dsc_p;
+
+#define FLASH_KEY_STORAGE_PAGES 3
+#define FLASH_KEY_STORAGE_SIZE (flash_page_size*FLASH_KEY_STORAGE_PAGES)
+/* In-RAM index of the key storage */
+static uint8_t *key_addr[3];
+static uint16_t key_alloc_next;
 
 /* The first halfword is generation for the data page (little endian) */
 const uint8_t const flash_data[4] __attribute__ ((section (".gnuk_data"))) = {
@@ -87,6 +95,8 @@ extern uint8_t _data_pool;
 #define FLASH_ADDR_KEY_STORAGE_START  ((&_keystore_pool))
 #define FLASH_ADDR_DATA_STORAGE_START ((&_data_pool))
 #endif
+#define FLASH_ADDR_DSC_START (FLASH_ADDR_DATA_STORAGE_START \
+			      + FLASH_DATA_POOL_SIZE)
 
 static int key_available_at (const uint8_t *k, int key_size)
 {
@@ -109,60 +119,97 @@ static int key_available_at (const uint8_t *k, int key_size)
 
 
 #define CHIP_ID_REG      ((uint32_t *)0xe0042000)
-void
-flash_do_storage_init (const uint8_t **p_do_start, const uint8_t **p_do_end)
+
+/* Check data pool generation and choose the page.  */
+static const uint8_t *
+flash_data_pool_select (void)
 {
   uint16_t gen0, gen1;
   uint16_t *gen0_p = (uint16_t *)FLASH_ADDR_DATA_STORAGE_START;
   uint16_t *gen1_p;
 
-  flash_page_size = 1024;
-#if !defined (GNU_LINUX_EMULATION)
-  if (((*CHIP_ID_REG) & 0xfff) == 0x0414)
-    flash_page_size = 2048;
-#endif
-
   gen1_p = (uint16_t *)(FLASH_ADDR_DATA_STORAGE_START + flash_page_size);
-  data_pool = FLASH_ADDR_DATA_STORAGE_START;
-
-  /* Check data pool generation and choose the page */
   gen0 = *gen0_p;
   gen1 = *gen1_p;
 
   if (gen0 == 0xffff && gen1 == 0xffff)
-    {
-      /* It's terminated.  */
-      *p_do_start = *p_do_end = NULL;
-      return;
-    }
+    /* It's terminated.  */
+    return NULL;
 
   if (gen0 == 0xffff)
     /* Use another page if a page is erased.  */
-    data_pool = FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
+    return FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
   else if (gen1 == 0xffff)
     /* Or use different page if another page is erased.  */
-    data_pool = FLASH_ADDR_DATA_STORAGE_START;
+    return FLASH_ADDR_DATA_STORAGE_START;
   else if ((gen0 == 0xfffe && gen1 == 0) || gen1 > gen0)
     /* When both pages have valid header, use newer page.   */
-    data_pool = FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
+    return FLASH_ADDR_DATA_STORAGE_START + flash_page_size;
+  else
+    return FLASH_ADDR_DATA_STORAGE_START;
+}
+
+void
+flash_do_storage_init (const uint8_t **p_do_start, const uint8_t **p_do_end)
+{
+  flash_page_size = 1024;
+#if !defined (GNU_LINUX_EMULATION)
+  if (((*CHIP_ID_REG) & 0xfff) == 0x0414)
+    flash_page_size = 2048;
+#endif
+
+  data_pool = flash_data_pool_select ();
+  if (data_pool == NULL)
+    {
+      data_pool = FLASH_ADDR_DATA_STORAGE_START;
+      *p_do_start = *p_do_end = NULL;
+      return;
+    }
 
   *p_do_start = data_pool + FLASH_DATA_POOL_HEADER_SIZE;
   *p_do_end = data_pool + flash_page_size;
 }
 
-static uint8_t *flash_key_getpage (enum kind_of_key kk);
+/*
+ * Return 1 when the data pool is not what was scanned: another page is
+ * chosen, or there is a record after the last one.  Records are only
+ * appended until GC, which changes the page, so it's enough.
+ */
+int
+flash_do_storage_changed (void)
+{
+  const uint8_t *p = flash_data_pool_select ();
+
+  if (p == NULL)
+    return 1;
+
+  if (p != data_pool)
+    return 1;
+
+  if (last_p < data_pool + flash_page_size
+      && *(const uint16_t *)last_p != 0xffff)
+    return 1;
+
+  return 0;
+}
 
 void
 flash_terminate (void)
 {
   int i;
 
+  for (i = 0; i < FLASH_KEY_STORAGE_PAGES; i++)
+    flash_erase_page ((uintptr_t)(FLASH_ADDR_KEY_STORAGE_START
+				  + flash_page_size * i));
   for (i = 0; i < 3; i++)
-    flash_erase_page ((uintptr_t)flash_key_getpage (i));
+    key_addr[i] = NULL;
+  key_alloc_next = 0;
   flash_erase_page ((uintptr_t)FLASH_ADDR_DATA_STORAGE_START);
   flash_erase_page ((uintptr_t)(FLASH_ADDR_DATA_STORAGE_START + flash_page_size));
+  flash_erase_page ((uintptr_t)FLASH_ADDR_DSC_START);
   data_pool = FLASH_ADDR_DATA_STORAGE_START;
   last_p = FLASH_ADDR_DATA_STORAGE_START + FLASH_DATA_POOL_HEADER_SIZE;
+  dsc_p = NULL;
 #if defined(CERTDO_SUPPORT)
   flash_erase_page ((uintptr_t)&ch_certificate_start);
   if (FLASH_CH_CERTIFICATE_SIZE > flash_page_size)
@@ -177,31 +224,63 @@ flash_activate (void)
 }
 
 
+/* Size of key data of KK in the key storage.  */
+static int
+flash_key_size (enum kind_of_key kk)
+{
+  int size = gpg_get_algo_attr_key_size (kk, GPG_KEY_PRIVATE)
+    + gpg_get_algo_attr_key_size (kk, GPG_KEY_PUBLIC);
+
+  return (size + FLASH_KEY_LOC_UNIT - 1) & ~(FLASH_KEY_LOC_UNIT - 1);
+}
+
 void
 flash_key_storage_init (void)
 {
-  const uint8_t *p;
+  uint8_t *base = FLASH_ADDR_KEY_STORAGE_START;
   int i;
 
+  key_alloc_next = 0;
+
   /* For each key, find its address.  */
-  p = FLASH_ADDR_KEY_STORAGE_START;
   for (i = 0; i < 3; i++)
     {
-      const uint8_t *k;
-      int key_size = gpg_get_algo_attr_key_size (i, GPG_KEY_STORAGE);
+      int loc = gpg_get_key_loc (i);
+      int size = flash_key_size (i);
 
-      kd[i].pubkey = NULL;
-      for (k = p; k < p + flash_page_size; k += key_size)
-	if (key_available_at (k, key_size))
-	  {
-	    int prv_len = gpg_get_algo_attr_key_size (i, GPG_KEY_PRIVATE);
+      key_addr[i] = NULL;
+      if (!gpg_key_loc_recorded ())
+	{
+	  /* Old layout: the key is in its own page.  */
+	  uint8_t *p = base + flash_page_size * i;
+	  uint8_t *k;
+	  int key_size = gpg_get_algo_attr_key_size (i, GPG_KEY_STORAGE);
+
+	  for (k = p; k < p + flash_page_size; k += key_size)
+	    if (key_available_at (k, key_size))
+	      {
+		key_addr[i] = k;
+		break;
+	      }
+	}
+      else if (loc >= 0 && loc != FLASH_KEY_LOC_NONE
+	       && loc * FLASH_KEY_LOC_UNIT + size <= FLASH_KEY_STORAGE_SIZE)
+	key_addr[i] = base + loc * FLASH_KEY_LOC_UNIT;
 
-	    kd[i].pubkey = k + prv_len;
-	    break;
-	  }
+      if (key_addr[i])
+	{
+	  int prv_len = gpg_get_algo_attr_key_size (i, GPG_KEY_PRIVATE);
 
-      p += flash_page_size;
+	  kd[i].pubkey = key_addr[i] + prv_len;
+	  if (key_addr[i] + size - base > key_alloc_next)
+	    key_alloc_next = key_addr[i] + size - base;
+	}
+      else
+	kd[i].pubkey = NULL;
     }
+
+  if (key_alloc_next >= FLASH_KEY_STORAGE_SIZE)
+    key_alloc_next = 0;
 }
 
 /*
@@ -242,6 +321,7 @@ flash_copying_gc (void)
   uint8_t *src, *dst;
   uint16_t generation;
 
+  TRACE_EVENT (TRACE_FLASH_GC, 0);
   if (data_pool == FLASH_ADDR_DATA_STORAGE_START)
     {
       src = FLASH_ADDR_DATA_STORAGE_START;
@@ -262,6 +342,7 @@ flash_copying_gc (void)
     generation++;
   flash_program_halfword ((uintptr_t)dst, generation);
   flash_erase_page ((uintptr_t)src);
+  TRACE_EVENT (TRACE_FLASH_GC_END, 0);
   return 0;
 }
 
@@ -294,6 +375,7 @@ flash_do_write_internal (const uint8_t *p, int nr, const uint8_t *data, int len)
   uintptr_t addr;
   int i;
 
+  TRACE_EVENT (TRACE_FLASH_WRITE, len);
   addr = (uintptr_t)p;
   hw = nr | (len << 8);
   if (flash_program_halfword (addr, hw) != 0)
@@ -314,6 +396,7 @@ flash_do_write_internal (const uint8_t *p, int nr, const uint8_t *data, int len)
       if (flash_program_halfword (addr, hw) != 0)
 	flash_warning ("DO WRITE ERROR");
     }
+  TRACE_EVENT (TRACE_FLASH_WRITE_END, 0);
 }
 
 const uint8_t *
@@ -379,38 +462,188 @@ flash_do_release (const uint8_t *do_data)
 }
 
 
-static uint8_t *
-flash_key_getpage (enum kind_of_key kk)
+/*
+ * Key storage management
+ *
+ * Keys are packed in the key storage (shared by all kinds of keys), at
+ * the offset of multiple of FLASH_KEY_LOC_UNIT, not across a page
+ * boundary.  The location of each key is recorded in the data pool,
+ * and the index (KEY_ADDR) is in RAM.
+ *
+ * A new key is placed at free (erased) space, searched from the end of
+ * the last one, like a log.  A released key is filled by zero.  When
+ * there is no space, a page which has no live key is erased.  If there
+ * is no such page, live keys in a page are relocated to other pages
+ * to erase it.
+ *
+ * When the data pool has no record of NR_BOOL_KEY_LOC, it is the old
+ * layout (a page for each kind of key).  Before the first change of the
+ * key storage, locations of existing keys are recorded, then the
+ * record of NR_BOOL_KEY_LOC is written.
+ */
+static void
+flash_key_loc_record_all (void)
 {
-  /* There is a page for each KK.  */
-  return FLASH_ADDR_KEY_STORAGE_START + (flash_page_size * kk);
+  uint8_t *base = FLASH_ADDR_KEY_STORAGE_START;
+  int i;
+
+  if (gpg_key_loc_recorded ())
+    return;
+
+  for (i = 0; i < 3; i++)
+    if (key_addr[i])
+      gpg_set_key_loc (i, (key_addr[i] - base) / FLASH_KEY_LOC_UNIT);
+
+  gpg_set_key_loc_recorded ();
 }
 
-uint8_t *
-flash_key_alloc (enum kind_of_key kk)
+static int
+flash_key_is_free (const uint8_t *k, int size)
+{
+  const uint32_t *p = (const uint32_t *)k;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    if (key_addr[i] && k < key_addr[i] + flash_key_size (i)
+	&& key_addr[i] < k + size)
+      return 0;
+
+  for (i = 0; i < size/4; i++)
+    if (p[i] != 0xffffffff)
+      return 0;
+
+  return 1;
+}
+
+/* Find free space of SIZE, except in the page of EXCLUDE (if any).  */
+static uint8_t *
+flash_key_find_free (int size, const uint8_t *exclude)
 {
-  uint8_t *k, *k0 = flash_key_getpage (kk);
+  uint8_t *base = FLASH_ADDR_KEY_STORAGE_START;
+  int n = FLASH_KEY_STORAGE_SIZE / FLASH_KEY_LOC_UNIT;
   int i;
-  int key_size = gpg_get_algo_attr_key_size (kk, GPG_KEY_STORAGE);
 
-  /* Seek free space in the page.  */
-  for (k = k0; k < k0 + flash_page_size; k += key_size)
+  for (i = 0; i < n; i++)
     {
-      const uint32_t *p = (const uint32_t *)k;
+      int off = (key_alloc_next + i * FLASH_KEY_LOC_UNIT)
+	% FLASH_KEY_STORAGE_SIZE;
+      uint8_t *k = base + off;
 
-      for (i = 0; i < key_size/4; i++)
-	if (p[i] != 0xffffffff)
-	  break;
+      if ((off % flash_page_size) + size > flash_page_size)
+	continue;
+
+      if (exclude && (off / flash_page_size)
+	  == (exclude - base) / flash_page_size)
+	continue;
 
-      if (i == key_size/4)	/* Yes, it's empty.  */
+      if (flash_key_is_free (k, size))
 	return k;
     }
 
-  /* Should not happen as we have enough free space all time, but just
-     in case.  */
   return NULL;
 }
 
+static int
+flash_key_in_page (int kk, const uint8_t *page)
+{
+  return key_addr[kk] && key_addr[kk] >= page
+    && key_addr[kk] < page + flash_page_size;
+}
+
+static void
+flash_key_relocate (int kk, uint8_t *k)
+{
+  int size = flash_key_size (kk);
+  int prv_len = gpg_get_algo_attr_key_size (kk, GPG_KEY_PRIVATE);
+  uint8_t *base = FLASH_ADDR_KEY_STORAGE_START;
+  int i;
+
+  for (i = 0; i < size/2; i++)
+    {
+      const uint8_t *src = key_addr[kk] + i*2;
+
+      flash_program_halfword ((uintptr_t)(k + i*2), src[0] | (src[1] << 8));
+    }
+
+  /* The key is at the new place, after its location is recorded.  */
+  gpg_set_key_loc (kk, (k - base) / FLASH_KEY_LOC_UNIT);
+  key_addr[kk] = k;
+  kd[kk].pubkey = k + prv_len;
+}
+
+/*
+ * Erase a page to have space.  Prefer a page without live key, and a
+ * page which is not blank.  Return 0 on success.
+ */
+static int
+flash_key_reclaim (void)
+{
+  uint8_t *base = FLASH_ADDR_KEY_STORAGE_START;
+  uint8_t *page;
+  int i, j;
+
+  for (i = 0; i < FLASH_KEY_STORAGE_PAGES; i++)
+    {
+      page = base + flash_page_size * i;
+
+      for (j = 0; j < 3; j++)
+	if (flash_key_in_page (j, page))
+	  break;
+
+      if (j == 3 && !flash_check_blank (page, flash_page_size))
+	{
+	  flash_erase_page ((uintptr_t)page);
+	  return 0;
+	}
+    }
+
+  for (i = 0; i < FLASH_KEY_STORAGE_PAGES; i++)
+    {
+      page = base + flash_page_size * i;
+
+      /* Move live keys in the page to other pages, if possible.  */
+      for (j = 0; j < 3; j++)
+	if (flash_key_in_page (j, page))
+	  {
+	    uint8_t *k = flash_key_find_free (flash_key_size (j), page);
+
+	    if (k == NULL)
+	      break;
+
+	    flash_key_relocate (j, k);
+	  }
+
+      if (j == 3)
+	{
+	  flash_erase_page ((uintptr_t)page);
+	  return 0;
+	}
+    }
+
+  return -1;
+}
+
+uint8_t *
+flash_key_alloc (enum kind_of_key kk)
+{
+  uint8_t *base = FLASH_ADDR_KEY_STORAGE_START;
+  int size = flash_key_size (kk);
+  uint8_t *k;
+
+  flash_key_loc_record_all ();
+
+  while ((k = flash_key_find_free (size, NULL)) == NULL)
+    if (flash_key_reclaim () < 0)
+      /* Should not happen as we have enough space all time, but just
+	 in case.  */
+      return NULL;
+
+  gpg_set_key_loc (kk, (k - base) / FLASH_KEY_LOC_UNIT);
+  key_addr[kk] = k;
+  key_alloc_next = (k + size - base) % FLASH_KEY_STORAGE_SIZE;
+  return k;
+}
+
 int
 flash_key_write (uint8_t *key_addr,
 		 const uint8_t *key_data, int key_data_len,
@@ -420,6 +653,7 @@ flash_key_write (uint8_t *key_addr,
   uintptr_t addr;
   int i;
 
+  TRACE_EVENT (TRACE_FLASH_WRITE, key_data_len + pubkey_len);
   addr = (uintptr_t)key_addr;
   for (i = 0; i < key_data_len/2; i ++)
     {
@@ -437,50 +671,27 @@ flash_key_write (uint8_t *key_addr,
       addr += 2;
     }
 
+  TRACE_EVENT (TRACE_FLASH_WRITE_END, 0);
   return 0;
 }
 
-static int
-flash_check_all_other_keys_released (const uint8_t *key_addr, int key_size)
-{
-  uintptr_t start = (uintptr_t)key_addr & ~(flash_page_size - 1);
-  const uint32_t *p = (const uint32_t *)start;
-
-  while (p < (const uint32_t *)(start + flash_page_size))
-    if (p == (const uint32_t *)key_addr)
-      p += key_size/4;
-    else
-      if (*p)
-	return 0;
-      else
-	p++;
-
-  return 1;
-}
-
-static void
-flash_key_fill_zero_as_released (uint8_t *key_addr, int key_size)
+void
+flash_key_release (enum kind_of_key kk)
 {
+  uintptr_t addr = (uintptr_t)key_addr[kk];
+  int size = flash_key_size (kk);
   int i;
-  uintptr_t addr = (uintptr_t)key_addr;
 
-  for (i = 0; i < key_size/2; i++)
-    flash_program_halfword (addr + i*2, 0);
-}
+  if (key_addr[kk] == NULL)
+    return;
 
-void
-flash_key_release (uint8_t *key_addr, int key_size)
-{
-  if (flash_check_all_other_keys_released (key_addr, key_size))
-    flash_erase_page (((uintptr_t)key_addr & ~(flash_page_size - 1)));
-  else
-    flash_key_fill_zero_as_released (key_addr, key_size);
-}
+  flash_key_loc_record_all ();
+  gpg_set_key_loc (kk, FLASH_KEY_LOC_NONE);
+  key_addr[kk] = NULL;
 
-void
-flash_key_release_page (enum kind_of_key kk)
-{
-  flash_erase_page ((uintptr_t)flash_key_getpage (kk));
+  /* Fill zero as released.  */
+  for (i = 0; i < size/2; i++)
+    flash_program_halfword (addr + i*2, 0);
 }
 
 
@@ -670,6 +881,82 @@ flash_cnt123_clear (const uint8_t **addr_p)
 }
 
 
+/*
+ * Digital signature counter area
+ *
+ * It's a page after the data pool.  The header has a magic and the
+ * base value (24-bit), and the counter is BASE + number of cleared
+ * halfwords after the header.  A halfword can be programmed only once
+ * after erase (except to zero), so an increment takes a halfword.
+ *
+ * When it's full, the value is saved in the data pool, and the area
+ * is erased and restarted with the value as its base.  When the area
+ * is erased or retired (the magic is cleared), the value in the data
+ * pool is used.
+ */
+#define FLASH_DSC_MAGIC		0x5344
+#define FLASH_DSC_HEADER_SIZE	8
+
+/* Return the value of the area, or -1 when it's not in use.  */
+int
+flash_dsc_init (void)
+{
+  const uint16_t *area = (const uint16_t *)FLASH_ADDR_DSC_START;
+  const uint16_t *end = area + flash_page_size / 2;
+  const uint16_t *p;
+
+  dsc_p = NULL;
+  if (area[0] != FLASH_DSC_MAGIC)
+    return -1;
+
+  for (p = area + FLASH_DSC_HEADER_SIZE / 2; p < end; p++)
+    if (*p != 0)
+      break;
+
+  dsc_p = p;
+  return (((area[2] << 16) | area[1])
+	  + (p - (area + FLASH_DSC_HEADER_SIZE / 2))) & 0x00ffffff;
+}
+
+/* Return 0 on success, -1 when the area is full or not in use.  */
+int
+flash_dsc_increment (void)
+{
+  const uint16_t *end;
+
+  end = (const uint16_t *)(FLASH_ADDR_DSC_START + flash_page_size);
+  if (dsc_p == NULL || dsc_p >= end)
+    return -1;
+
+  flash_clear_halfword ((uintptr_t)dsc_p);
+  dsc_p++;
+  return 0;
+}
+
+void
+flash_dsc_rebase (uint32_t base)
+{
+  uintptr_t addr = (uintptr_t)FLASH_ADDR_DSC_START;
+
+  flash_erase_page (addr);
+  flash_program_halfword (addr + 2, base & 0xffff);
+  flash_program_halfword (addr + 4, (base >> 16) & 0xff);
+  /* The magic at last, so that the base is valid when it's there.  */
+  flash_program_halfword (addr, FLASH_DSC_MAGIC);
+  dsc_p = (const uint16_t *)(addr + FLASH_DSC_HEADER_SIZE);
+}
+
+void
+flash_dsc_retire (void)
+{
+  if (dsc_p == NULL)
+    return;
+
+  flash_clear_halfword ((uintptr_t)FLASH_ADDR_DSC_START);
+  dsc_p = NULL;
+}
+
+
 #if defined(CERTDO_SUPPORT)
 int
 flash_erase_binary (uint8_t file_id)
@@ -14,3 +14,7 @@
 
 void *gnuk_malloc (size_t);
 void gnuk_free (void *);
+
+/* Scratch memory for temporaries, freed in LIFO order.  */
+void *gnuk_scratch_alloc (size_t);
+void gnuk_scratch_free (void *);
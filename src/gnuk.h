@@ -18,6 +18,11 @@ struct apdu {
 
 extern struct apdu apdu;
 
+void openpgp_card_init (void);
+void openpgp_card_process (void);
+void openpgp_card_fini (void);
+int openpgp_card_warm_reset (void);
+
 #define CARD_CHANGE_INSERT 0
 #define CARD_CHANGE_REMOVE 1
 #define CARD_CHANGE_TOGGLE 2
@@ -107,6 +112,7 @@ void gpg_data_scan (const uint8_t *start, const uint8_t *end);
 void gpg_data_copy (const uint8_t *p);
 void gpg_do_terminate (void);
 void gpg_do_get_data (uint16_t tag, int with_tag);
+void gpg_do_get_data_bulk (const uint8_t *tags, int num_tags);
 void gpg_do_put_data (uint16_t tag, const uint8_t *data, int len);
 void gpg_do_public_key (uint8_t kk_byte);
 void gpg_do_keygen (uint8_t *buf);
@@ -135,16 +141,129 @@ enum size_of_key {
 
 int gpg_get_algo_attr (enum kind_of_key kk);
 int gpg_get_algo_attr_key_size (enum kind_of_key kk, enum size_of_key s);
+int gpg_get_key_loc (enum kind_of_key kk);
+void gpg_set_key_loc (enum kind_of_key kk, uint8_t loc);
+int gpg_key_loc_recorded (void);
+void gpg_set_key_loc_recorded (void);
+uint8_t gpg_cmd_algo (const struct apdu *a);
+
+/* Class of command, for statistics.  */
+struct gpg_cmd_class {
+  uint8_t ins;
+  uint8_t alg;
+};
+int gpg_cmd_class_get (const struct apdu *a,
+		       struct gpg_cmd_class *table, uint8_t *num_p, int max);
+
+#ifdef GNU_LINUX_EMULATION
+
+int apdu_trace_open (const char *path);
+void apdu_trace_command (const struct apdu *a);
+void apdu_trace_response (const struct apdu *a);
+#endif
+
+/*
+ * Time stamp for measurement: free running counter in microseconds,
+ * which wraps around every 71.6 minutes.  On STM32F103, it's the cycle
+ * counter (at 72MHz, wraps around every 59.6 seconds) extended at each
+ * call; the CCID thread calls it at its timeout, so that no wrap of
+ * the cycle counter is missed.
+ */
+void timestamp_init (void);
+uint32_t timestamp_get (void);
+#define TIMESTAMP_PER_USEC 1
+
+/* Tags of statistics, for measurement by tools.  */
+#define GPG_DO_STAT_FIRST	0x0110
+#define GPG_DO_STAT_LAST	0x011f
+
+#ifdef LATENCY_STATS
+#define GPG_DO_LATENCY		0x0110
+
+void latency_cmd_received (void);
+void latency_cmd_done (const struct apdu *a);
+void latency_res_sent (void);
+int latency_size (void);
+uint8_t *latency_copy (uint8_t *p);
+void latency_clear (void);
+#endif
+
+#ifdef EVENT_TRACE
+#define GPG_DO_EVENT_TRACE		0x0112
+
+/* Events of stages; keep in sync with tool/gnuk_evtrace.py.  */
+enum trace_event {
+  TRACE_USB_RX_START = 1,	/* ARG: length of the first packet */
+  TRACE_USB_RX_DONE,		/* ARG: length of the CCID message */
+  TRACE_CCID_CMD,		/* ARG: INS, given to the OpenPGP thread */
+  TRACE_GPG_WAKEUP,		/* ARG: event mask */
+  TRACE_CRYPTO_START,		/* ARG: algorithm (ALGO_xxx) */
+  TRACE_CRYPTO_END,		/* ARG: result */
+  TRACE_FLASH_WRITE,		/* ARG: length */
+  TRACE_FLASH_WRITE_END,
+  TRACE_FLASH_GC,
+  TRACE_FLASH_GC_END,
+  TRACE_GPG_DONE,		/* ARG: SW */
+  TRACE_CCID_RES,		/* ARG: length of response data */
+  TRACE_USB_TX_DONE,
+};
+
+void event_trace (uint8_t ev, uint16_t arg);
+int event_trace_size (void);
+uint8_t *event_trace_copy (uint8_t *p);
+void event_trace_clear (void);
+#define TRACE_EVENT(ev,arg) event_trace (ev, arg)
+#else
+#define TRACE_EVENT(ev,arg)
+#endif
+
+#ifdef HEAP_STATS
+#define GPG_DO_HEAP_STAT	0x0114
+
+int heap_stat_size (void);
+uint8_t *heap_stat_copy (uint8_t *p);
+void heap_stat_clear (void);
+#endif
+
+#ifdef STACK_STATS
+#define GPG_DO_STACK_STAT	0x0116
+
+void stack_cmd_done (const struct apdu *a);
+int stack_stat_size (void);
+uint8_t *stack_stat_copy (uint8_t *p);
+void stack_stat_clear (void);
+#endif
+
+#ifdef PROFILER
+#define GPG_DO_PROFILE		0x0118
+
+int profile_start (const char *path);
+void profile_cmd_start (const struct apdu *a);
+void profile_cmd_done (void);
+int profile_size (void);
+uint8_t *profile_copy (uint8_t *p);
+void profile_clear (void);
+#endif
+
+#ifdef OP_COUNT
+#define GPG_DO_OPCOUNT		0x011a
+
+void opcount_cmd_start (void);
+void opcount_cmd_done (const struct apdu *a);
+int opcount_size (void);
+uint8_t *opcount_copy (uint8_t *p);
+void opcount_clear (void);
+#endif
 
 void flash_do_storage_init (const uint8_t **, const uint8_t **);
+int flash_do_storage_changed (void);
 void flash_terminate (void);
 void flash_activate (void);
 void flash_key_storage_init (void);
 void flash_do_release (const uint8_t *);
 const uint8_t *flash_do_write (uint8_t nr, const uint8_t *data, int len);
 uint8_t *flash_key_alloc (enum kind_of_key);
-void flash_key_release (uint8_t *, int);
-void flash_key_release_page (enum kind_of_key);
+void flash_key_release (enum kind_of_key);
 int flash_key_write (uint8_t *key_addr,
 		     const uint8_t *key_data, int key_data_len,
 		     const uint8_t *pubkey, int pubkey_len);
@@ -236,6 +355,7 @@ extern struct key_data kd[3];
 
 #ifdef DEBUG
 void stdout_init (void);
+void debug_init (void);
 #define DEBUG_MORE 1
 /*
  * Debug functions in debug.c
@@ -267,6 +387,7 @@ int rsa_decrypt (const uint8_t *, uint8_t *, int, struct key_data *,
 		 unsigned int *);
 int rsa_verify (const uint8_t *, int, const uint8_t *, const uint8_t *);
 int rsa_genkey (int, uint8_t *, uint8_t *);
+void rsa_blinding_clear (enum kind_of_key kk);
 
 int ecdsa_sign_p256r1 (const uint8_t *hash, uint8_t *output,
 		       const uint8_t *key_data);
@@ -303,6 +424,11 @@ void fatal (uint8_t code) __attribute__ ((noreturn));
 #define FATAL_RANDOM 2
 #define FATAL_HEAP   3
 
+/* Scratch memory for temporaries of crypto, instead of stack.  */
+void *gnuk_scratch_alloc (size_t size);
+void gnuk_scratch_free (void *p);
+void gnuk_scratch_reset (void);
+
 extern uint8_t keystring_md_pw3[KEYSTRING_MD_SIZE];
 extern uint8_t admin_authorized;
 
@@ -378,7 +504,27 @@ extern uint8_t admin_authorized;
 #define NR_KEY_ALGO_ATTR_DEC	0xf2
 #define NR_KEY_ALGO_ATTR_AUT	0xf3
 /*
- * NR_UINT_SOMETHING could be here...  Use 0xf[456789abcd]
+ * Representation of key location object:
+ *   Location in the key storage, in unit of FLASH_KEY_LOC_UNIT bytes
+ *   0xf?NN
+ *   No key: 0xf?ff
+ * where <?> == 4 (signature), 5 (decryption) or 6 (authentication)
+ *
+ * When there is no record, there is no key.
+ */
+#define NR_KEY_LOC_SIG		0xf4
+#define NR_KEY_LOC_DEC		0xf5
+#define NR_KEY_LOC_AUT		0xf6
+#define FLASH_KEY_LOC_UNIT	32
+#define FLASH_KEY_LOC_NONE	0xff
+/*
+ * Representation of layout of the key storage:
+ *   Old layout (a page for each key): No record in flash memory
+ *   Key locations are recorded:       0xf700
+ */
+#define NR_BOOL_KEY_LOC		0xf7
+/*
+ * NR_UINT_SOMETHING could be here...  Use 0xf[89abcd]
  */
 /* 123-counters: Recorded in flash memory by 2-halfword (4-byte).  */
 /*
@@ -414,6 +560,10 @@ const uint8_t *flash_enum_write (uint8_t nr, uint8_t v);
 int flash_cnt123_get_value (const uint8_t *p);
 void flash_cnt123_increment (uint8_t which, const uint8_t **addr_p);
 void flash_cnt123_clear (const uint8_t **addr_p);
+int flash_dsc_init (void);
+int flash_dsc_increment (void);
+void flash_dsc_rebase (uint32_t base);
+void flash_dsc_retire (void);
 void flash_put_data (uint16_t hw);
 void flash_warning (const char *msg);
 
@@ -447,7 +597,7 @@ void dial_sw_enable (void);
 void msc_init (void);
 void msc_media_insert_change (int available);
 int msc_scsi_write (uint32_t lba, const uint8_t *buf, size_t size);
-int msc_scsi_read (uint32_t lba, const uint8_t **sector_p);
+int msc_scsi_read (uint32_t lba, uint8_t *sector);
 void msc_scsi_stop (uint8_t code);
 # endif
 #define PIN_INPUT_CURRENT 1
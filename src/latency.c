@@ -0,0 +1,136 @@
+/*
+ * latency.c -- Latency histograms of commands
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Latency is measured by the CCID thread, from when a command is
+ * given to the OpenPGP thread, to when (the first part of) its
+ * response has been sent to the host.
+ *
+ * A histogram is kept for each class of command: INS, and algorithm
+ * of the key for PSO and INTERNAL AUTHENTICATE.  Bucket N counts
+ * latency in [2^N, 2^(N+1)) microseconds (bucket 0 includes 0), the
+ * last bucket counts everything longer.  Counts saturate at 0xffff.
+ *
+ * The histograms can be read by GET DATA of the tag 0x0110, and
+ * cleared by PUT DATA of it (with no data, admin authorized).  Its
+ * format is, for each class:
+ *
+ *   INS (1 byte), ALG (1 byte), LATENCY_BUCKETS counts (2 bytes each)
+ *
+ * ALG is 0 when not applicable, 0x80 | ALGO_xxx otherwise (ALGO_RSA2K
+ * is 0xff).  INS of 0x00 is for other commands, when the table is
+ * full.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "gnuk.h"
+
+#define LATENCY_CLASSES 10
+#define LATENCY_BUCKETS 24
+
+struct latency_class {
+  uint16_t count[LATENCY_BUCKETS];
+};
+
+static struct gpg_cmd_class latency_class[LATENCY_CLASSES];
+static struct latency_class latency_table[LATENCY_CLASSES];
+static uint8_t latency_num_classes;
+
+static uint32_t latency_start;
+static struct latency_class *latency_pending;
+
+void
+latency_cmd_received (void)
+{
+  latency_start = timestamp_get ();
+  latency_pending = NULL;
+}
+
+/*
+ * Called when the OpenPGP thread finishes the command.  The class is
+ * determined here, while the command header is still available.
+ */
+void
+latency_cmd_done (const struct apdu *a)
+{
+  latency_pending = &latency_table[gpg_cmd_class_get (a, latency_class,
+						      &latency_num_classes,
+						      LATENCY_CLASSES)];
+}
+
+/* Called when a response has been sent.  */
+void
+latency_res_sent (void)
+{
+  uint32_t usec;
+  int n;
+
+  if (latency_pending == NULL)
+    return;
+
+  usec = timestamp_get () - latency_start;
+  for (n = 0; n < LATENCY_BUCKETS - 1 && (usec >> (n + 1)); n++)
+    ;
+
+  if (latency_pending->count[n] != 0xffff)
+    latency_pending->count[n]++;
+
+  latency_pending = NULL;
+}
+
+int
+latency_size (void)
+{
+  return latency_num_classes * (2 + LATENCY_BUCKETS * 2);
+}
+
+/* Copy the histograms to P, and return the end.  */
+uint8_t *
+latency_copy (uint8_t *p)
+{
+  int i, j;
+
+  for (i = 0; i < latency_num_classes; i++)
+    {
+      *p++ = latency_class[i].ins;
+      *p++ = latency_class[i].alg;
+      for (j = 0; j < LATENCY_BUCKETS; j++)
+	{
+	  *p++ = latency_table[i].count[j] >> 8;
+	  *p++ = latency_table[i].count[j] & 0xff;
+	}
+    }
+
+  return p;
+}
+
+void
+latency_clear (void)
+{
+  memset (latency_class, 0, sizeof latency_class);
+  memset (latency_table, 0, sizeof latency_table);
+  latency_num_classes = 0;
+}
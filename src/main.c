@@ -38,6 +38,15 @@
 #ifdef GNU_LINUX_EMULATION
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#ifdef CRYPTO_WORKER_SUPPORT
+#include <pthread.h>
+#include "crypto-worker.h"
+#endif
 #define main emulated_main
 #else
 #include "mcu/stm32f103.h"
@@ -55,6 +64,101 @@
 #ifdef GNU_LINUX_EMULATION
 uint8_t *flash_addr_key_storage_start;
 uint8_t *flash_addr_data_storage_start;
+
+void
+timestamp_init (void)
+{
+}
+
+uint32_t
+timestamp_get (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint32_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Fill the flash image DST (file descriptor) by TEMPLATE, which is
+ * only read.  On a file system with reflink, DST shares the blocks
+ * with TEMPLATE, and they are copied on write.  Otherwise, it's a
+ * copy (8 KiB).
+ */
+static int
+flash_image_clone (const char *template, int dst)
+{
+  char buf[1024];
+  ssize_t len;
+  int src;
+  int r = 0;
+
+  src = open (template, O_RDONLY);
+  if (src < 0)
+    return -1;
+
+#ifdef FICLONE
+  if (ioctl (dst, FICLONE, src) == 0)
+    {
+      close (src);
+      return 0;
+    }
+#endif
+
+  while ((len = read (src, buf, sizeof buf)) > 0)
+    if (write (dst, buf, len) != len)
+      {
+	r = -1;
+	break;
+      }
+
+  if (len < 0)
+    r = -1;
+
+  close (src);
+  return r;
+}
+
+/*
+ * Start the token from TEMPLATE, with its own overlay PATH.  When PATH
+ * exists, it's used as is (overlay of previous run).  When PATH is
+ * NULL, the overlay is a temporary file, which is removed after
+ * flash_init.  Return the path of the overlay, or NULL on error.
+ */
+static const char *
+flash_image_overlay (const char *template, const char *path,
+		     int *temporary_p)
+{
+  static char tmp_path[] = "/tmp/gnuk-flash-XXXXXX";
+  int fd;
+
+  *temporary_p = 0;
+  if (path == NULL)
+    {
+      fd = mkstemp (tmp_path);
+      path = tmp_path;
+      *temporary_p = 1;
+    }
+  else
+    {
+      fd = open (path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+      if (fd < 0 && access (path, F_OK) == 0)
+	return path;
+    }
+
+  if (fd < 0)
+    return NULL;
+
+  if (flash_image_clone (template, fd) < 0)
+    {
+      close (fd);
+      unlink (path);
+      return NULL;
+    }
+
+  close (fd);
+  return path;
+}
 #else
 #define ID_OFFSET (2+SERIALNO_STR_LEN*2)
 static void
@@ -233,6 +337,8 @@ main (int argc, const char *argv[])
   uintptr_t flash_addr;
   const char *flash_image_path;
   char *path_string = NULL;
+  const char *flash_template = NULL;
+  int flash_temporary = 0;
 #endif
 #ifdef FLASH_UPGRADE_SUPPORT
   uintptr_t entry;
@@ -246,9 +352,13 @@ main (int argc, const char *argv[])
 #ifdef GNU_LINUX_EMULATION
 #define FLASH_IMAGE_NAME ".gnuk-flash-image"
 
-  if (argc >= 4 || (argc == 2 && !strcmp (argv[1], "--help")))
+  if (argc >= 8 || (argc == 2 && !strcmp (argv[1], "--help")))
     {
-      fprintf (stdout, "Usage: %s [--vidpid=Vxxx:Pxxx] [flash-image-file]",
+      fprintf (stdout, "Usage: %s [--debug=N] [--apdu-trace=FILE] "
+#ifdef PROFILER
+	       "[--profile=FILE] "
+#endif
+	       "[--vidpid=Vxxx:Pxxx] [--template=FILE] [flash-image-file]",
 	       argv[0]);
       return 0;
     }
@@ -260,6 +370,30 @@ main (int argc, const char *argv[])
       argv++;
     }
 
+  if (argc >= 2 && !strncmp (argv[1], "--apdu-trace=", 13))
+    {
+      if (apdu_trace_open (&argv[1][13]) < 0)
+	{
+	  fprintf (stderr, "Can't open %s\n", &argv[1][13]);
+	  return 1;
+	}
+      argc--;
+      argv++;
+    }
+
+#ifdef PROFILER
+  if (argc >= 2 && !strncmp (argv[1], "--profile=", 10))
+    {
+      if (profile_start (&argv[1][10]) < 0)
+	{
+	  fprintf (stderr, "Can't start profiler\n");
+	  return 1;
+	}
+      argc--;
+      argv++;
+    }
+#endif
+
   if (argc >= 2 && !strncmp (argv[1], "--vidpid=", 9))
     {
       extern uint8_t device_desc[];
@@ -281,7 +415,25 @@ main (int argc, const char *argv[])
       argv++;
     }
 
-  if (argc == 1)
+  if (argc >= 2 && !strncmp (argv[1], "--template=", 11))
+    {
+      flash_template = &argv[1][11];
+      argc--;
+      argv++;
+    }
+
+  if (flash_template)
+    {
+      flash_image_path = flash_image_overlay (flash_template,
+					      argc == 1 ? NULL : argv[1],
+					      &flash_temporary);
+      if (flash_image_path == NULL)
+	{
+	  fprintf (stderr, "Can't make flash image from %s\n", flash_template);
+	  return 1;
+	}
+    }
+  else if (argc == 1)
     {
       char *p = getenv ("HOME");
 
@@ -302,6 +454,10 @@ main (int argc, const char *argv[])
     flash_image_path = argv[1];
 
   flash_addr = flash_init (flash_image_path);
+  if (flash_temporary)
+    unlink (flash_image_path);
+  if (path_string)
+    free (path_string);
   flash_addr_key_storage_start = (uint8_t *)flash_addr;
   flash_addr_data_storage_start = (uint8_t *)flash_addr + 4096;
 #else
@@ -311,10 +467,9 @@ main (int argc, const char *argv[])
 
   flash_unlock ();
 
-#ifdef GNU_LINUX_EMULATION
-    if (path_string)
-      free (path_string);
-#else
+  timestamp_init ();
+
+#ifndef GNU_LINUX_EMULATION
   device_initialize_once ();
 #endif
 
@@ -324,10 +479,16 @@ main (int argc, const char *argv[])
 
   random_init ();
 
+#ifdef CRYPTO_WORKER_SUPPORT
+  crypto_worker_init ();
+#endif
+
 #ifdef DEBUG
   stdout_init ();
+  debug_init ();
 #endif
 
+  STACK_REGISTER ("ccid", STACK_ADDR_CCID, STACK_SIZE_CCID);
   ccid_thd = chopstx_create (PRIO_CCID, STACK_ADDR_CCID, STACK_SIZE_CCID,
 			     ccid_thread, NULL);
 
@@ -390,6 +551,10 @@ main (int argc, const char *argv[])
   /* Finish application.  */
   chopstx_join (ccid_thd, NULL);
 
+#ifdef CRYPTO_WORKER_SUPPORT
+  crypto_worker_fini ();
+#endif
+
 #ifdef FLASH_UPGRADE_SUPPORT
   /* Set vector */
   SCB->VTOR = (uintptr_t)&_regnual_start;
@@ -446,19 +611,34 @@ fatal (uint8_t code)
 /*
  * Malloc for Gnuk.
  *
- * Each memory chunk has header with size information.
- * The size of chunk is at least 16.
+ * Each memory chunk has header with size information.  The size of
+ * chunk is multiple of HEAP_ALIGNMENT, and lower bits of the header
+ * are used as flags: CHUNK_INUSE for the chunk itself, and
+ * CHUNK_PREV_INUSE for the chunk just before.
+ *
+ * When it is free, ->NEXT and ->PREV are used for doubly linked
+ * list, and the last word of the chunk has a copy of the size, so
+ * that the next chunk can find it when coalescing.  Thus, the size of
+ * chunk is at least four words, which is HEAP_ALIGNMENT.
  *
- * Free memory is managed by FREE_LIST.
+ * Free memory is managed by segregated lists of FREE_LIST by size
+ * class.  Smaller classes are exact (by HEAP_ALIGNMENT), which
+ * matches allocation of PolarSSL's mpi, and larger classes are by
+ * power of two.  FREE_MAP has a bit for non-empty list.  Allocation,
+ * and free with coalescing to its neighbors, are done in constant
+ * time.
  *
- * When it is managed in FREE_LIST, three pointers, ->NEXT, ->PREV,
- * and ->NEIGHBOR is used.  NEXT and PREV is to implement doubly
- * linked list.  NEIGHBOR is to link adjacent memory chunk to be
- * reclaimed to system.
+ * A free chunk is never next to HEAP_P; it is reclaimed to system
+ * by lowering HEAP_P, instead.
  */
 
 #ifdef GNU_LINUX_EMULATION
+#ifdef CRYPTO_WORKER_SUPPORT
+/* Two exponentiations of RSA CRT may run at the same time.  */
+#define HEAP_SIZE (64*1024)
+#else
 #define HEAP_SIZE (32*1024)
+#endif
 uint8_t __heap_base__[HEAP_SIZE];
 
 #define HEAP_START __heap_base__
@@ -478,26 +658,89 @@ extern uint8_t __heap_end__[];
 
 static uint8_t *heap_p;
 static chopstx_mutex_t malloc_mtx;
+#ifdef CRYPTO_WORKER_SUPPORT
+/*
+ * Crypto workers are host threads outside of Chopstx.  They can't use
+ * MALLOC_MTX; instead, all threads serialize on MALLOC_HOST_MTX.
+ */
+static pthread_mutex_t malloc_host_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+malloc_lock (void)
+{
+  if (!crypto_worker_self ())
+    chopstx_mutex_lock (&malloc_mtx);
+  pthread_mutex_lock (&malloc_host_mtx);
+}
+
+static void
+malloc_unlock (void)
+{
+  pthread_mutex_unlock (&malloc_host_mtx);
+  if (!crypto_worker_self ())
+    chopstx_mutex_unlock (&malloc_mtx);
+}
+#else
+#define malloc_lock()   chopstx_mutex_lock (&malloc_mtx)
+#define malloc_unlock() chopstx_mutex_unlock (&malloc_mtx)
+#endif
 
 struct mem_head {
-  uintptr_t size;
+  uintptr_t size;		/* with CHUNK_xxx flags */
   /**/
   struct mem_head *next, *prev;	/* free list chain */
-  struct mem_head *neighbor;	/* backlink to neighbor */
 };
 
+#define CHUNK_INUSE      1
+#define CHUNK_PREV_INUSE 2
+#define CHUNK_FLAGS      3
+#define CHUNK_SIZE(x)    ((x)->size & ~CHUNK_FLAGS)
+#define CHUNK_NEXT(x)    ((struct mem_head *)((uint8_t *)(x) + CHUNK_SIZE (x)))
+
 #define MEM_HEAD_IS_CORRUPT(x) \
-    ((x)->size != HEAP_ALIGN((x)->size) || (x)->size > HEAP_SIZE)
+    (((x)->size & (HEAP_ALIGNMENT - 1) & ~CHUNK_FLAGS) \
+     || CHUNK_SIZE (x) == 0 || CHUNK_SIZE (x) > HEAP_SIZE)
 #define MEM_HEAD_CHECK(x) if (MEM_HEAD_IS_CORRUPT(x)) fatal (FATAL_HEAP)
 
-static struct mem_head *free_list;
+#define HEAP_EXACT_CLASSES 8
+#define HEAP_CLASSES       16
+/* Smallest chunk in the last class: 1024 units.  */
+#define HEAP_LAST_CLASS_MIN \
+  ((16 << (HEAP_CLASSES - HEAP_EXACT_CLASSES - 2)) * HEAP_ALIGNMENT)
+
+/*
+ * Two chunks in the last class can't be free at the same time, when
+ * the heap is smaller than two of them and a chunk in use in between
+ * (free chunks are coalesced).  Then, search of the last class in
+ * find_free_chunk is a single step.  It's 16KiB on STM32F103, larger
+ * than its heap; for the emulation, check it here.
+ */
+#if defined(GNU_LINUX_EMULATION) \
+    && HEAP_SIZE >= 2 * HEAP_LAST_CLASS_MIN + HEAP_ALIGNMENT
+#error "HEAP_SIZE is too large for HEAP_CLASSES"
+#endif
+
+static struct mem_head *free_list[HEAP_CLASSES];
+static uint32_t free_map;
+
+#ifdef HEAP_STATS
+static uintptr_t heap_in_use;
+static uintptr_t heap_peak_in_use;
+static uintptr_t heap_peak_brk;
+static uint32_t heap_num_alloc;
+static uint32_t heap_num_fail;
+#endif
 
 static void
 gnuk_malloc_init (void)
 {
+  int i;
+
   chopstx_mutex_init (&malloc_mtx);
   heap_p = HEAP_START;
-  free_list = NULL;
+  for (i = 0; i < HEAP_CLASSES; i++)
+    free_list[i] = NULL;
+  free_map = 0;
 }
 
 static void *
@@ -509,60 +752,129 @@ sbrk (size_t size)
     return NULL;
 
   heap_p += size;
+#ifdef HEAP_STATS
+  if ((uintptr_t)(heap_p - HEAP_START) > heap_peak_brk)
+    heap_peak_brk = heap_p - HEAP_START;
+#endif
   return p;
 }
 
+static int
+size_class (uintptr_t size)
+{
+  uintptr_t units = size / HEAP_ALIGNMENT;
+  int c;
+
+  if (units <= HEAP_EXACT_CLASSES)
+    return units - 1;
+
+  /* 9..15 units is the class HEAP_EXACT_CLASSES, 16..31 is next...  */
+  for (c = HEAP_EXACT_CLASSES; units >= 16 && c < HEAP_CLASSES - 1; c++)
+    units >>= 1;
+  return c;
+}
+
+static void
+add_to_free_list (struct mem_head *m)
+{
+  int c = size_class (CHUNK_SIZE (m));
+
+  ((uintptr_t *)CHUNK_NEXT (m))[-1] = CHUNK_SIZE (m);
+  m->prev = NULL;
+  m->next = free_list[c];
+  if (m->next)
+    m->next->prev = m;
+  free_list[c] = m;
+  free_map |= (1 << c);
+}
+
 static void
 remove_from_free_list (struct mem_head *m)
 {
+  int c = size_class (CHUNK_SIZE (m));
+
   if (m->prev)
     m->prev->next = m->next;
-  else
-    free_list = m->next;
+  else if ((free_list[c] = m->next) == NULL)
+    free_map &= ~(1 << c);
   if (m->next)
     m->next->prev = m->prev;
 }
 
+static struct mem_head *
+find_free_chunk (uintptr_t size)
+{
+  int c = size_class (size);
+  struct mem_head *m = free_list[c];
+
+  /* Any in an exact class fits.  For others, try the first one.  */
+  if (m && (c < HEAP_EXACT_CLASSES || CHUNK_SIZE (m) >= size))
+    return m;
+
+  if (c == HEAP_CLASSES - 1)
+    {
+      /*
+       * The last class has no upper bound; search it.  It has a chunk
+       * at most (see HEAP_LAST_CLASS_MIN).
+       */
+      while (m && CHUNK_SIZE (m) < size)
+	m = m->next;
+      return m;
+    }
+
+  /* Any in a larger class fits; take the smallest one.  */
+  for (c++; c < HEAP_CLASSES; c++)
+    if ((free_map & (1 << c)))
+      return free_list[c];
+
+  return NULL;
+}
+
 
 void *
 gnuk_malloc (size_t size)
 {
   struct mem_head *m;
-  struct mem_head *m0;
 
   size = HEAP_ALIGN (size + sizeof (uintptr_t));
 
-  chopstx_mutex_lock (&malloc_mtx);
+  malloc_lock ();
   DEBUG_INFO ("malloc: ");
   DEBUG_SHORT (size);
-  m = free_list;
 
-  while (1)
+  m = find_free_chunk (size);
+  if (m)
     {
-      if (m == NULL)
-	{
-	  m = (struct mem_head *)sbrk (size);
-	  if (m)
-	    m->size = size;
-	  break;
-	}
       MEM_HEAD_CHECK (m);
-      if (m->size == size)
-	{
-	  remove_from_free_list (m);
-	  m0 = free_list;
-	  while (m0)
-	    if (m0->neighbor == m)
-	      m0->neighbor = NULL;
-	    else
-	      m0 = m0->next;
-	  break;
+      remove_from_free_list (m);
+      if (CHUNK_SIZE (m) > size)
+	{			/* Split, and put back the rest.  */
+	  struct mem_head *r = (struct mem_head *)((uint8_t *)m + size);
+
+	  r->size = (CHUNK_SIZE (m) - size) | CHUNK_PREV_INUSE;
+	  add_to_free_list (r);
+	  m->size = size | (m->size & CHUNK_PREV_INUSE);
 	}
-
-      m = m->next;
+      else
+	CHUNK_NEXT (m)->size |= CHUNK_PREV_INUSE;
+      m->size |= CHUNK_INUSE;
+    }
+  else
+    {
+      /* The chunk at the end is always in use.  */
+      m = (struct mem_head *)sbrk (size);
+      if (m)
+	m->size = size | CHUNK_INUSE | CHUNK_PREV_INUSE;
     }
 
-  chopstx_mutex_unlock (&malloc_mtx);
+#ifdef HEAP_STATS
+  heap_num_alloc++;
+  if (m == NULL)
+    heap_num_fail++;
+  else if ((heap_in_use += size) > heap_peak_in_use)
+    heap_peak_in_use = heap_in_use;
+#endif
+  malloc_unlock ();
   if (m == NULL)
     {
       DEBUG_WORD (0);
@@ -580,51 +892,199 @@ void
 gnuk_free (void *p)
 {
   struct mem_head *m = (struct mem_head *)((void *)p - sizeof (uintptr_t));
-  struct mem_head *m0;
+  struct mem_head *mn;
 
   if (p == NULL)
     return;
 
-  chopstx_mutex_lock (&malloc_mtx);
-  m0 = free_list;
+  malloc_lock ();
   DEBUG_INFO ("free: ");
-  DEBUG_SHORT (m->size);
+  DEBUG_SHORT (CHUNK_SIZE (m));
   DEBUG_WORD ((uintptr_t)p);
 
   MEM_HEAD_CHECK (m);
-  m->neighbor = NULL;
-  while (m0)
-    {
-      MEM_HEAD_CHECK (m0);
-      if ((void *)m + m->size == (void *)m0)
-	m0->neighbor = m;
-      else if ((void *)m0 + m0->size == (void *)m)
-	m->neighbor = m0;
+  if (!(m->size & CHUNK_INUSE))
+    fatal (FATAL_HEAP);
+#ifdef HEAP_STATS
+  heap_in_use -= CHUNK_SIZE (m);
+#endif
+  m->size &= ~CHUNK_INUSE;
 
-      m0 = m0->next;
+  if (!(m->size & CHUNK_PREV_INUSE))
+    {				/* Coalesce with the previous.  */
+      struct mem_head *mp;
+
+      mp = (struct mem_head *)((uint8_t *)m - ((uintptr_t *)m)[-1]);
+      MEM_HEAD_CHECK (mp);
+      remove_from_free_list (mp);
+      mp->size += CHUNK_SIZE (m);
+      m = mp;
     }
 
-  if ((void *)m + m->size == heap_p)
+  mn = CHUNK_NEXT (m);
+  if ((uint8_t *)mn == heap_p)
+    heap_p = (uint8_t *)m;
+  else
     {
-      struct mem_head *mn = m->neighbor;
-
-      heap_p -= m->size;
-      while (mn)
-	{
-	  MEM_HEAD_CHECK (mn);
-	  heap_p -= mn->size;
+      MEM_HEAD_CHECK (mn);
+      if (!(mn->size & CHUNK_INUSE))
+	{			/* Coalesce with the next.  */
 	  remove_from_free_list (mn);
-	  mn = mn->neighbor;
+	  m->size += CHUNK_SIZE (mn);
 	}
+      else
+	mn->size &= ~CHUNK_PREV_INUSE;
+      add_to_free_list (m);
     }
-  else
+
+  malloc_unlock ();
+}
+
+#ifdef HEAP_STATS
+int
+heap_stat_size (void)
+{
+  return 9 * 4 + HEAP_CLASSES * 2;
+}
+
+static uint8_t *
+put_uint32 (uint8_t *p, uint32_t v)
+{
+  *p++ = v >> 24;
+  *p++ = (v >> 16) & 0xff;
+  *p++ = (v >> 8) & 0xff;
+  *p++ = v & 0xff;
+  return p;
+}
+
+/*
+ * Copy the statistics to P, and return the end.  Sizes are in bytes,
+ * including headers of chunks.
+ */
+uint8_t *
+heap_stat_copy (uint8_t *p)
+{
+  uint16_t len[HEAP_CLASSES];
+  uintptr_t free_bytes = 0, largest = 0;
+  uintptr_t brk;
+  struct mem_head *m;
+  int i;
+
+  malloc_lock ();
+  for (i = 0; i < HEAP_CLASSES; i++)
+    for (len[i] = 0, m = free_list[i]; m; m = m->next)
+      {
+	len[i]++;
+	free_bytes += CHUNK_SIZE (m);
+	if (CHUNK_SIZE (m) > largest)
+	  largest = CHUNK_SIZE (m);
+      }
+
+  brk = heap_p - HEAP_START;
+  p = put_uint32 (p, HEAP_SIZE);
+  p = put_uint32 (p, brk);
+  p = put_uint32 (p, heap_peak_brk);
+  p = put_uint32 (p, heap_in_use);
+  p = put_uint32 (p, heap_peak_in_use);
+  p = put_uint32 (p, free_bytes);
+  p = put_uint32 (p, largest);
+  p = put_uint32 (p, heap_num_alloc);
+  p = put_uint32 (p, heap_num_fail);
+  for (i = 0; i < HEAP_CLASSES; i++)
+    {
+      *p++ = len[i] >> 8;
+      *p++ = len[i] & 0xff;
+    }
+  malloc_unlock ();
+
+  return p;
+}
+
+/* Reset peaks to current values, and clear counters.  */
+void
+heap_stat_clear (void)
+{
+  malloc_lock ();
+  heap_peak_brk = heap_p - HEAP_START;
+  heap_peak_in_use = heap_in_use;
+  heap_num_alloc = heap_num_fail = 0;
+  malloc_unlock ();
+}
+#endif
+
+/*
+ * Scratch memory for large temporaries of crypto operations, instead
+ * of stack of the OpenPGP thread (see SIZE_3 of stack-def.h).  It's
+ * sized for the largest, RSA signature: TEMP of rsa_sign, and D, W1
+ * and the window table of mpi_exp_mod for CRT (a half of the
+ * modulus), with MAX_WSIZE of bignum.c.
+ *
+ * Only the OpenPGP thread runs a crypto operation at a time, so, it
+ * is allocated and freed in LIFO order.  When it's not enough (or
+ * for crypto workers), it falls back to the heap.  A chunk is cleared
+ * when freed, as it may hold secrets.
+ */
+#define SCRATCH_ALIGN(n) (((n) + 7) & ~7)
+#ifdef ALGO_ENABLE_RSA
+#if MEMORY_SIZE >= 32
+#define SCRATCH_SIZE (512 + (3 + 32) * 256)	/* RSA-4096 */
+#elif MEMORY_SIZE >= 24
+#define SCRATCH_SIZE (512 + (3 + 16) * 256)	/* RSA-4096 */
+#else
+#define SCRATCH_SIZE (256 + (3 + 8) * 128)	/* RSA-2048 */
+#endif
+#else
+/* Key data, with another loaded while writing a key.  */
+#define SCRATCH_SIZE \
+  (2 * SCRATCH_ALIGN (MAX_PRVKEY_LEN + DATA_ENCRYPTION_KEY_SIZE))
+#endif
+
+static uint8_t scratch[SCRATCH_SIZE] __attribute__ ((aligned (8)));
+static uint8_t *scratch_p = scratch;
+
+void *
+gnuk_scratch_alloc (size_t size)
+{
+  void *p;
+
+#ifdef CRYPTO_WORKER_SUPPORT
+  if (crypto_worker_self ())
+    return gnuk_malloc (size);
+#endif
+
+  size = SCRATCH_ALIGN (size);
+  if ((size_t)(scratch + SCRATCH_SIZE - scratch_p) < size)
+    return gnuk_malloc (size);
+
+  p = scratch_p;
+  scratch_p += size;
+  return p;
+}
+
+void
+gnuk_scratch_free (void *p)
+{
+  uint8_t *q = (uint8_t *)p;
+
+  if (q >= scratch && q < scratch + SCRATCH_SIZE)
     {
-      m->next = free_list;
-      m->prev = NULL;
-      if (free_list)
-	free_list->prev = m;
-      free_list = m;
+      /* Chunks allocated after this are freed too.  */
+      memset (q, 0, scratch_p - q);
+      scratch_p = q;
     }
+  else if (p)
+    {
+      struct mem_head *m = (struct mem_head *)(q - sizeof (uintptr_t));
+
+      memset (p, 0, CHUNK_SIZE (m) - sizeof (uintptr_t));
+      gnuk_free (p);
+    }
+}
 
-  chopstx_mutex_unlock (&malloc_mtx);
+/* Free all, when an operation has been cancelled.  */
+void
+gnuk_scratch_reset (void)
+{
+  memset (scratch, 0, scratch_p - scratch);
+  scratch_p = scratch;
 }
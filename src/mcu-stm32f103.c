@@ -1,7 +1,7 @@
 /*
  * mcu-stm32f103.c - STM32F103 specific routines
  *
- * Copyright (C) 2017
+ * Copyright (C) 2017, 2026
  *               Free Software Initiative of Japan
  * Author: NIIBE Yutaka <gniibe@fsij.org>
  *
@@ -30,3 +30,52 @@ sram_address (uint32_t offset)
 {
   return ((uint8_t *)0x20000000) + offset;
 }
+
+/* Cycle counter of DWT (Data Watchpoint and Trace unit).  */
+#define DEMCR      (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA 0x01000000
+#define DWT_CTRL   (*(volatile uint32_t *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA 0x00000001
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+
+#define CYCLES_PER_USEC 72
+
+static uint32_t timestamp_cycle;
+static uint32_t timestamp_cycle_rem;
+static uint32_t timestamp_usec;
+
+void
+timestamp_init (void)
+{
+  DEMCR |= DEMCR_TRCENA;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+  timestamp_cycle = timestamp_cycle_rem = timestamp_usec = 0;
+}
+
+/*
+ * Microseconds, by the cycles since the last call.  It's called by
+ * any thread, so, interrupts are disabled while updating.
+ */
+uint32_t
+timestamp_get (void)
+{
+  uint32_t primask, cycle, d, usec;
+
+  asm volatile ("mrs	%0, PRIMASK\n\t"
+		"cpsid	i" : "=r" (primask) : : "memory");
+  cycle = DWT_CYCCNT;
+  d = cycle - timestamp_cycle;
+  timestamp_cycle = cycle;
+  timestamp_usec += d / CYCLES_PER_USEC;
+  timestamp_cycle_rem += d % CYCLES_PER_USEC;
+  if (timestamp_cycle_rem >= CYCLES_PER_USEC)
+    {
+      timestamp_usec++;
+      timestamp_cycle_rem -= CYCLES_PER_USEC;
+    }
+  usec = timestamp_usec;
+  asm volatile ("msr	PRIMASK, %0" : : "r" (primask) : "memory");
+
+  return usec;
+}
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "bn.h"
+#include "opcount.h"
 
 /**
  * @brief X = A mod B (using MU=(1<<(256)+MU_lower)) (Barret reduction)
@@ -37,6 +38,7 @@ mod_reduce (bn256 *X, const bn512 *A, const bn256 *B, const bn256 *MU_lower)
   uint32_t carry;
 #define borrow carry
 
+  OPCOUNT (OPC_MOD_REDUCE);
   memset (q, 0, sizeof (bn256));
   q->word[0] = A->word[15];
   bn256_mul (tmp, q, MU_lower);
@@ -156,6 +158,7 @@ mod_inv (bn256 *C, const bn256 *X, const bn256 *N)
 #define borrow carry
   int n = MAX_GCD_STEPS_BN256;
 
+  OPCOUNT (OPC_INV);
   memset (tmp, 0, sizeof (bn256));
   memset (C, 0, sizeof (bn256));
   memcpy (u, X, sizeof (bn256));
@@ -37,6 +37,7 @@
 
 #include "bn.h"
 #include "mod25638.h"
+#include "opcount.h"
 
 #ifndef BN256_C_IMPLEMENTATION
 #define ASM_IMPLEMENTATION 1
@@ -98,6 +99,7 @@ mod25638_add (bn256 *X, const bn256 *A, const bn256 *B)
 {
   uint32_t carry;
 
+  OPCOUNT (OPC_ADD);
   carry = bn256_add (X, A, B);
   carry = bn256_add_uint (X, X, carry*38);
   X->word[0] += carry * 38;
@@ -111,6 +113,7 @@ mod25638_sub (bn256 *X, const bn256 *A, const bn256 *B)
 {
   uint32_t borrow;
 
+  OPCOUNT (OPC_ADD);
   borrow = bn256_sub (X, A, B);
   borrow = bn256_sub_uint (X, X, borrow*38);
   X->word[0] -= borrow * 38;
@@ -132,10 +135,12 @@ mod25638_reduce (bn256 *X, bn512 *A)
   const uint32_t *s;
   uint32_t *d;
   uint32_t w;
-
 #if ASM_IMPLEMENTATION
   uint32_t c, c0;
+#endif
 
+  OPCOUNT (OPC_REDUCE);
+#if ASM_IMPLEMENTATION
   s = &A->word[8]; d = &A->word[0]; w = 38; MULADD_256 (s, d, w, c);
   c0 = A->word[8] * 38;
   d = &X->word[0];
@@ -179,6 +184,7 @@ mod25638_mul (bn256 *X, const bn256 *A, const bn256 *B)
 {
   bn512 tmp[1];
 
+  OPCOUNT (OPC_MUL);
   bn256_mul (tmp, A, B);
   mod25638_reduce (X, tmp);
 }
@@ -191,6 +197,7 @@ mod25638_sqr (bn256 *X, const bn256 *A)
 {
   bn512 tmp[1];
 
+  OPCOUNT (OPC_SQR);
   bn256_sqr (tmp, A);
   mod25638_reduce (X, tmp);
 }
@@ -206,6 +213,7 @@ mod25638_shift (bn256 *X, const bn256 *A, int shift)
   uint32_t carry;
   bn256 tmp[1];
 
+  OPCOUNT (OPC_ADD);
   carry = bn256_shift (X, A, shift);
   if (shift < 0)
     return;
@@ -29,6 +29,7 @@
 
 #include "bn.h"
 #include "modp256k1.h"
+#include "opcount.h"
 
 /*
 256      224      192      160      128       96       64       32        0
@@ -72,6 +73,7 @@ modp256k1_add (bn256 *X, const bn256 *A, const bn256 *B)
   uint32_t cond;
   bn256 tmp[1];
 
+  OPCOUNT (OPC_ADD);
   cond = (bn256_add (X, A, B) == 0);
   cond &= bn256_sub (tmp, X, P256K1);
   if (cond)
@@ -90,6 +92,7 @@ modp256k1_sub (bn256 *X, const bn256 *A, const bn256 *B)
   uint32_t borrow;
   bn256 tmp[1];
 
+  OPCOUNT (OPC_ADD);
   borrow = bn256_sub (X, A, B);
   bn256_add (tmp, X, P256K1);
   if (borrow)
@@ -112,6 +115,7 @@ modp256k1_reduce (bn256 *X, const bn512 *A)
 #define s01 tmp->word[1]
 #define s02 tmp->word[2]
 
+  OPCOUNT (OPC_REDUCE);
 #define W0 X
 #define W1 tmp
 #define W2 tmp
@@ -271,6 +275,7 @@ modp256k1_mul (bn256 *X, const bn256 *A, const bn256 *B)
 {
   bn512 AB[1];
 
+  OPCOUNT (OPC_MUL);
   bn256_mul (AB, A, B);
   modp256k1_reduce (X, AB);
 }
@@ -283,6 +288,7 @@ modp256k1_sqr (bn256 *X, const bn256 *A)
 {
   bn512 AA[1];
 
+  OPCOUNT (OPC_SQR);
   bn256_sqr (AA, A);
   modp256k1_reduce (X, AA);
 }
@@ -298,6 +304,7 @@ modp256k1_shift (bn256 *X, const bn256 *A, int shift)
   uint32_t carry;
   bn256 tmp[1];
 
+  OPCOUNT (OPC_ADD);
   carry = bn256_shift (X, A, shift);
   if (shift < 0)
     return;
@@ -30,6 +30,7 @@
 
 #include "bn.h"
 #include "modp256r1.h"
+#include "opcount.h"
 
 /*
 256      224      192      160      128       96       64       32        0
@@ -67,6 +68,7 @@ modp256r1_add (bn256 *X, const bn256 *A, const bn256 *B)
   uint32_t cond;
   bn256 tmp[1];
 
+  OPCOUNT (OPC_ADD);
   cond = (bn256_add (X, A, B) == 0);
   cond &= bn256_sub (tmp, X, P256R1);
   if (cond)
@@ -85,6 +87,7 @@ modp256r1_sub (bn256 *X, const bn256 *A, const bn256 *B)
   uint32_t borrow;
   bn256 tmp[1];
 
+  OPCOUNT (OPC_ADD);
   borrow = bn256_sub (X, A, B);
   bn256_add (tmp, X, P256R1);
   if (borrow)
@@ -102,6 +105,7 @@ modp256r1_reduce (bn256 *X, const bn512 *A)
   bn256 tmp[1], tmp0[1];
   uint32_t borrow;
 
+  OPCOUNT (OPC_REDUCE);
 #define S1 X
 #define S2 tmp
 #define S3 tmp
@@ -248,6 +252,7 @@ modp256r1_mul (bn256 *X, const bn256 *A, const bn256 *B)
 {
   bn512 AB[1];
 
+  OPCOUNT (OPC_MUL);
   bn256_mul (AB, A, B);
   modp256r1_reduce (X, AB);
 }
@@ -260,6 +265,7 @@ modp256r1_sqr (bn256 *X, const bn256 *A)
 {
   bn512 AA[1];
 
+  OPCOUNT (OPC_SQR);
   bn256_sqr (AA, A);
   modp256r1_reduce (X, AA);
 }
@@ -276,6 +282,7 @@ modp256r1_shift (bn256 *X, const bn256 *A, int shift)
 #define borrow carry
   bn256 tmp[1];
 
+  OPCOUNT (OPC_ADD);
   carry = bn256_shift (X, A, shift);
   if (shift < 0)
     return;
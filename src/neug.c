@@ -792,6 +792,7 @@ neug_init (uint32_t *buf, uint8_t size)
   neug_mode = NEUG_MODE_CONDITIONED;
   rb_init (rb, buf, size);
 
+  STACK_REGISTER ("rng", STACK_ADDR_RNG, STACK_SIZE_RNG);
   rng_thread = chopstx_create (PRIO_RNG, STACK_ADDR_RNG, STACK_SIZE_RNG,
 			       rng, rb);
 }
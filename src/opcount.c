@@ -0,0 +1,137 @@
+/*
+ * opcount.c -- Field operation counts of commands
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The counters (see opcount.h) are sampled when the OpenPGP thread
+ * starts a command and when it finishes, and the difference is added
+ * to the totals of the class of the command: INS, and algorithm of the
+ * key for PSO and INTERNAL AUTHENTICATE (see gpg_cmd_algo).  Commands
+ * without any operation are not recorded.
+ *
+ * The totals can be read by GET DATA of the tag 0x011a, and cleared
+ * by PUT DATA of it (with no data, admin authorized).  Its format is,
+ * for each class:
+ *
+ *   INS (1 byte), ALG (1 byte), number of commands (4 bytes),
+ *   OPC_NUM totals (4 bytes each, in order of enum opcount_kind)
+ *
+ * in big endian.  INS of 0x00 is for other commands, when the table
+ * is full.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "gnuk.h"
+#include "opcount.h"
+
+#define OPCOUNT_CLASSES 10
+
+struct opcount_class {
+  uint32_t count;
+  uint32_t total[OPC_NUM];
+};
+
+uint32_t opcount[OPC_NUM];
+
+static struct gpg_cmd_class opcount_class[OPCOUNT_CLASSES];
+static struct opcount_class opcount_table[OPCOUNT_CLASSES];
+static uint8_t opcount_num_classes;
+static uint32_t opcount_start[OPC_NUM];
+
+void
+opcount_cmd_start (void)
+{
+  int i;
+
+  for (i = 0; i < OPC_NUM; i++)
+    opcount_start[i] = __atomic_load_n (&opcount[i], __ATOMIC_RELAXED);
+}
+
+void
+opcount_cmd_done (const struct apdu *a)
+{
+  uint32_t delta[OPC_NUM];
+  struct opcount_class *c;
+  int i, any = 0;
+
+  for (i = 0; i < OPC_NUM; i++)
+    {
+      delta[i] = __atomic_load_n (&opcount[i], __ATOMIC_RELAXED)
+	- opcount_start[i];
+      any |= (delta[i] != 0);
+    }
+
+  if (!any)
+    return;
+
+  c = &opcount_table[gpg_cmd_class_get (a, opcount_class,
+					 &opcount_num_classes,
+					 OPCOUNT_CLASSES)];
+  c->count++;
+  for (i = 0; i < OPC_NUM; i++)
+    c->total[i] += delta[i];
+}
+
+int
+opcount_size (void)
+{
+  return opcount_num_classes * (2 + 4 + OPC_NUM * 4);
+}
+
+static uint8_t *
+put_u32 (uint8_t *p, uint32_t v)
+{
+  *p++ = v >> 24;
+  *p++ = v >> 16;
+  *p++ = v >> 8;
+  *p++ = v;
+  return p;
+}
+
+/* Copy the totals to P, and return the end.  */
+uint8_t *
+opcount_copy (uint8_t *p)
+{
+  int i, j;
+
+  for (i = 0; i < opcount_num_classes; i++)
+    {
+      *p++ = opcount_class[i].ins;
+      *p++ = opcount_class[i].alg;
+      p = put_u32 (p, opcount_table[i].count);
+      for (j = 0; j < OPC_NUM; j++)
+	p = put_u32 (p, opcount_table[i].total[j]);
+    }
+
+  return p;
+}
+
+void
+opcount_clear (void)
+{
+  memset (opcount_class, 0, sizeof opcount_class);
+  memset (opcount_table, 0, sizeof opcount_table);
+  opcount_num_classes = 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * opcount.h -- Counters of field operations
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * When built with OP_COUNT, field operations of modp256r1, modp256k1
+ * and mod25638, mod_inv, mod_reduce and mpi_montmul of PolarSSL count
+ * their calls.  Counters are shared by threads (crypto workers).
+ * Calls inside another operation are counted too; e.g. a reduction of
+ * modp256r1 is done by ten of add and sub.
+ *
+ * Keep in sync with tool/gnuk_opcount.py and bench/bench.c.
+ */
+
+#ifdef OP_COUNT
+enum opcount_kind {
+  OPC_MUL,			/* X = A * B mod P */
+  OPC_SQR,			/* X = A * A mod P */
+  OPC_ADD,			/* add, sub and shift mod P */
+  OPC_REDUCE,			/* including the ones by mul and sqr */
+  OPC_INV,			/* mod_inv */
+  OPC_MOD_REDUCE,		/* mod_reduce (by the order) */
+  OPC_MONTMUL,			/* mpi_montmul (RSA) */
+  OPC_NUM
+};
+
+extern uint32_t opcount[OPC_NUM];
+
+#define OPCOUNT(kind) \
+  __atomic_fetch_add (&opcount[kind], 1, __ATOMIC_RELAXED)
+#else
+#define OPCOUNT(kind)
+#endif
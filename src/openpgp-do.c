@@ -214,6 +214,15 @@ static const uint8_t *algo_attr_sig_p;
 static const uint8_t *algo_attr_dec_p;
 static const uint8_t *algo_attr_aut_p;
 
+/*
+ * Key location in the key storage (see flash_key_alloc):
+ *    NULL: No key
+ * Valid only when KEY_LOC_RECORDED_P != NULL.  Otherwise, it's the
+ * old layout, a page for each key.
+ */
+static const uint8_t *key_loc_p[3];
+static const uint8_t *key_loc_recorded_p;
+
 static const uint8_t **
 get_algo_attr_pointer (enum kind_of_key kk)
 {
@@ -251,6 +260,43 @@ gpg_get_algo_attr (enum kind_of_key kk)
   return algo_attr_p[1];
 }
 
+int
+gpg_get_key_loc (enum kind_of_key kk)
+{
+  if (key_loc_p[kk] == NULL)
+    return -1;
+
+  return key_loc_p[kk][1];
+}
+
+void
+gpg_set_key_loc (enum kind_of_key kk, uint8_t loc)
+{
+  const uint8_t *p;
+
+  /*
+   * Write new record before clearing old one, so that there is always
+   * a record (gpg_data_scan takes the last one).  Note that old one
+   * may be moved by flash_enum_write (with GC).
+   */
+  p = flash_enum_write (NR_KEY_LOC_SIG + kk, loc);
+  flash_enum_clear (&key_loc_p[kk]);
+  key_loc_p[kk] = p;
+}
+
+int
+gpg_key_loc_recorded (void)
+{
+  return key_loc_recorded_p != NULL;
+}
+
+void
+gpg_set_key_loc_recorded (void)
+{
+  if (key_loc_recorded_p == NULL)
+    key_loc_recorded_p = flash_bool_write (NR_BOOL_KEY_LOC);
+}
+
 static void
 gpg_reset_algo_attr (enum kind_of_key kk)
 {
@@ -371,29 +417,36 @@ gpg_reset_digital_signature_counter (void)
 {
   if (digital_signature_counter != 0)
     {
+      flash_dsc_retire ();
       flash_put_data (NR_COUNTER_DS);
       flash_put_data (NR_COUNTER_DS_LSB);
       digital_signature_counter = 0;
     }
 }
 
+/*
+ * The counter is incremented in its own area (see flash_dsc_init), so
+ * that signatures don't fill the data pool.  Only when the area is
+ * full (or not used yet), the value is written to the data pool.
+ */
 void
 gpg_increment_digital_signature_counter (void)
 {
   uint16_t hw0, hw1;
   uint32_t dsc = (digital_signature_counter + 1) & 0x00ffffff;
 
-  if ((dsc & 0x03ff) == 0)
-    { /* carry occurs from l10 to h14 */
-      hw0 = NR_COUNTER_DS | ((dsc & 0xfc0000) >> 18) | ((dsc & 0x03fc00) >> 2);
-      hw1 = NR_COUNTER_DS_LSB;	/* zero */
-      flash_put_data (hw0);
-      flash_put_data (hw1);
-    }
-  else
+  if (flash_dsc_increment () < 0)
     {
+      hw0 = NR_COUNTER_DS | ((dsc & 0xfc0000) >> 18) | ((dsc & 0x03fc00) >> 2);
       hw1 = NR_COUNTER_DS_LSB | ((dsc & 0x0300) >> 8) | ((dsc & 0x00ff) << 8);
+      flash_put_data (hw0);
       flash_put_data (hw1);
+      /*
+       * Invalidate the area before erasing it, so that the value in the
+       * data pool is used, if the erase is interrupted.
+       */
+      flash_dsc_retire ();
+      flash_dsc_rebase (dsc);
     }
 
   digital_signature_counter = dsc;
@@ -690,6 +743,200 @@ do_ds_count (uint16_t tag, int with_tag)
   return 1;
 }
 
+#ifdef LATENCY_STATS
+static int
+rw_latency (uint16_t tag, int with_tag,
+	    const uint8_t *data, int len, int is_write)
+{
+  (void)data;
+
+  if (is_write)
+    {
+      if (len != 0)
+	return 0;		/* Failure */
+
+      latency_clear ();
+      return 1;			/* Success */
+    }
+  else
+    {
+      if (with_tag)
+	{
+	  int size = latency_size ();
+
+	  copy_tag (tag);
+	  *res_p++ = 0x82;
+	  *res_p++ = size >> 8;
+	  *res_p++ = size & 0xff;
+	}
+
+      res_p = latency_copy (res_p);
+      return 1;
+    }
+}
+#endif
+
+#ifdef EVENT_TRACE
+static int
+rw_event_trace (uint16_t tag, int with_tag,
+	        const uint8_t *data, int len, int is_write)
+{
+  (void)data;
+
+  if (is_write)
+    {
+      if (len != 0)
+	return 0;		/* Failure */
+
+      event_trace_clear ();
+      return 1;			/* Success */
+    }
+  else
+    {
+      if (with_tag)
+	{
+	  int size = event_trace_size ();
+
+	  copy_tag (tag);
+	  *res_p++ = 0x82;
+	  *res_p++ = size >> 8;
+	  *res_p++ = size & 0xff;
+	}
+
+      res_p = event_trace_copy (res_p);
+      return 1;
+    }
+}
+#endif
+
+#ifdef HEAP_STATS
+static int
+rw_heap_stat (uint16_t tag, int with_tag,
+	      const uint8_t *data, int len, int is_write)
+{
+  (void)data;
+
+  if (is_write)
+    {
+      if (len != 0)
+	return 0;		/* Failure */
+
+      heap_stat_clear ();
+      return 1;			/* Success */
+    }
+  else
+    {
+      if (with_tag)
+	{
+	  int size = heap_stat_size ();
+
+	  copy_tag (tag);
+	  *res_p++ = 0x82;
+	  *res_p++ = size >> 8;
+	  *res_p++ = size & 0xff;
+	}
+
+      res_p = heap_stat_copy (res_p);
+      return 1;
+    }
+}
+#endif
+
+#ifdef STACK_STATS
+static int
+rw_stack_stat (uint16_t tag, int with_tag,
+	       const uint8_t *data, int len, int is_write)
+{
+  (void)data;
+
+  if (is_write)
+    {
+      if (len != 0)
+	return 0;		/* Failure */
+
+      stack_stat_clear ();
+      return 1;			/* Success */
+    }
+  else
+    {
+      if (with_tag)
+	{
+	  int size = stack_stat_size ();
+
+	  copy_tag (tag);
+	  *res_p++ = 0x82;
+	  *res_p++ = size >> 8;
+	  *res_p++ = size & 0xff;
+	}
+
+      res_p = stack_stat_copy (res_p);
+      return 1;
+    }
+}
+#endif
+
+#ifdef PROFILER
+static int
+rw_profile (uint16_t tag, int with_tag,
+	    const uint8_t *data, int len, int is_write)
+{
+  (void)data;
+
+  if (is_write)
+    {
+      if (len != 0)
+	return 0;		/* Failure */
+
+      profile_clear ();
+      return 1;			/* Success */
+    }
+  else
+    {
+      if (with_tag)
+	{
+	  copy_tag (tag);
+	  *res_p++ = profile_size ();
+	}
+
+      res_p = profile_copy (res_p);
+      return 1;
+    }
+}
+#endif
+
+#ifdef OP_COUNT
+static int
+rw_opcount (uint16_t tag, int with_tag,
+	    const uint8_t *data, int len, int is_write)
+{
+  (void)data;
+
+  if (is_write)
+    {
+      if (len != 0)
+	return 0;		/* Failure */
+
+      opcount_clear ();
+      return 1;			/* Success */
+    }
+  else
+    {
+      if (with_tag)
+	{
+	  int size = opcount_size ();
+
+	  copy_tag (tag);
+	  *res_p++ = 0x82;
+	  *res_p++ = size >> 8;
+	  *res_p++ = size & 0xff;
+	}
+
+      res_p = opcount_copy (res_p);
+      return 1;
+    }
+}
+#endif
+
 static int
 rw_pw_status (uint16_t tag, int with_tag,
 	      const uint8_t *data, int len, int is_write)
@@ -1012,6 +1259,13 @@ void
 gpg_do_clear_prvkey (enum kind_of_key kk)
 {
   memset (kd[kk].data, 0, MAX_PRVKEY_LEN);
+#if defined(ALGO_ENABLE_RSA) && MEMORY_SIZE < 32
+  /*
+   * On smaller parts, don't keep the blinding pair (two numbers of the
+   * size of N) on heap.  It is created again for next operation.
+   */
+  rsa_blinding_clear (kk);
+#endif
 }
 
 
@@ -1063,7 +1317,7 @@ gpg_do_load_prvkey (enum kind_of_key kk, int who, const uint8_t *keystring)
   const uint8_t *key_addr;
   uint8_t dek[DATA_ENCRYPTION_KEY_SIZE];
   const uint8_t *iv;
-  struct key_data_internal kdi;
+  struct key_data_internal *kdi;
 
   DEBUG_INFO ("Loading private key: ");
   DEBUG_BYTE (kk);
@@ -1071,24 +1325,30 @@ gpg_do_load_prvkey (enum kind_of_key kk, int who, const uint8_t *keystring)
   if (do_data == NULL)
     return 0;
 
+  kdi = gnuk_scratch_alloc (sizeof (struct key_data_internal));
+  if (kdi == NULL)
+    return -1;
+
   key_addr = kd[kk].pubkey - prvkey_len;
-  memcpy (kdi.data, key_addr, prvkey_len);
+  memcpy (kdi->data, key_addr, prvkey_len);
   iv = &do_data[1];
-  memcpy (CHECKSUM_ADDR (kdi, prvkey_len),
+  memcpy (CHECKSUM_ADDR (*kdi, prvkey_len),
 	  iv + INITIAL_VECTOR_SIZE, DATA_ENCRYPTION_KEY_SIZE);
 
   memcpy (dek, iv + DATA_ENCRYPTION_KEY_SIZE*(who+1), DATA_ENCRYPTION_KEY_SIZE);
   decrypt_dek (keystring, dek);
 
-  decrypt (dek, iv, (uint8_t *)&kdi, kdi_len (prvkey_len));
+  decrypt (dek, iv, (uint8_t *)kdi, kdi_len (prvkey_len));
   memset (dek, 0, DATA_ENCRYPTION_KEY_SIZE);
-  if (!compute_key_data_checksum (&kdi, prvkey_len, CKDC_CHECK))
+  if (!compute_key_data_checksum (kdi, prvkey_len, CKDC_CHECK))
     {
       DEBUG_INFO ("gpg_do_load_prvkey failed.\r\n");
+      gnuk_scratch_free (kdi);
       return -1;
     }
 
-  memcpy (kd[kk].data, kdi.data, prvkey_len);
+  memcpy (kd[kk].data, kdi->data, prvkey_len);
+  gnuk_scratch_free (kdi);
   DEBUG_BINARY (kd[kk].data, prvkey_len);
   return 1;
 }
@@ -1101,25 +1361,21 @@ gpg_do_delete_prvkey (enum kind_of_key kk, int clean_page_full)
 {
   uint8_t nr = get_do_ptr_nr_for_kk (kk);
   const uint8_t *do_data = do_ptr[nr];
-  uint8_t *key_addr;
-  int prvkey_len = gpg_get_algo_attr_key_size (kk, GPG_KEY_PRIVATE);
-  int key_size = gpg_get_algo_attr_key_size (kk, GPG_KEY_STORAGE);
 
   if (do_data == NULL)
     {
       if (clean_page_full)
-	flash_key_release_page (kk);
+	flash_key_release (kk);
       return;
     }
 
   do_ptr[nr] = NULL;
   flash_do_release (do_data);
-  key_addr = (uint8_t *)kd[kk].pubkey - prvkey_len;
   kd[kk].pubkey = NULL;
-  if (clean_page_full)
-    flash_key_release_page (kk);
-  else
-    flash_key_release (key_addr, key_size);
+  flash_key_release (kk);
+#ifdef ALGO_ENABLE_RSA
+  rsa_blinding_clear (kk);
+#endif
 
   if (admin_authorized == BY_ADMIN && kk == GPG_KEY_FOR_SIGNING)
     {			/* Recover admin keystring DO.  */
@@ -1155,7 +1411,12 @@ gpg_do_terminate (void)
   int i;
 
   for (i = 0; i < 3; i++)
-    kd[i].pubkey = NULL;
+    {
+      kd[i].pubkey = NULL;
+#ifdef ALGO_ENABLE_RSA
+      rsa_blinding_clear (i);
+#endif
+    }
 
   for (i = 0; i < NR_DO__LAST__; i++)
     do_ptr[i] = NULL;
@@ -1169,6 +1430,8 @@ gpg_do_terminate (void)
   pw_err_counter_p[PW_ERR_RC] = NULL;
   pw_err_counter_p[PW_ERR_PW3] = NULL;
   algo_attr_sig_p = algo_attr_dec_p = algo_attr_aut_p = NULL;
+  key_loc_p[0] = key_loc_p[1] = key_loc_p[2] = NULL;
+  key_loc_recorded_p = NULL;
 }
 
 static int
@@ -1184,7 +1447,7 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
   struct prvkey_data *pd = &prv;
   uint8_t *key_addr;
   const uint8_t *dek, *iv;
-  struct key_data_internal kdi;
+  struct key_data_internal *kdi;
   int pubkey_len;
   uint8_t ks[KEYSTRING_MD_SIZE];
   enum kind_of_key kk0;
@@ -1224,10 +1487,17 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
 	return -1;
     }
 
+  kdi = gnuk_scratch_alloc (sizeof (struct key_data_internal));
+  if (kdi == NULL)
+    return -1;
+
   DEBUG_INFO ("Getting keystore address...\r\n");
   key_addr = flash_key_alloc (kk);
   if (key_addr == NULL)
-    return -1;
+    {
+      gnuk_scratch_free (kdi);
+      return -1;
+    }
 
   kd[kk].pubkey = key_addr + prvkey_len;
 
@@ -1236,10 +1506,10 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
   DEBUG_INFO ("key_addr: ");
   DEBUG_WORD ((uint32_t)key_addr);
 
-  memcpy (kdi.data, key_data, prvkey_len);
-  memset ((uint8_t *)kdi.data + prvkey_len, 0, MAX_PRVKEY_LEN - prvkey_len);
+  memcpy (kdi->data, key_data, prvkey_len);
+  memset ((uint8_t *)kdi->data + prvkey_len, 0, MAX_PRVKEY_LEN - prvkey_len);
 
-  compute_key_data_checksum (&kdi, prvkey_len, CKDC_CALC);
+  compute_key_data_checksum (kdi, prvkey_len, CKDC_CALC);
 
   dek = random_bytes_get (); /* 32-byte random bytes */
   iv = dek + DATA_ENCRYPTION_KEY_SIZE;
@@ -1261,20 +1531,22 @@ gpg_do_write_prvkey (enum kind_of_key kk, const uint8_t *key_data,
 	gpg_do_chks_prvkey (kk0, BY_RESETCODE, NULL, 0, NULL);
       }
 
-  encrypt (dek, iv, (uint8_t *)&kdi, kdi_len (prvkey_len));
+  encrypt (dek, iv, (uint8_t *)kdi, kdi_len (prvkey_len));
 
-  r = flash_key_write (key_addr, (const uint8_t *)kdi.data, prvkey_len,
+  r = flash_key_write (key_addr, (const uint8_t *)kdi->data, prvkey_len,
 		       pubkey, pubkey_len);
   if (r < 0)
     {
+      gnuk_scratch_free (kdi);
       random_bytes_free (dek);
       memset (pd, 0, sizeof (struct prvkey_data));
       return r;
     }
 
   memcpy (pd->iv, iv, INITIAL_VECTOR_SIZE);
-  memcpy (pd->checksum_encrypted, CHECKSUM_ADDR (kdi, prvkey_len),
+  memcpy (pd->checksum_encrypted, CHECKSUM_ADDR (*kdi, prvkey_len),
 	  DATA_ENCRYPTION_KEY_SIZE);
+  gnuk_scratch_free (kdi);
 
   encrypt_dek (ks, pd->dek_encrypted_1);
 
@@ -1593,6 +1865,31 @@ gpg_do_table[] = {
     rw_algorithm_attr },
   { GPG_DO_KDF, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
     rw_kdf },
+  /* Pseudo DO READ/WRITE: statistics, cleared by write */
+#ifdef LATENCY_STATS
+  { GPG_DO_LATENCY, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_latency },
+#endif
+#ifdef EVENT_TRACE
+  { GPG_DO_EVENT_TRACE, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_event_trace },
+#endif
+#ifdef HEAP_STATS
+  { GPG_DO_HEAP_STAT, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_heap_stat },
+#endif
+#ifdef STACK_STATS
+  { GPG_DO_STACK_STAT, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_stack_stat },
+#endif
+#ifdef PROFILER
+  { GPG_DO_PROFILE, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_profile },
+#endif
+#ifdef OP_COUNT
+  { GPG_DO_OPCOUNT, DO_PROC_READWRITE, AC_ALWAYS, AC_ADMIN_AUTHORIZED,
+    rw_opcount },
+#endif
   /* Fixed data */
   { GPG_DO_HIST_BYTES, DO_FIXED, AC_ALWAYS, AC_NEVER, historical_bytes },
   { GPG_DO_EXTCAP, DO_FIXED, AC_ALWAYS, AC_NEVER, extended_capabilities },
@@ -1633,7 +1930,13 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
   pw_err_counter_p[PW_ERR_RC] = NULL;
   pw_err_counter_p[PW_ERR_PW3] = NULL;
   algo_attr_sig_p = algo_attr_dec_p = algo_attr_aut_p = NULL;
+  key_loc_p[0] = key_loc_p[1] = key_loc_p[2] = NULL;
+  key_loc_recorded_p = NULL;
   digital_signature_counter = 0;
+#ifdef ALGO_ENABLE_RSA
+  for (i = 0; i < 3; i++)
+    rsa_blinding_clear (i);
+#endif
 
   /* When the card is terminated no data objects are valid.  */
   if (do_start == NULL)
@@ -1692,6 +1995,16 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
 		algo_attr_aut_p = p - 1;
 		p++;
 		break;
+	      case NR_KEY_LOC_SIG:
+	      case NR_KEY_LOC_DEC:
+	      case NR_KEY_LOC_AUT:
+		key_loc_p[nr - NR_KEY_LOC_SIG] = p - 1;
+		p++;
+		break;
+	      case NR_BOOL_KEY_LOC:
+		key_loc_recorded_p = p - 1;
+		p++;
+		break;
 	      case NR_COUNTER_123:
 		p++;
 		if (second_byte <= PW_ERR_PW3)
@@ -1739,6 +2052,11 @@ gpg_data_scan (const uint8_t *do_start, const uint8_t *do_end)
     }
 
   digital_signature_counter = (dsc_h14 << 10) | dsc_l10;
+
+  /* The value in the counter area is newer, if any.  */
+  i = flash_dsc_init ();
+  if (i >= 0)
+    digital_signature_counter = i;
 }
 
 /*
@@ -1783,6 +2101,21 @@ gpg_data_copy (const uint8_t *p_start)
       p += 2;
     }
 
+  for (i = 0; i < 3; i++)
+    if (key_loc_p[i] != NULL)
+      {
+	flash_enum_write_internal (p, NR_KEY_LOC_SIG + i, key_loc_p[i][1]);
+	key_loc_p[i] = p;
+	p += 2;
+      }
+
+  if (key_loc_recorded_p != NULL)
+    {
+      flash_bool_write_internal (p, NR_BOOL_KEY_LOC);
+      key_loc_recorded_p = p;
+      p += 2;
+    }
+
   for (i = 0; i < 3; i++)
     if ((v = flash_cnt123_get_value (pw_err_counter_p[i])) != 0)
       {
@@ -2053,26 +2386,14 @@ gpg_do_put_data (uint16_t tag, const uint8_t *data, int len)
     GPG_NO_RECORD ();
 }
 
-void
-gpg_do_public_key (uint8_t kk_byte)
+/* Put the template 7F49 of public key of KK at RES_P.  */
+static void
+copy_public_key (enum kind_of_key kk)
 {
-  enum kind_of_key kk = kkb_to_kk (kk_byte);
   int attr = gpg_get_algo_attr (kk);
   int pubkey_len = gpg_get_algo_attr_key_size (kk, GPG_KEY_PUBLIC);
   const uint8_t *pubkey = kd[kk].pubkey;
 
-  DEBUG_INFO ("Public key\r\n");
-  DEBUG_BYTE (kk_byte);
-
-  if (pubkey == NULL)
-    {
-      DEBUG_INFO ("none.\r\n");
-      GPG_NO_RECORD ();
-      return;
-    }
-
-  res_p = res_APDU;
-
   /* TAG */
   *res_p++ = 0x7f; *res_p++ = 0x49;
 
@@ -2121,6 +2442,40 @@ gpg_do_public_key (uint8_t kk_byte)
 	*res_p++ = 0x01; *res_p++ = 0x00; *res_p++ = 0x01;
       }
     }
+}
+
+/* Size of the template 7F49 of public key, by copy_public_key.  */
+static int
+public_key_size (enum kind_of_key kk)
+{
+  int attr = gpg_get_algo_attr (kk);
+  int pubkey_len = gpg_get_algo_attr_key_size (kk, GPG_KEY_PUBLIC);
+
+  if (attr == ALGO_NISTP256R1 || attr == ALGO_SECP256K1)
+    return 3 + 2 + 1 + 64;
+  else if (attr == ALGO_ED25519 || attr == ALGO_CURVE25519)
+    return 3 + 2 + 32;
+  else
+    return 5 + 4 + pubkey_len + 2 + 3;
+}
+
+void
+gpg_do_public_key (uint8_t kk_byte)
+{
+  enum kind_of_key kk = kkb_to_kk (kk_byte);
+
+  DEBUG_INFO ("Public key\r\n");
+  DEBUG_BYTE (kk_byte);
+
+  if (kd[kk].pubkey == NULL)
+    {
+      DEBUG_INFO ("none.\r\n");
+      GPG_NO_RECORD ();
+      return;
+    }
+
+  res_p = res_APDU;
+  copy_public_key (kk);
 
   /* Success */
   res_APDU_size = res_p - res_APDU;
@@ -2130,6 +2485,108 @@ gpg_do_public_key (uint8_t kk_byte)
   return;
 }
 
+/* Upper bound of the size of a DO by copy_do.  */
+#define DO_SIZE_MAX (2 + 2 + 255)
+
+static int
+do_size_max (const struct do_table_entry *do_p)
+{
+  const uint8_t *do_data;
+
+  if (do_p->do_type == DO_FIXED)
+    do_data = (const uint8_t *)do_p->obj;
+  else if (do_p->do_type == DO_VAR)
+    do_data = *(const uint8_t **)do_p->obj;
+  else
+    return DO_SIZE_MAX;
+
+  if (do_data == NULL)
+    return 0;
+
+  return 2 + 2 + do_data[0];
+}
+
+/*
+ * Get DOs at once, to save round trips of card status.  TAGS has
+ * NUM_TAGS tags, two-byte each (big endian).  CRT tag (B6, B8, or A4)
+ * means its public key.
+ *
+ * A TLV is returned for each tag, in the order.  It's empty (length
+ * zero) when the DO is not available.  When the response buffer is
+ * full, it returns the TLVs so far with 6310 (more data available),
+ * and the host asks the rest again.
+ *
+ * Cardholder certificate (7F21) is rejected, as it may be larger than
+ * the response buffer; it's read by GET DATA or READ BINARY.  So are
+ * statistics, read by GET DATA.
+ */
+void
+gpg_do_get_data_bulk (const uint8_t *tags, int num_tags)
+{
+  const uint8_t *res_end = res_APDU + MAX_RES_APDU_DATA_SIZE;
+  int i;
+
+  for (i = 0; i < num_tags; i++)
+    {
+      uint16_t tag = (tags[i*2] << 8) | tags[i*2+1];
+
+      if (tag == GPG_DO_CH_CERTIFICATE
+	  || (tag >= GPG_DO_STAT_FIRST && tag <= GPG_DO_STAT_LAST))
+	{
+	  GPG_FUNCTION_NOT_SUPPORTED ();
+	  return;
+	}
+    }
+
+  res_p = res_APDU;
+
+  for (i = 0; i < num_tags; i++)
+    {
+      uint16_t tag = (tags[i*2] << 8) | tags[i*2+1];
+      uint8_t *p = res_p;
+
+      DEBUG_SHORT (tag);
+
+      if (tag == 0x00b6 || tag == 0x00b8 || tag == 0x00a4)
+	{
+	  enum kind_of_key kk = kkb_to_kk (tag);
+
+	  if (kd[kk].pubkey == NULL)
+	    {
+	      if (res_end - res_p < 3)
+		break;
+	      *res_p++ = 0x7f; *res_p++ = 0x49; *res_p++ = 0x00;
+	    }
+	  else
+	    {
+	      if (res_end - res_p < public_key_size (kk))
+		break;
+	      copy_public_key (kk);
+	    }
+	}
+      else
+	{
+	  const struct do_table_entry *do_p = get_do_entry (tag);
+
+	  if (res_end - res_p < (do_p ? do_size_max (do_p) : 0) + 3)
+	    break;
+
+	  if (do_p == NULL || copy_do (do_p, 1) < 0 || res_p == p)
+	    {
+	      res_p = p;
+	      copy_tag (tag);
+	      *res_p++ = 0x00;
+	    }
+	}
+    }
+
+  res_APDU_size = res_p - res_APDU;
+  if (i < num_tags)
+    GPG_MORE_DATA_AVAILABLE ();
+  else
+    GPG_SUCCESS ();
+}
+
 const uint8_t *
 gpg_do_read_simple (uint8_t nr)
 {
@@ -2179,6 +2636,7 @@ gpg_do_keygen (uint8_t *buf)
 
   DEBUG_INFO ("Keygen\r\n");
   DEBUG_BYTE (kk_byte);
+  TRACE_EVENT (TRACE_CRYPTO_START, attr);
 
   #ifdef ALGO_ENABLE_RSA
   if (attr == ALGO_RSA2K || attr == ALGO_RSA4K)
@@ -2256,6 +2714,7 @@ gpg_do_keygen (uint8_t *buf)
       return;
     }
 
+  TRACE_EVENT (TRACE_CRYPTO_END, r);
   if (r >= 0)
     {
       const uint8_t *keystring_admin;
@@ -57,6 +57,7 @@ static struct eventflag *openpgp_comm;
 #define INS_SELECT_FILE				0xa4
 #define INS_READ_BINARY				0xb0
 #define INS_GET_DATA				0xca
+#define INS_GET_DATA_BULK			0xcb	/* Vendor class */
 #define INS_WRITE_BINARY			0xd0
 #define INS_UPDATE_BINARY			0xd6
 #define INS_PUT_DATA				0xda
@@ -118,6 +119,8 @@ gpg_init (void)
 
   gpg_data_scan (flash_do_start, flash_do_end);
   flash_key_storage_init ();
+  /* In case the previous thread was canceled during an operation.  */
+  gnuk_scratch_reset ();
 }
 
 static void
@@ -872,6 +875,37 @@ cmd_get_data (void)
   gpg_do_get_data (tag, 0);
 }
 
+#define MAX_BULK_TAGS 32
+
+/*
+ * Gnuk specific (CLA=0x80): get DOs in a single round trip.  Command
+ * data is a list of two-byte tags.
+ */
+static void
+cmd_get_data_bulk (void)
+{
+  uint8_t tags[MAX_BULK_TAGS * 2];
+  int len = apdu.cmd_apdu_data_len;
+
+  DEBUG_INFO (" - Get Data Bulk\r\n");
+
+  if ((CLS (apdu) & 0x80) == 0)
+    {
+      GPG_CLA_NOT_SUPPORTED ();
+      return;
+    }
+
+  if (len == 0 || (len & 1) || len > MAX_BULK_TAGS * 2)
+    {
+      GPG_WRONG_LENGTH ();
+      return;
+    }
+
+  /* Copy, as the response overwrites the command data.  */
+  memcpy (tags, apdu.cmd_apdu_data, len);
+  gpg_do_get_data_bulk (tags, len / 2);
+}
+
 #define ECDSA_HASH_LEN 32
 #define ECDSA_SIGNATURE_LENGTH 64
 
@@ -908,6 +942,8 @@ cmd_pso (void)
 	  return;
 	}
 
+      TRACE_EVENT (TRACE_CRYPTO_START, attr);
+
       #ifdef ALGO_ENABLE_RSA
       if (attr == ALGO_RSA2K || attr == ALGO_RSA4K)
 	{
@@ -979,6 +1015,7 @@ cmd_pso (void)
 	  return;
 	}
 
+      TRACE_EVENT (TRACE_CRYPTO_END, r);
       if (r == 0)
 	{
 	  res_APDU_size = result_len;
@@ -1002,6 +1039,7 @@ cmd_pso (void)
 	  return;
 	}
 
+      TRACE_EVENT (TRACE_CRYPTO_START, attr);
       #ifdef ALGO_ENABLE_RSA
       if (attr == ALGO_RSA2K || attr == ALGO_RSA4K)
 	{
@@ -1062,6 +1100,7 @@ cmd_pso (void)
 	  return;
 	}
 
+      TRACE_EVENT (TRACE_CRYPTO_END, r);
       if (r == 0)
 	res_APDU_size = result_len;
     }
@@ -1111,6 +1150,8 @@ cmd_internal_authenticate (void)
       return;
     }
 
+  TRACE_EVENT (TRACE_CRYPTO_START, attr);
+
   #ifdef ALGO_ENABLE_RSA
   if (attr == ALGO_RSA2K || attr == ALGO_RSA4K)
     {
@@ -1178,6 +1219,7 @@ cmd_internal_authenticate (void)
       memcpy (res_APDU, output, EDDSA_SIGNATURE_LENGTH);
     }
 
+  TRACE_EVENT (TRACE_CRYPTO_END, r);
   if (r == 0)
     res_APDU_size = result_len;
   else
@@ -1350,7 +1392,8 @@ cmd_external_authenticate (void)
       return;
     }
 
-  eventflag_signal (openpgp_comm, EV_EXIT); /* signal to self.  */
+  if (openpgp_comm)
+    eventflag_signal (openpgp_comm, EV_EXIT); /* signal to self.  */
   set_res_sw (0xff, 0xff);
   DEBUG_INFO ("EXTERNAL AUTHENTICATE done.\r\n");
 }
@@ -1470,6 +1513,7 @@ const struct command cmds[] = {
   { INS_SELECT_FILE, cmd_select_file },
   { INS_READ_BINARY, cmd_read_binary },     /* Not in OpenPGP card protocol */
   { INS_GET_DATA, cmd_get_data },
+  { INS_GET_DATA_BULK, cmd_get_data_bulk }, /* Not in OpenPGP card protocol */
   { INS_WRITE_BINARY, cmd_write_binary},    /* Not in OpenPGP card protocol */
 #if defined(CERTDO_SUPPORT)
   { INS_UPDATE_BINARY, cmd_update_binary }, /* Not in OpenPGP card protocol */
@@ -1488,6 +1532,13 @@ process_command_apdu (void)
   int i;
   uint8_t cmd = INS (apdu);
 
+#ifdef PROFILER
+  profile_cmd_start (&apdu);
+#endif
+#ifdef OP_COUNT
+  opcount_cmd_start ();
+#endif
+
   for (i = 0; i < NUM_CMDS; i++)
     if (cmds[i].command == cmd)
       break;
@@ -1517,8 +1568,115 @@ process_command_apdu (void)
       DEBUG_BYTE (cmd);
       GPG_NO_INS ();
     }
+
+#ifdef OP_COUNT
+  opcount_cmd_done (&apdu);
+#endif
+#ifdef PROFILER
+  profile_cmd_done ();
+#endif
+}
+
+/*
+ * Algorithm of the key used by the command A, for statistics: 0 when
+ * not applicable, 0x80 | ALGO_xxx for PSO and INTERNAL AUTHENTICATE.
+ */
+uint8_t
+gpg_cmd_algo (const struct apdu *a)
+{
+  uint8_t ins = a->cmd_apdu_head[1];
+  int kk = -1;
+
+  if (ins == INS_PSO)
+    {
+      if (a->cmd_apdu_head[2] == 0x9e && a->cmd_apdu_head[3] == 0x9a)
+	kk = GPG_KEY_FOR_SIGNING;
+      else if (a->cmd_apdu_head[2] == 0x80 && a->cmd_apdu_head[3] == 0x86)
+	kk = GPG_KEY_FOR_DECRYPTION;
+    }
+  else if (ins == INS_INTERNAL_AUTHENTICATE)
+    kk = GPG_KEY_FOR_AUTHENTICATION;
+
+  if (kk < 0)
+    return 0;
+  return 0x80 | gpg_get_algo_attr (kk);
+}
+
+/*
+ * Find the class of the command A in TABLE (of MAX entries, *NUM_P
+ * used), adding it if new, and return its index.  When the table is
+ * full, the last entry is for other commands, with INS and ALG of 0.
+ */
+int
+gpg_cmd_class_get (const struct apdu *a,
+		   struct gpg_cmd_class *table, uint8_t *num_p, int max)
+{
+  uint8_t ins = a->cmd_apdu_head[1];
+  uint8_t alg = gpg_cmd_algo (a);
+  int i;
+
+  for (i = 0; i < *num_p; i++)
+    if (table[i].ins == ins && table[i].alg == alg)
+      return i;
+
+  if (i < max - 1)
+    {
+      table[i].ins = ins;
+      table[i].alg = alg;
+      (*num_p)++;
+      return i;
+    }
+
+  *num_p = max;
+  table[max - 1].ins = 0;
+  table[max - 1].alg = 0;
+  return max - 1;
+}
+
+/*
+ * Entry points to run the card without its thread: the caller sets up
+ * APDU and calls openpgp_card_process, synchronously.
+ */
+void
+openpgp_card_init (void)
+{
+  gpg_init ();
+}
+
+void
+openpgp_card_process (void)
+{
+  process_command_apdu ();
+}
+
+void
+openpgp_card_fini (void)
+{
+  gpg_fini ();
 }
 
+#ifdef WARM_POWER_CYCLE
+/*
+ * Called by the CCID thread at ICC power off, while the card thread is
+ * waiting for a command.  Instead of exit of the card thread (and
+ * scan of the flash by new one at power on), only the security status
+ * and the selection are reset.  Return -1 when the flash has been
+ * changed since the scan; then, the card thread should exit.
+ */
+int
+openpgp_card_warm_reset (void)
+{
+  if (flash_do_storage_changed ())
+    return -1;
+
+  ac_fini ();
+  if (file_selection != FILE_CARD_TERMINATED)
+    file_selection = FILE_NONE;
+  gnuk_scratch_reset ();
+  return 0;
+}
+#endif
+
 void *
 openpgp_card_thread (void *arg)
 {
@@ -1535,6 +1693,7 @@ openpgp_card_thread (void *arg)
 #endif
       eventmask_t m = eventflag_wait (openpgp_comm);
 
+      TRACE_EVENT (TRACE_GPG_WAKEUP, m);
       DEBUG_INFO ("GPG!: ");
 
       if (m == EV_VERIFY_CMD_AVAILABLE)
@@ -1624,6 +1783,10 @@ openpgp_card_thread (void *arg)
       process_command_apdu ();
       led_blink (LED_FINISH_COMMAND);
     done:
+#ifdef STACK_STATS
+      stack_cmd_done (&apdu);
+#endif
+      TRACE_EVENT (TRACE_GPG_DONE, apdu.sw);
       eventflag_signal (ccid_comm, EV_EXEC_FINISHED);
     }
 
@@ -1060,6 +1060,8 @@ cir_init (void)
   /* Generate UEV to upload PSC and ARR */
   TIMx->EGR = TIM_EGR_UG;
 
+  STACK_REGISTER ("tim", STACK_ADDR_TIM, STACK_SIZE_TIM);
   chopstx_create (PRIO_TIM, STACK_ADDR_TIM, STACK_SIZE_TIM, tim_main, NULL);
+  STACK_REGISTER ("ext", STACK_ADDR_EXT, STACK_SIZE_EXT);
   chopstx_create (PRIO_EXT, STACK_ADDR_EXT, STACK_SIZE_EXT, ext_main, NULL);
 }
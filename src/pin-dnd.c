@@ -188,7 +188,6 @@ static const uint8_t d0_fat0_sector[] = {
   0xff, 0x0f, 0x00,	/* cluster 8: used */ /* cluster 9: free */
 };
 
-static uint8_t the_sector[512];
 
 #define FOLDER_INDEX_TO_CLUSTER_NO(i) (i+1)
 #define CLUSTER_NO_TO_FOLDER_INDEX(n) (n-1)
@@ -246,7 +245,7 @@ static void build_directory_sector (uint8_t *p, uint8_t index)
 }
 
 int
-msc_scsi_read (uint32_t lba, const uint8_t **sector_p)
+msc_scsi_read (uint32_t lba, uint8_t *sector)
 {
   if (!media_available)
     return SCSI_ERROR_NOT_READY;
@@ -257,17 +256,15 @@ msc_scsi_read (uint32_t lba, const uint8_t **sector_p)
   switch (lba)
     {
     case 0:
-      *sector_p = the_sector;
-      memcpy (the_sector, d0_0_sector, sizeof d0_0_sector);
-      memset (the_sector + sizeof d0_0_sector, 0, 512 - sizeof d0_0_sector);
-      the_sector[510] = 0x55;
-      the_sector[511] = 0xaa;
+      memcpy (sector, d0_0_sector, sizeof d0_0_sector);
+      memset (sector + sizeof d0_0_sector, 0, 512 - sizeof d0_0_sector);
+      sector[510] = 0x55;
+      sector[511] = 0xaa;
       return 0;
     case 1:
     case 2:
-      *sector_p = the_sector;
-      memcpy (the_sector, d0_fat0_sector, sizeof d0_fat0_sector);
-      memset (the_sector + sizeof d0_fat0_sector, 0,
+      memcpy (sector, d0_fat0_sector, sizeof d0_fat0_sector);
+      memset (sector + sizeof d0_fat0_sector, 0,
 	      512 - sizeof d0_fat0_sector);
       return 0;
     case 3:
@@ -278,12 +275,10 @@ msc_scsi_read (uint32_t lba, const uint8_t **sector_p)
     case 8:
     case 9:
     case 10:
-      *sector_p = the_sector;
-      build_directory_sector (the_sector, LBA_TO_FOLDER_INDEX (lba));
+      build_directory_sector (sector, LBA_TO_FOLDER_INDEX (lba));
       return 0;
     default:
-      *sector_p = the_sector;
-      memset (the_sector, 0, 512);
+      memset (sector, 0, 512);
       return 0;
     }
 }
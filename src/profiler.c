@@ -0,0 +1,283 @@
+/*
+ * profiler.c -- Sampling profiler of GNU/Linux emulation
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * SIGPROF is delivered every PROFILE_INTERVAL_USEC of CPU time of the
+ * process (ITIMER_PROF), to the thread which is running: a Chopstx
+ * thread, or a crypto worker.  The handler takes the backtrace and
+ * counts it in a hash table, together with the class of the command
+ * in execution: INS and algorithm (see gpg_cmd_algo).  Samples
+ * outside of commands have INS 0x00.
+ *
+ * Folded stacks, the input of flamegraph.pl and alike, are written at
+ * exit, and when GET DATA of the tag 0x0118 is requested.  PUT DATA of
+ * it (with no data, admin authorized) clears the table.  A line is:
+ *
+ *   ins_2a-alg_81;main;...;bn256_mul 123
+ *
+ * Functions are symbolized by dladdr; the emulation is linked with
+ * -rdynamic for that.  Static functions are shown as gnuk+0xOFFSET,
+ * which addr2line -f -e build/gnuk can resolve.
+ *
+ * The response of GET DATA is the number of samples and the number of
+ * dropped samples (when the table is full, or it's being written), 4
+ * bytes each, in big endian.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+
+#include "config.h"
+
+#include "gnuk.h"
+
+#define PROFILE_INTERVAL_USEC 1000
+#define PROFILE_STACKS        16384	/* Must be 2^N */
+#define PROFILE_DEPTH         32
+/* Frames of the handler itself and the signal trampoline */
+#define PROFILE_SKIP          2
+
+struct profile_stack {
+  uint32_t count;
+  uint16_t cls;			/* INS << 8 | ALG */
+  uint8_t depth;
+  void *pc[PROFILE_DEPTH];
+};
+
+static struct profile_stack profile_table[PROFILE_STACKS];
+static uint32_t profile_samples;
+static uint32_t profile_dropped;
+static volatile uint16_t profile_cls;
+static char profile_busy;
+static const char *profile_path;
+
+static uint32_t
+profile_hash (uint16_t cls, void **pc, int depth)
+{
+  uint32_t h = 2166136261U ^ cls;
+  int i;
+
+  for (i = 0; i < depth; i++)
+    h = (h ^ (uint32_t)((uintptr_t)pc[i] >> 2)) * 16777619U;
+
+  return h;
+}
+
+static void
+profile_sample (int sig)
+{
+  void *pc[PROFILE_DEPTH + PROFILE_SKIP];
+  int depth;
+  uint16_t cls = profile_cls;
+  uint32_t h;
+  int i;
+
+  (void)sig;
+
+  if (__atomic_test_and_set (&profile_busy, __ATOMIC_ACQUIRE))
+    {
+      __atomic_fetch_add (&profile_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+  depth = backtrace (pc, PROFILE_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;
+  if (depth < 0)
+    depth = 0;
+
+  h = profile_hash (cls, pc + PROFILE_SKIP, depth);
+  for (i = 0; i < PROFILE_STACKS; i++)
+    {
+      struct profile_stack *s;
+
+      s = &profile_table[(h + i) & (PROFILE_STACKS - 1)];
+
+      if (s->count == 0)
+	{
+	  s->cls = cls;
+	  s->depth = depth;
+	  memcpy (s->pc, pc + PROFILE_SKIP, depth * sizeof (void *));
+	}
+      else if (s->cls != cls || s->depth != depth
+	       || memcmp (s->pc, pc + PROFILE_SKIP, depth * sizeof (void *)))
+	continue;
+
+      s->count++;
+      profile_samples++;
+      break;
+    }
+
+  if (i == PROFILE_STACKS)
+    profile_dropped++;
+
+  __atomic_clear (&profile_busy, __ATOMIC_RELEASE);
+}
+
+static void
+profile_symbol (FILE *fp, void *pc)
+{
+  Dl_info info;
+
+  /* PC is the return address; look up the call instruction.  */
+  pc = (char *)pc - 1;
+  if (dladdr (pc, &info) == 0)
+    fprintf (fp, ";%p", pc);
+  else if (info.dli_sname)
+    fprintf (fp, ";%s", info.dli_sname);
+  else
+    {
+      const char *name = info.dli_fname ? info.dli_fname : "?";
+
+      if (strrchr (name, '/'))
+	name = strrchr (name, '/') + 1;
+      fprintf (fp, ";%s+0x%lx", name,
+	       (unsigned long)((char *)pc - (char *)info.dli_fbase));
+    }
+}
+
+static void
+profile_write (void)
+{
+  FILE *fp;
+  int i, j;
+
+  if (profile_path == NULL)
+    return;
+
+  while (__atomic_test_and_set (&profile_busy, __ATOMIC_ACQUIRE))
+    ;
+
+  fp = fopen (profile_path, "w");
+  if (fp)
+    {
+      for (i = 0; i < PROFILE_STACKS; i++)
+	{
+	  struct profile_stack *s = &profile_table[i];
+
+	  if (s->count == 0)
+	    continue;
+
+	  fprintf (fp, "ins_%02x-alg_%02x", s->cls >> 8, s->cls & 0xff);
+	  for (j = s->depth - 1; j >= 0; j--)
+	    profile_symbol (fp, s->pc[j]);
+	  fprintf (fp, " %u\n", s->count);
+	}
+      fclose (fp);
+    }
+
+  __atomic_clear (&profile_busy, __ATOMIC_RELEASE);
+}
+
+static void
+profile_atexit (void)
+{
+  struct itimerval it;
+
+  memset (&it, 0, sizeof it);
+  setitimer (ITIMER_PROF, &it, NULL);
+  profile_write ();
+}
+
+int
+profile_start (const char *path)
+{
+  struct sigaction sa;
+  struct itimerval it;
+  void *dummy[1];
+
+  /* The first call of backtrace loads libgcc, which is not allowed
+     in the signal handler.  */
+  backtrace (dummy, 1);
+
+  profile_path = path;
+
+  memset (&sa, 0, sizeof sa);
+  sa.sa_handler = profile_sample;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset (&sa.sa_mask);
+  if (sigaction (SIGPROF, &sa, NULL) < 0)
+    return -1;
+
+  it.it_interval.tv_sec = 0;
+  it.it_interval.tv_usec = PROFILE_INTERVAL_USEC;
+  it.it_value = it.it_interval;
+  if (setitimer (ITIMER_PROF, &it, NULL) < 0)
+    return -1;
+
+  atexit (profile_atexit);
+  return 0;
+}
+
+void
+profile_cmd_start (const struct apdu *a)
+{
+  profile_cls = (a->cmd_apdu_head[1] << 8) | gpg_cmd_algo (a);
+}
+
+void
+profile_cmd_done (void)
+{
+  profile_cls = 0;
+}
+
+int
+profile_size (void)
+{
+  return 8;
+}
+
+uint8_t *
+profile_copy (uint8_t *p)
+{
+  uint32_t samples = profile_samples;
+  uint32_t dropped = profile_dropped;
+
+  profile_write ();
+
+  *p++ = samples >> 24;
+  *p++ = samples >> 16;
+  *p++ = samples >> 8;
+  *p++ = samples;
+  *p++ = dropped >> 24;
+  *p++ = dropped >> 16;
+  *p++ = dropped >> 8;
+  *p++ = dropped;
+  return p;
+}
+
+void
+profile_clear (void)
+{
+  while (__atomic_test_and_set (&profile_busy, __ATOMIC_ACQUIRE))
+    ;
+
+  memset (profile_table, 0, sizeof profile_table);
+  profile_samples = profile_dropped = 0;
+
+  __atomic_clear (&profile_busy, __ATOMIC_RELEASE);
+}
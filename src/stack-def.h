@@ -2,18 +2,39 @@
 #define SIZE_1 4096
 #define SIZE_2 4096
 #define SIZE_3 (5 * 4096)
+#define SIZE_4 4096
 #else
 #define SIZE_0 0x0150 /* Main         */
 #define SIZE_1 0x01a0 /* CCID         */
 #define SIZE_2 0x0180 /* RNG          */
+/*
+ * Large temporaries of crypto operations are in the scratch memory
+ * (SCRATCH_SIZE of main.c), and SIZE_3 is reduced by that size only.
+ * It should not be reduced more, until the stack marks of
+ * --enable-stack-stats are read on the device.
+ */
+#ifdef ALGO_ENABLE_RSA
 #if MEMORY_SIZE >= 32
-#define SIZE_3 0x4640 /* openpgp-card */
+#define SIZE_3 0x2140 /* openpgp-card */
 #elif MEMORY_SIZE >= 24
-#define SIZE_3 0x2640 /* openpgp-card */
+#define SIZE_3 0x1140 /* openpgp-card */
 #else
-#define SIZE_3 0x1640 /* openpgp-card */
+#define SIZE_3 0x0fc0 /* openpgp-card */
 #endif
+#else
+#if MEMORY_SIZE >= 32
+#define SIZE_3 0x4220 /* openpgp-card */
+#elif MEMORY_SIZE >= 24
+#define SIZE_3 0x2220 /* openpgp-card */
+#else
+#define SIZE_3 0x1220 /* openpgp-card */
+#endif
+#endif
+#ifdef DEBUG
+#define SIZE_4 0x0180 /* debug        */
+#else
 #define SIZE_4 0x0000 /* ---          */
+#endif
 #define SIZE_5 0x0200 /* msc          */
 #define SIZE_6 0x00c0 /* timer (cir)  */
 #define SIZE_7 0x00c0 /* ext   (cir)  */
@@ -63,3 +84,10 @@ char process6_base[SIZE_6] __attribute__ ((section(".process_stack.6")));
 #if defined(STACK_PROCESS_7)
 char process7_base[SIZE_7] __attribute__ ((section(".process_stack.7")));
 #endif
+
+#ifdef STACK_STATS
+void stack_register (const char *name, uintptr_t addr, size_t size);
+#define STACK_REGISTER(name,addr,size) stack_register (name, addr, size)
+#else
+#define STACK_REGISTER(name,addr,size)
+#endif
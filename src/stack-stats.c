@@ -0,0 +1,231 @@
+/*
+ * stack-stats.c -- High-water marks of thread stacks
+ *
+ * Copyright (C) 2026  Free Software Initiative of Japan
+ *
+ * This file is a part of Gnuk, a GnuPG USB Token implementation.
+ *
+ * Gnuk is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Stack of a thread is painted with STACK_PAINT before its creation
+ * (by STACK_REGISTER), and its high-water mark is found by scanning
+ * from the bottom for the first word overwritten.  Usage includes the
+ * thread control block, which Chopstx puts at the top.
+ *
+ * For the OpenPGP thread, the mark is also recorded for each class of
+ * command (INS, and algorithm of the key, same as latency.c).  After
+ * each command, the part used by it is painted again, so that the
+ * next command is measured by itself.
+ *
+ * The marks can be read by GET DATA of the tag 0x0116, and the
+ * records of commands are cleared by PUT DATA of it (with no data,
+ * admin authorized).  Its format is:
+ *
+ *   Number of threads (1 byte), number of classes (1 byte),
+ *   for each thread: NAME (8 bytes), SIZE (2 bytes), USED (2 bytes),
+ *   for each class: INS (1 byte), ALG (1 byte), USED (2 bytes)
+ *
+ * INS of 0x00 is for other commands, when the table is full.
+ *
+ * On emulation, new marks are also printed to stderr.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "gnuk.h"
+#include "stack-def.h"
+
+#ifdef GNU_LINUX_EMULATION
+#include <stdio.h>
+#endif
+
+#define STACK_PAINT 0xa5a5a5a5
+#define STACK_THREADS 8
+#define STACK_CLASSES 12
+#define STACK_NAME_LEN 8
+/* Bytes below the frame of stack_cmd_done, not to be painted.  */
+#define STACK_PAINT_MARGIN 128
+
+struct stack_info {
+  const char *name;
+  uint32_t *bottom;
+  uint32_t *top;
+  uint16_t used;
+};
+
+
+static struct stack_info stack_table[STACK_THREADS];
+static uint8_t stack_num_threads;
+
+static struct gpg_cmd_class stack_class[STACK_CLASSES];
+static uint16_t stack_class_used[STACK_CLASSES];
+static uint8_t stack_num_classes;
+
+void
+stack_register (const char *name, uintptr_t addr, size_t size)
+{
+  uint32_t *bottom = (uint32_t *)((addr + 3) & ~3);
+  struct stack_info *s;
+  uint32_t *p;
+  int i;
+
+  for (i = 0; i < stack_num_threads; i++)
+    if (stack_table[i].bottom == bottom)
+      break;
+
+  if (i == stack_num_threads)
+    {
+      if (i == STACK_THREADS)
+	return;
+      stack_num_threads++;
+    }
+
+  s = &stack_table[i];
+  s->name = name;
+  s->bottom = bottom;
+  s->top = (uint32_t *)((addr + size) & ~3);
+  for (p = s->bottom; p < s->top; p++)
+    *p = STACK_PAINT;
+}
+
+static uint32_t *
+stack_lowest_used (const struct stack_info *s)
+{
+  uint32_t *p = s->bottom;
+
+  while (p < s->top && *p == STACK_PAINT)
+    p++;
+
+  return p;
+}
+
+static void
+stack_mark (struct stack_info *s, uint16_t used)
+{
+  if (used <= s->used)
+    return;
+
+  s->used = used;
+#ifdef GNU_LINUX_EMULATION
+  fprintf (stderr, "stack: %s: %u of %u bytes\n", s->name, used,
+	   (unsigned int)((s->top - s->bottom) * sizeof (uint32_t)));
+#endif
+}
+
+static void
+stack_update (struct stack_info *s)
+{
+  stack_mark (s, (s->top - stack_lowest_used (s)) * sizeof (uint32_t));
+}
+
+/*
+ * Called by the OpenPGP thread, when it finishes the command A.
+ */
+void
+stack_cmd_done (const struct apdu *a)
+{
+  uint32_t here;
+  volatile uint32_t *p;
+  struct stack_info *s = NULL;
+  int c;
+  uint16_t used;
+  int i;
+
+  for (i = 0; i < stack_num_threads; i++)
+    if (stack_table[i].bottom <= &here && &here < stack_table[i].top)
+      s = &stack_table[i];
+
+  if (s == NULL)
+    return;
+
+  /* Measure this thread first, before calls below use its stack.  */
+  used = (s->top - stack_lowest_used (s)) * sizeof (uint32_t);
+  stack_mark (s, used);
+  for (i = 0; i < stack_num_threads; i++)
+    if (&stack_table[i] != s)
+      stack_update (&stack_table[i]);
+
+  c = gpg_cmd_class_get (a, stack_class, &stack_num_classes, STACK_CLASSES);
+  if (used > stack_class_used[c])
+    {
+      stack_class_used[c] = used;
+#ifdef GNU_LINUX_EMULATION
+      fprintf (stderr, "stack: %s: INS %02x ALG %02x: %u bytes\n", s->name,
+	       stack_class[c].ins, stack_class[c].alg, used);
+#endif
+    }
+
+  /*
+   * Paint again, below this frame.  Through volatile pointer, so that
+   * it's not done by memset, which would use the stack being painted.
+   */
+  for (p = stack_lowest_used (s); p < &here - STACK_PAINT_MARGIN / sizeof (uint32_t); p++)
+    *p = STACK_PAINT;
+}
+
+int
+stack_stat_size (void)
+{
+  return 2 + stack_num_threads * (STACK_NAME_LEN + 4) + stack_num_classes * 4;
+}
+
+/* Copy the marks to P, and return the end.  */
+uint8_t *
+stack_stat_copy (uint8_t *p)
+{
+  int i;
+
+  *p++ = stack_num_threads;
+  *p++ = stack_num_classes;
+  for (i = 0; i < stack_num_threads; i++)
+    {
+      struct stack_info *s = &stack_table[i];
+      uint16_t size = (s->top - s->bottom) * sizeof (uint32_t);
+      const char *name = s->name;
+      int j;
+
+      stack_update (s);
+      for (j = 0; j < STACK_NAME_LEN; j++)
+	*p++ = *name ? *name++ : 0;
+      *p++ = size >> 8;
+      *p++ = size & 0xff;
+      *p++ = s->used >> 8;
+      *p++ = s->used & 0xff;
+    }
+
+  for (i = 0; i < stack_num_classes; i++)
+    {
+      *p++ = stack_class[i].ins;
+      *p++ = stack_class[i].alg;
+      *p++ = stack_class_used[i] >> 8;
+      *p++ = stack_class_used[i] & 0xff;
+    }
+
+  return p;
+}
+
+/* Clear the records of commands; marks of threads are kept.  */
+void
+stack_stat_clear (void)
+{
+  memset (stack_class, 0, sizeof stack_class);
+  memset (stack_class_used, 0, sizeof stack_class_used);
+  stack_num_classes = 0;
+}
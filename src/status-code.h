@@ -1,3 +1,4 @@
+#define GPG_MORE_DATA_AVAILABLE()	set_res_sw (0x63, 0x10)
 #define GPG_APPLICATION_TERMINATED()	set_res_sw (0x62, 0x85)
 #define GPG_MEMORY_FAILURE()		set_res_sw (0x65, 0x81)
 #define GPG_WRONG_LENGTH()		set_res_sw (0x67, 0x00)
@@ -10,5 +11,6 @@
 #define GPG_NO_RECORD()			set_res_sw (0x6a, 0x88)
 #define GPG_BAD_P1_P2()			set_res_sw (0x6b, 0x00)
 #define GPG_NO_INS() 			set_res_sw (0x6d, 0x00)
+#define GPG_CLA_NOT_SUPPORTED()		set_res_sw (0x6e, 0x00)
 #define GPG_ERROR()			set_res_sw (0x6f, 0x00)
 #define GPG_SUCCESS()			set_res_sw (0x90, 0x00)
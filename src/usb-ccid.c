@@ -307,6 +307,7 @@ static void notify_tx (struct ep_in *epi)
   struct ccid *c = (struct ccid *)epi->priv;
 
   /* The sequence of Bulk-IN transactions finished */
+  TRACE_EVENT (TRACE_USB_TX_DONE, 0);
   eventflag_signal (&c->ccid_comm, EV_TX_FINISHED);
 }
 
@@ -322,8 +323,9 @@ static void set_sw1sw2 (struct ccid *c, size_t chunk_len)
 {
   if (c->a->expected_res_size >= c->len)
     {
-      c->sw1sw2[0] = 0x90;
-      c->sw1sw2[1] = 0x00;
+      /* Last part, with SW of the command (it may be a warning).  */
+      c->sw1sw2[0] = c->a->sw >> 8;
+      c->sw1sw2[1] = c->a->sw & 0xff;
     }
   else
     {
@@ -427,6 +429,7 @@ static void notify_icc (struct ep_out *epo)
   struct ccid *c = (struct ccid *)epo->priv;
 
   c->err = epo->err;
+  TRACE_EVENT (TRACE_USB_RX_DONE, epo->cnt);
   eventflag_signal (&c->ccid_comm, EV_RX_DATA_READY);
 }
 
@@ -673,6 +676,9 @@ ccid_rx_ready (uint8_t ep_num, uint16_t len)
   int cont;
   size_t orig_len = len;
 
+  if (epo->cnt == 0)
+    TRACE_EVENT (TRACE_USB_RX_START, len);
+
   while (epo->err == 0)
     if (len == 0)
       break;
@@ -842,10 +848,23 @@ ccid_power_on (struct ccid *c)
   uint8_t xor_check = 0;
   int i;
 
+#ifdef WARM_POWER_CYCLE
+  /* The card thread is kept; rescan by new one, if flash is changed.  */
+  if (c->application && flash_do_storage_changed ())
+    {
+      eventflag_signal (&c->openpgp_comm, EV_EXIT);
+      chopstx_join (c->application, NULL);
+      c->application = 0;
+    }
+#endif
+
   if (c->application == 0)
-    c->application = chopstx_create (PRIO_GPG, STACK_ADDR_GPG,
-				     STACK_SIZE_GPG, openpgp_card_thread,
-				     (void *)&c->ccid_comm);
+    {
+      STACK_REGISTER ("openpgp", STACK_ADDR_GPG, STACK_SIZE_GPG);
+      c->application = chopstx_create (PRIO_GPG, STACK_ADDR_GPG,
+				       STACK_SIZE_GPG, openpgp_card_thread,
+				       (void *)&c->ccid_comm);
+    }
 
   p[0] = CCID_DATA_BLOCK_RET;
   p[1] = size_atr;
@@ -940,6 +959,11 @@ static enum ccid_state
 ccid_power_off (struct ccid *c)
 {
   if (c->application)
+#ifdef WARM_POWER_CYCLE
+    /* Keep the card thread, unless it's executing a command.  */
+    if (c->ccid_state == CCID_STATE_EXECUTE
+	|| openpgp_card_warm_reset () < 0)
+#endif
     {
       eventflag_signal (&c->openpgp_comm, EV_EXIT);
       chopstx_join (c->application, NULL);
@@ -1353,6 +1377,13 @@ ccid_handle_data (struct ccid *c)
 		      c->a->res_apdu_data_len = 0;
 		      c->a->res_apdu_data = &ccid_buffer[5];
 
+#ifdef GNU_LINUX_EMULATION
+		      apdu_trace_command (c->a);
+#endif
+#ifdef LATENCY_STATS
+		      latency_cmd_received ();
+#endif
+		      TRACE_EVENT (TRACE_CCID_CMD, c->a->cmd_apdu_head[1]);
 		      eventflag_signal (&c->openpgp_comm, EV_CMD_AVAILABLE);
 		      next_state = CCID_STATE_EXECUTE;
 		    }
@@ -1495,6 +1526,8 @@ ccid_handle_timeout (struct ccid *c)
       break;
     }
 
+  /* Keep the time stamp going over the wrap of its counter.  */
+  timestamp_get ();
   led_blink (LED_ONESHOT);
   return next_state;
 }
@@ -1788,6 +1821,13 @@ ccid_thread (void *arg)
 		break;
 	      }
 
+#ifdef GNU_LINUX_EMULATION
+	    apdu_trace_response (c->a);
+#endif
+#ifdef LATENCY_STATS
+	    latency_cmd_done (c->a);
+#endif
+	    TRACE_EVENT (TRACE_CCID_RES, c->a->res_apdu_data_len);
 	    c->a->cmd_apdu_data_len = 0;
 	    c->sw1sw2[0] = c->a->sw >> 8;
 	    c->sw1sw2[1] = c->a->sw & 0xff;
@@ -1813,6 +1853,9 @@ ccid_thread (void *arg)
 	  }
       else if (m == EV_TX_FINISHED)
 	{
+#ifdef LATENCY_STATS
+	  latency_res_sent ();
+#endif
 	  if (c->state == APDU_STATE_RESULT)
 	    {
 	      c->state = APDU_STATE_WAIT_COMMAND;
@@ -1,7 +1,7 @@
 /*
  * usb-msc.c -- USB Mass Storage Class protocol handling
  *
- * Copyright (C) 2011, 2012, 2013, 2015
+ * Copyright (C) 2011, 2012, 2013, 2015, 2026
  *               Free Software Initiative of Japan
  * Author: NIIBE Yutaka <gniibe@fsij.org>
  *
@@ -47,6 +47,7 @@ static chopstx_cond_t a_msc_cond;
 #define RDY_OK    0
 #define RDY_RESET 1
 static uint8_t msg;
+static uint8_t xfer_done;
 
 chopstx_mutex_t *pinpad_mutex = &a_pinpad_mutex;
 chopstx_cond_t *pinpad_cond = &a_pinpad_cond;
@@ -82,6 +83,7 @@ static void usb_start_transmit (const uint8_t *p, size_t n)
   ep6_in.txbuf = p;
   ep6_in.txsize = n;
   ep6_in.txcnt = 0;
+  xfer_done = 0;
 
   usb_lld_write (ENDP6, (uint8_t *)ep6_in.txbuf, pkt_len);
 }
@@ -113,6 +115,7 @@ EP6_IN_Callback (uint16_t len)
       case MSC_SENDING_CSW:
       case MSC_DATA_IN:
 	msg = RDY_OK;
+	xfer_done = 1;
 	chopstx_cond_signal (msc_cond);
 	break;
       default:
@@ -128,6 +131,7 @@ static void usb_start_receive (uint8_t *p, size_t n)
   ep6_out.rxbuf = p;
   ep6_out.rxsize = n;
   ep6_out.rxcnt = 0;
+  xfer_done = 0;
   usb_lld_rx_enable (ENDP6);
 }
 
@@ -161,6 +165,7 @@ EP6_OUT_Callback (uint16_t len)
       case MSC_IDLE:
       case MSC_DATA_OUT:
 	msg = err ? RDY_RESET : RDY_OK;
+	xfer_done = 1;
 	chopstx_cond_signal (msc_cond);
 	break;
       default:
@@ -221,7 +226,11 @@ static void set_scsi_sense_data(uint8_t sense_key, uint8_t asc)
 }
 
 
-static uint8_t buf[512];
+/*
+ * Two sectors, for double buffering of READ(10) and WRITE(10): a
+ * sector is prepared (or parsed) while the other is on the bus.
+ */
+static uint8_t buf[512*2];
 
 static uint8_t contingent_allegiance;
 static uint8_t keep_contingent_allegiance;
@@ -263,12 +272,10 @@ static struct CSW CSW;
 
 
 /* called with holding the lock.  */
-static int msc_recv_data (void)
+static void msc_wait_xfer (void)
 {
-  msc_state = MSC_DATA_OUT;
-  usb_start_receive (buf, 512);
-  chopstx_cond_wait (msc_cond, msc_mutex);
-  return 0;
+  while (!xfer_done)
+    chopstx_cond_wait (msc_cond, msc_mutex);
 }
 
 /* called with holding the lock.  */
@@ -276,10 +283,20 @@ static void msc_send_data (const uint8_t *p, size_t n)
 {
   msc_state = MSC_DATA_IN;
   usb_start_transmit (p, n);
-  chopstx_cond_wait (msc_cond, msc_mutex);
+  msc_wait_xfer ();
   CSW.dCSWDataResidue -= (uint32_t)n;
 }
 
+static void msc_set_error (int r)
+{
+  CSW.bCSWStatus = MSC_CSW_STATUS_FAILED;
+  contingent_allegiance = 1;
+  if (r == SCSI_ERROR_NOT_READY)
+    set_scsi_sense_data (SCSI_ERROR_NOT_READY, 0x3a);
+  else
+    set_scsi_sense_data (r, 0x00);
+}
+
 /* called with holding the lock.  */
 static void msc_send_result (const uint8_t *p, size_t n)
 {
@@ -297,7 +314,7 @@ static void msc_send_result (const uint8_t *p, size_t n)
 
   msc_state = MSC_SENDING_CSW;
   usb_start_transmit ((uint8_t *)&CSW, sizeof CSW);
-  chopstx_cond_wait (msc_cond, msc_mutex);
+  msc_wait_xfer ();
 }
 
 
@@ -307,12 +324,14 @@ msc_handle_command (void)
   size_t n;
   uint32_t nblocks, secsize;
   uint32_t lba;
+  uint16_t nsect;
+  uint8_t *p;
   int r;
 
   chopstx_mutex_lock (msc_mutex);
   msc_state = MSC_IDLE;
   usb_start_receive ((uint8_t *)&CBW, sizeof CBW);
-  chopstx_cond_wait (msc_cond, msc_mutex);
+  msc_wait_xfer ();
 
   if (msg != RDY_OK)
     {
@@ -449,6 +468,8 @@ msc_handle_command (void)
 
   lba = (CBW.CBWCB[2] << 24) | (CBW.CBWCB[3] << 16)
       | (CBW.CBWCB[4] <<  8) | CBW.CBWCB[5];
+  nsect = (CBW.CBWCB[7] << 8) | CBW.CBWCB[8];
+  p = buf;
 
   /* Transfer direction.*/
   if (CBW.bmCBWFlags & 0x80)
@@ -457,40 +478,41 @@ msc_handle_command (void)
       msc_state = MSC_DATA_IN;
       if (CBW.CBWCB[0] == SCSI_READ10)
 	{
-	  const uint8_t *p;
-
 	  CSW.dCSWDataResidue = 0;
-	  while (1)
-	    {
-	      if (CBW.CBWCB[7] == 0 && CBW.CBWCB[8] == 0)
-		{
-		  CSW.bCSWStatus = MSC_CSW_STATUS_PASSED;
-		  break;
-		}
-
-	      if ((r = msc_scsi_read (lba, &p)) == 0)
-		{
-		  msc_send_data (p, 512);
-		  if (++CBW.CBWCB[5] == 0)
-		    if (++CBW.CBWCB[4] == 0)
-		      if (++CBW.CBWCB[3] == 0)
-			++CBW.CBWCB[2];
-		  if (CBW.CBWCB[8]-- == 0)
-		    CBW.CBWCB[7]--;
-		  CSW.dCSWDataResidue += 512;
-		  lba++;
-		}
-	      else
-		{
-		  CSW.bCSWStatus = MSC_CSW_STATUS_FAILED;
-		  contingent_allegiance = 1;
-		  if (r == SCSI_ERROR_NOT_READY)
-		    set_scsi_sense_data (SCSI_ERROR_NOT_READY, 0x3a);
-		  else
-		    set_scsi_sense_data (r, 0x00);
-		  break;
-		}
-	    }
+	  if (nsect == 0)
+	    CSW.bCSWStatus = MSC_CSW_STATUS_PASSED;
+	  else if ((r = msc_scsi_read (lba, p)) != 0)
+	    msc_set_error (r);
+	  else
+	    while (1)
+	      {
+		usb_start_transmit (p, 512);
+		lba++;
+		nsect--;
+
+		/* Prepare next sector, while sending this one.  */
+		p = (p == buf) ? buf + 512 : buf;
+		r = 0;
+		if (nsect)
+		  {
+		    chopstx_mutex_unlock (msc_mutex);
+		    r = msc_scsi_read (lba, p);
+		    chopstx_mutex_lock (msc_mutex);
+		  }
+
+		msc_wait_xfer ();
+
+		if (r)
+		  {
+		    msc_set_error (r);
+		    break;
+		  }
+		else if (nsect == 0)
+		  {
+		    CSW.bCSWStatus = MSC_CSW_STATUS_PASSED;
+		    break;
+		  }
+	      }
 
 	  msc_send_result (NULL, 0);
 	}
@@ -502,40 +524,47 @@ msc_handle_command (void)
 	{
 	  CSW.dCSWDataResidue = CBW.dCBWDataTransferLength;
 
-	  while (1)
+	  if (nsect == 0)
+	    CSW.bCSWStatus = MSC_CSW_STATUS_PASSED;
+	  else
 	    {
-	      if (CBW.CBWCB[8] == 0 && CBW.CBWCB[7] == 0)
-		{
-		  CSW.bCSWStatus = MSC_CSW_STATUS_PASSED;
-		  break;
-		}
+	      msc_state = MSC_DATA_OUT;
+	      usb_start_receive (p, 512);
+	    }
 
-	      msc_recv_data ();
-	      if (msg != RDY_OK)
-		/* ignore erroneous packet, ang go next.  */
-		continue;
+	  while (nsect)
+	    {
+	      uint8_t *p_next = (p == buf) ? buf + 512 : buf;
 
-	      if ((r = msc_scsi_write (lba, buf, 512)) == 0)
+	      msc_wait_xfer ();
+	      if (msg != RDY_OK)
 		{
-		  if (++CBW.CBWCB[5] == 0)
-		    if (++CBW.CBWCB[4] == 0)
-		      if (++CBW.CBWCB[3] == 0)
-			++CBW.CBWCB[2];
-		  if (CBW.CBWCB[8]-- == 0)
-		    CBW.CBWCB[7]--;
-		  CSW.dCSWDataResidue -= 512;
-		  lba++;
+		  /* ignore erroneous packet, ang go next.  */
+		  usb_start_receive (p, 512);
+		  continue;
 		}
-	      else
+
+	      /* Receive next sector, while handling this one.  */
+	      if (--nsect)
+		usb_start_receive (p_next, 512);
+
+	      chopstx_mutex_unlock (msc_mutex);
+	      r = msc_scsi_write (lba, p, 512);
+	      chopstx_mutex_lock (msc_mutex);
+
+	      if (r)
 		{
-		  CSW.bCSWStatus = MSC_CSW_STATUS_FAILED;
-		  contingent_allegiance = 1;
-		  if (r == SCSI_ERROR_NOT_READY)
-		    set_scsi_sense_data (SCSI_ERROR_NOT_READY, 0x3a);
-		  else
-		    set_scsi_sense_data (r, 0x00);
+		  msc_set_error (r);
+		  if (nsect)
+		    msc_wait_xfer ();
 		  break;
 		}
+
+	      CSW.dCSWDataResidue -= 512;
+	      lba++;
+	      p = p_next;
+	      if (nsect == 0)
+		CSW.bCSWStatus = MSC_CSW_STATUS_PASSED;
 	    }
 
 	  msc_send_result (NULL, 0);
@@ -570,5 +599,6 @@ msc_main (void *arg)
 void
 msc_init (void)
 {
+  STACK_REGISTER ("msc", STACK_ADDR_MSC, STACK_SIZE_MSC);
   chopstx_create (PRIO_MSC, STACK_ADDR_MSC, STACK_SIZE_MSC, msc_main, NULL);
 }
@@ -1,10 +1,24 @@
-import pytest
+import os, pytest
 from card_reader import get_ccid_device
+from core_reader import CoreReader
 from openpgp_card import OpenPGP_Card
 
+# Performance suite runs against emulation, only when specified.
+collect_ignore = ["perf"]
+
+DEFAULT_CORE = os.path.join(os.path.dirname(__file__),
+                            "..", "core", "libgnuk-core.so")
+
 def pytest_addoption(parser):
     parser.addoption("--reader", dest="reader", type=str, action="store",
                      default="gnuk", help="specify reader: gnuk or gemalto")
+    parser.addoption("--core", dest="core", type=str, action="store",
+                     default=DEFAULT_CORE,
+                     help="libgnuk-core.so, card engine of emulation")
+    parser.addoption("--legacy-core", dest="legacy_core", type=str,
+                     action="store", default=None,
+                     help="libgnuk-core.so of an older version, to make "
+                     "a flash image to start with")
 
 @pytest.fixture(scope="session")
 def card():
@@ -16,3 +30,24 @@ def card():
     card.cmd_select_openpgp()
     yield card
     del card
+
+@pytest.fixture(scope="module")
+def core_image():
+    """Flash image to start with; a test module may override it."""
+    return None
+
+@pytest.fixture(scope="module")
+def core_reader(request, core_image):
+    lib = request.config.getoption("core")
+    if not os.path.exists(lib):
+        pytest.skip("No libgnuk-core: %s" % lib)
+    reader = CoreReader(lib, core_image)
+    yield reader
+    reader.power_off()
+
+@pytest.fixture(scope="module")
+def core_card(core_reader):
+    card = OpenPGP_Card(core_reader)
+    card.cmd_select_openpgp()
+    yield card
+    del card
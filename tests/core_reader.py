@@ -0,0 +1,142 @@
+"""
+core_reader.py - a reader for the card engine of the emulation
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# libgnuk-core (built in ../core) is the card engine of the GNU/Linux
+# emulation, on a flash image in memory.  CoreReader offers it with
+# the same interface as CardReader, so that OpenPGP_Card works on it.
+# Power off and on again is done by gnuk_core_fini and gnuk_core_init,
+# which scan the flash image again as the emulation does at its start.
+
+import sys, os, ctypes
+
+FLASH_IMAGE_SIZE = 8192
+FLASH_PAGE_SIZE = 1024
+RES_APDU_MAX = 5+9+512+2
+
+def empty_image():
+    """Same as the output of gnuk-emulation-setup."""
+    return b"\xff" * 4096 + b"\x00\x00" + b"\xff" * 4094
+
+PROGRAM_HALFWORD = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p,
+                                    ctypes.c_void_p, ctypes.c_uint16)
+ERASE_PAGE = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p)
+RNG = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p,
+                       ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t)
+
+class gnuk_core_flash(ctypes.Structure):
+    _fields_ = [ ('image', ctypes.c_void_p),
+                 ('arg', ctypes.c_void_p),
+                 ('program_halfword', PROGRAM_HALFWORD),
+                 ('erase_page', ERASE_PAGE) ]
+
+class CoreReader(object):
+    def __init__(self, lib, image=None):
+        """
+        __init__(lib, image) -> None
+        Load libgnuk-core LIB, and power on with IMAGE (bytes of a
+        flash image, or None for an empty one).
+        """
+        self.__lib = ctypes.CDLL(lib)
+        size_p = ctypes.POINTER(ctypes.c_size_t)
+        self.__lib.gnuk_core_apdu.argtypes = [ ctypes.c_char_p,
+                                               ctypes.c_size_t,
+                                               ctypes.c_char_p, size_p ]
+        self.__image = ctypes.create_string_buffer(image or empty_image(),
+                                                   FLASH_IMAGE_SIZE)
+        self.__base = ctypes.addressof(self.__image)
+        # Keep references to callbacks, so that they are not collected.
+        self.__cb_program = PROGRAM_HALFWORD(self.program_halfword)
+        self.__cb_erase = ERASE_PAGE(self.erase_page)
+        self.__cb_rng = RNG(self.rng)
+        self.__flash = gnuk_core_flash(self.__base, None,
+                                       self.__cb_program, self.__cb_erase)
+        self.__response = b""
+        self.__powered = False
+        self.power_on()
+
+    def program_halfword(self, arg, addr, data):
+        offset = addr - self.__base
+        if not 0 <= offset < FLASH_IMAGE_SIZE or offset & 1:
+            return 1
+        # As NOR flash, a bit can be changed from one to zero only.
+        old = int.from_bytes(self.__image.raw[offset:offset+2], sys.byteorder)
+        if old & data != data:
+            return 1
+        # Native byte order, as the emulation does
+        ctypes.memmove(addr, data.to_bytes(2, sys.byteorder), 2)
+        return 0
+
+    def erase_page(self, arg, addr):
+        offset = addr - self.__base
+        if not 0 <= offset < FLASH_IMAGE_SIZE or offset % FLASH_PAGE_SIZE:
+            return 1
+        ctypes.memset(addr, 0xff, FLASH_PAGE_SIZE)
+        return 0
+
+    def rng(self, arg, buf, len):
+        ctypes.memmove(buf, os.urandom(len), len)
+        return 0
+
+    def power_on(self):
+        if self.__lib.gnuk_core_init(ctypes.byref(self.__flash),
+                                     self.__cb_rng, None, None) != 0:
+            raise ValueError("gnuk_core_init failed")
+        self.__powered = True
+
+    def power_off(self):
+        if self.__powered:
+            self.__lib.gnuk_core_fini()
+            self.__powered = False
+        self.__response = b""
+
+    def reinit(self):
+        """Power off and on again, with the flash image as it is."""
+        self.power_off()
+        self.power_on()
+
+    def get_image(self):
+        return self.__image.raw
+
+    def is_tpdu_reader(self):
+        return False
+
+    def send_cmd(self, cmd):
+        # Response data is returned by GET RESPONSE, as a TPDU reader
+        # does; OpenPGP_Card expects so.
+        if cmd[1] == 0xc0 and len(cmd) == 5:
+            le = cmd[4] or 256
+            r, self.__response = self.__response[:le], self.__response[le:]
+            if self.__response:
+                return r + self.sw_more_data()
+            return r + b"\x90\x00"
+        res = ctypes.create_string_buffer(RES_APDU_MAX)
+        res_len = ctypes.c_size_t(0)
+        if self.__lib.gnuk_core_apdu(bytes(cmd), len(cmd), res,
+                                     ctypes.byref(res_len)) != 0:
+            raise ValueError("gnuk_core_apdu failed")
+        r = res.raw[:res_len.value]
+        if len(r) > 2 and r[-2:] == b"\x90\x00":
+            self.__response = r[:-2]
+            return self.sw_more_data()
+        return r
+
+    def sw_more_data(self):
+        return bytes([0x61, min(len(self.__response), 256) & 0xff])
@@ -45,6 +45,27 @@ def iso7816_compose(ins, p1, p2, data, cls=0x00, le=None):
                 return pack('>BBBBBH', cls, ins, p1, p2, 0, data_len) \
                     + data + pack('>H', le)
 
+def parse_tlv_list(data):
+    values = []
+    i = 0
+    while i < len(data):
+        if data[i] & 0x1f == 0x1f:
+            i += 2
+        else:
+            i += 1
+        if data[i] == 0x81:
+            l = data[i+1]
+            i += 2
+        elif data[i] == 0x82:
+            l = (data[i+1] << 8) | data[i+2]
+            i += 3
+        else:
+            l = data[i]
+            i += 1
+        values.append(data[i:i+l])
+        i += l
+    return values
+
 class OpenPGP_Card(object):
     def __init__(self, reader):
         """
@@ -150,6 +171,37 @@ class OpenPGP_Card(object):
         else:
             raise ValueError("%02x%02x" % (sw[0], sw[1]))
 
+    def cmd_get_data_bulk(self, tags):
+        """
+        cmd_get_data_bulk(tags) -> list of values
+        Get DOs by Gnuk's vendor command, in a single round trip when
+        the response fits.  Value is empty when the DO is not available.
+        Tag B6, B8, or A4 means its public key (7F49).
+        """
+        values = []
+        while len(values) < len(tags):
+            data = b"".join([pack('>H', t) for t in tags[len(values):]])
+            cmd_data = iso7816_compose(0xcb, 0x00, 0x00, data, cls=0x80) \
+                       + b"\x00"
+            r = self.__reader.send_cmd(cmd_data)
+            if len(r) < 2:
+                raise ValueError(r)
+            res = r[0:-2]
+            sw = r[-2:]
+            while sw[0] == 0x61:
+                cmd_data = iso7816_compose(0xc0, 0x00, 0x00, b'') \
+                           + pack('>B', sw[1])
+                r = self.__reader.send_cmd(cmd_data)
+                res += r[0:-2]
+                sw = r[-2:]
+            if not ((sw[0] == 0x90 and sw[1] == 0x00)
+                    or (sw[0] == 0x63 and sw[1] == 0x10)):
+                raise ValueError("%02x%02x" % (sw[0], sw[1]))
+            values += parse_tlv_list(res)
+            if sw[0] == 0x90:
+                break
+        return values
+
     def cmd_change_reference_data(self, who, data):
         cmd_data = iso7816_compose(0x24, 0x00, 0x80+who, data)
         sw = self.__reader.send_cmd(cmd_data)
@@ -0,0 +1,65 @@
+import os, pytest
+from perf_util import ALGORITHMS, personalized_token, perf_recorder
+
+DEFAULT_GNUK = os.path.join(os.path.dirname(__file__),
+                            "..", "..", "src", "build", "gnuk")
+
+def pytest_addoption(parser):
+    group = parser.getgroup("gnuk-perf", "Gnuk performance suite")
+    group.addoption("--gnuk", dest="gnuk", default=DEFAULT_GNUK,
+                    help="emulation binary (built with --target=GNU_LINUX)")
+    group.addoption("--attach", dest="attach",
+                    default="sudo usbip attach -r 127.0.0.1 -b 1-1",
+                    help="command to attach the emulated token")
+    group.addoption("--detach", dest="detach",
+                    default="sudo usbip detach -p 0",
+                    help="command to detach the emulated token")
+    group.addoption("--algorithms", dest="algorithms",
+                    default=",".join(sorted(ALGORITHMS)),
+                    help="comma separated list of algorithms")
+    group.addoption("--iterations", dest="iterations", type=int, default=50,
+                    help="iterations of each operation")
+    group.addoption("--keygen-iterations", dest="keygen_iterations",
+                    type=int, default=3,
+                    help="iterations of key generation")
+    group.addoption("--baseline", dest="baseline", default=None,
+                    help="results of a previous run, to compare")
+    group.addoption("--threshold", dest="threshold", type=float,
+                    default=10.0,
+                    help="percent of p50/p90 regression to fail")
+    group.addoption("--results", dest="results",
+                    default="perf-results.json",
+                    help="file to write results")
+
+def pytest_generate_tests(metafunc):
+    if 'algo' in metafunc.fixturenames:
+        names = metafunc.config.getoption("algorithms").split(",")
+        metafunc.parametrize("algo", [ ALGORITHMS[n] for n in names ],
+                             ids=names, scope="module")
+
+@pytest.fixture(scope="session")
+def perf(request):
+    config = request.config
+    p = perf_recorder(config.getoption("iterations"),
+                      config.getoption("baseline"),
+                      config.getoption("threshold"),
+                      config.getoption("results"))
+    yield p
+    p.write()
+    print()
+    print(p.report())
+
+@pytest.fixture(scope="module")
+def token(request, algo):
+    config = request.config
+    gnuk = config.getoption("gnuk")
+    if not os.access(gnuk, os.X_OK):
+        pytest.skip("No emulation binary: %s" % gnuk)
+    t = personalized_token(algo, gnuk, config.getoption("attach"),
+                           config.getoption("detach"))
+    t.start()
+    try:
+        t.personalize()
+        yield t
+    finally:
+        t.stop()
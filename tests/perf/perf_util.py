@@ -0,0 +1,340 @@
+"""
+perf_util.py - emulated token and measurement for performance suite
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+import os, time, json, subprocess, shlex, tempfile
+from struct import pack
+from hashlib import sha256
+from random import SystemRandom
+
+from card_reader import get_ccid_device
+
+FACTORY_PASSPHRASE_PW1 = b"123456"
+FACTORY_PASSPHRASE_PW3 = b"12345678"
+
+# Algorithm attributes for SIG, DEC, AUT keys
+RSA2K_ATTR = b"\x01\x08\x00\x00\x20\x00"
+RSA4K_ATTR = b"\x01\x10\x00\x00\x20\x00"
+OID_NISTP256 = b"\x2a\x86\x48\xce\x3d\x03\x01\x07"
+OID_SECP256K1 = b"\x2b\x81\x04\x00\x0a"
+OID_ED25519 = b"\x2b\x06\x01\x04\x01\xda\x47\x0f\x01"
+OID_CV25519 = b"\x2b\x06\x01\x04\x01\x97\x55\x01\x05\x01"
+
+class profile(object):
+    def __init__(self, name, kind, sig, dec, aut, size=32):
+        self.name = name
+        self.kind = kind                # 'rsa', 'ecc' or '25519'
+        self.attr = [ sig, dec, aut ]
+        self.size = size                # bytes of modulus or scalar
+
+ALGORITHMS = {
+    'rsa2048': profile('rsa2048', 'rsa', RSA2K_ATTR, RSA2K_ATTR, RSA2K_ATTR,
+                       256),
+    'rsa4096': profile('rsa4096', 'rsa', RSA4K_ATTR, RSA4K_ATTR, RSA4K_ATTR,
+                       512),
+    'p256': profile('p256', 'ecc', b"\x13" + OID_NISTP256,
+                    b"\x12" + OID_NISTP256, b"\x13" + OID_NISTP256),
+    'secp256k1': profile('secp256k1', 'ecc', b"\x13" + OID_SECP256K1,
+                         b"\x12" + OID_SECP256K1, b"\x13" + OID_SECP256K1),
+    # Ed25519 for SIG and AUT, X25519 for DEC
+    'ed25519': profile('ed25519', '25519', b"\x16" + OID_ED25519,
+                       b"\x12" + OID_CV25519, b"\x16" + OID_ED25519),
+}
+
+KEY_SPEC = [ b"\xb6\x00", b"\xb8\x00", b"\xa4\x00" ]
+
+def tlv_len(l):
+    if l < 128:
+        return pack('>B', l)
+    elif l < 256:
+        return b"\x81" + pack('>B', l)
+    else:
+        return b"\x82" + pack('>H', l)
+
+def find_tlv(data, tag):
+    """Find TAG (one byte) in the content of public key DO (7F49)."""
+    i = 3 if data[2] < 0x80 else 2 + (data[2] & 0x7f) + 1
+    while i < len(data):
+        t = data[i]
+        if data[i+1] < 0x80:
+            l, i = data[i+1], i + 2
+        elif data[i+1] == 0x81:
+            l, i = data[i+2], i + 3
+        else:
+            l, i = (data[i+2] << 8) | data[i+3], i + 4
+        if t == tag:
+            return data[i:i+l]
+        i += l
+    return None
+
+def transmit(reader, cla, ins, p1, p2, data=b"", le=True):
+    """Send a command with command chaining, receive response with
+    GET RESPONSE.  Return (response data, SW)."""
+    while True:
+        chunk, data = data[:255], data[255:]
+        c = pack('>BBBB', cla | (0x10 if data else 0), ins, p1, p2)
+        if chunk:
+            c += pack('>B', len(chunk)) + chunk
+        if not data and le:
+            c += b"\x00"
+        r = reader.send_cmd(c)
+        if not data:
+            break
+        if r[-2:] != b"\x90\x00":
+            return b"", (r[-2] << 8) | r[-1]
+    res = bytes(r[:-2])
+    while r[-2] == 0x61:
+        r = reader.send_cmd(pack('>BBBBB', 0x00, 0xc0, 0x00, 0x00, r[-1]))
+        res += bytes(r[:-2])
+    return res, (r[-2] << 8) | r[-1]
+
+def check_sw(sw, what):
+    if sw != 0x9000:
+        raise ValueError("%s: SW %04x" % (what, sw))
+
+def is_probable_prime(n, rnd):
+    if n % 2 == 0:
+        return n == 2
+    d, s = n - 1, 0
+    while d % 2 == 0:
+        d, s = d // 2, s + 1
+    for i in range(40):
+        x = pow(rnd.randrange(2, n - 1), d, n)
+        if x in (1, n - 1):
+            continue
+        for j in range(s - 1):
+            x = pow(x, 2, n)
+            if x == n - 1:
+                break
+        else:
+            return False
+    return True
+
+def gen_rsa_key(bits):
+    """Generate RSA key for key import, return (n, e, p, q)."""
+    rnd = SystemRandom()
+    e = 65537
+    def gen_prime():
+        while True:
+            p = rnd.getrandbits(bits // 2) | (3 << (bits // 2 - 2)) | 1
+            if p % e != 1 and is_probable_prime(p, rnd):
+                return p
+    p, q = gen_prime(), gen_prime()
+    return (p * q, e, p, q)
+
+class emulated_token(object):
+    """Emulated token from a scratch flash image, attached by usbip."""
+    def __init__(self, gnuk, attach, detach, timeout=20):
+        self.gnuk = gnuk
+        self.attach = attach
+        self.detach = detach
+        self.timeout = timeout
+        self.dir = tempfile.mkdtemp(prefix="gnuk-perf-")
+        self.image = os.path.join(self.dir, "flash-image")
+        self.proc = None
+        self.reader = None
+
+    def start(self):
+        self.proc = subprocess.Popen([self.gnuk, self.image],
+                                     stdout=subprocess.DEVNULL,
+                                     stderr=subprocess.DEVNULL)
+        deadline = time.time() + self.timeout
+        while True:
+            time.sleep(0.5)
+            if self.proc.poll() is not None:
+                raise RuntimeError("%s exited" % self.gnuk)
+            if subprocess.call(shlex.split(self.attach)) == 0:
+                break
+            if time.time() > deadline:
+                raise RuntimeError("Can't attach emulated token")
+        while True:
+            try:
+                self.reader = get_ccid_device()
+                return self.reader
+            except Exception:
+                if time.time() > deadline:
+                    raise
+                time.sleep(0.5)
+
+    def stop(self):
+        self.reader = None
+        if self.detach:
+            subprocess.call(shlex.split(self.detach))
+        if self.proc:
+            self.proc.terminate()
+            self.proc.wait()
+            self.proc = None
+        if os.path.exists(self.image):
+            os.remove(self.image)
+        os.rmdir(self.dir)
+
+    def cmd(self, ins, p1, p2, data=b"", le=True, what=None):
+        res, sw = transmit(self.reader, 0x00, ins, p1, p2, data, le)
+        check_sw(sw, what or "INS %02x" % ins)
+        return res
+
+class personalized_token(emulated_token):
+    """Emulated token with keys of an algorithm profile."""
+    def __init__(self, prof, gnuk, attach, detach):
+        emulated_token.__init__(self, gnuk, attach, detach)
+        self.prof = prof
+        self.pubkey = [ None, None, None ]
+        self.rsa_key = None
+
+    def personalize(self):
+        self.cmd(0xa4, 0x04, 0x00, b"\xd2\x76\x00\x01\x24\x01", le=False)
+        self.verify_pw3()
+        for i in range(3):
+            self.cmd(0xda, 0x00, 0xc1 + i, self.prof.attr[i], le=False,
+                     what="algorithm attributes")
+        for i in range(3):
+            self.generate(i)
+
+    def verify_pw1(self, who=1):
+        self.cmd(0x20, 0x00, 0x80 + who, FACTORY_PASSPHRASE_PW1, le=False)
+
+    def verify_pw3(self):
+        self.cmd(0x20, 0x00, 0x83, FACTORY_PASSPHRASE_PW3, le=False)
+
+    def generate(self, keyno):
+        pk = self.cmd(0x47, 0x80, 0x00, KEY_SPEC[keyno], what="GENERATE")
+        self.pubkey[keyno] = pk
+        return pk
+
+    def import_key(self, keyno):
+        if self.prof.kind == 'rsa':
+            if self.rsa_key is None:
+                self.rsa_key = gen_rsa_key(self.prof.size * 8)
+            n, e, p, q = self.rsa_key
+            plen = self.prof.size // 2
+            e_bytes = pack('>I', e)
+            template = b"\x91\x04\x92" + tlv_len(plen) + b"\x93" \
+                + tlv_len(plen)
+            data = e_bytes + p.to_bytes(plen, 'big') + q.to_bytes(plen, 'big')
+        else:
+            d = SystemRandom().getrandbits(252).to_bytes(32, 'big')
+            template = b"\x92\x20"
+            data = d
+        exthdr = KEY_SPEC[keyno] + b"\x7f\x48" + tlv_len(len(template)) \
+            + template + b"\x5f\x48" + tlv_len(len(data))
+        body = b"\x4d" + tlv_len(len(exthdr) + len(data)) + exthdr + data
+        self.cmd(0xdb, 0x3f, 0xff, body, le=False, what="key import")
+
+    def digest_input(self):
+        """Input of PSO:CDS and INTERNAL AUTHENTICATE."""
+        h = sha256(os.urandom(16)).digest()
+        if self.prof.kind == 'rsa':
+            # DigestInfo of SHA-256
+            return b"\x30\x31\x30\x0d\x06\x09\x60\x86\x48\x01\x65\x03\x04" \
+                + b"\x02\x01\x05\x00\x04\x20" + h
+        return h
+
+    def decrypt_input(self):
+        """Input of PSO:DEC, for the decryption key."""
+        pk = self.pubkey[1]
+        if self.prof.kind == 'rsa':
+            n = int.from_bytes(find_tlv(pk, 0x81), 'big')
+            e = int.from_bytes(find_tlv(pk, 0x82), 'big')
+            size = self.prof.size
+            msg = os.urandom(32)
+            pad = bytes([ b or 1 for b in os.urandom(size - 3 - len(msg)) ])
+            m = int.from_bytes(b"\x00\x02" + pad + b"\x00" + msg, 'big')
+            return b"\x00" + pow(m, e, n).to_bytes(size, 'big')
+        # ECDH with the token's own public key
+        point = find_tlv(pk, 0x86)
+        p86 = b"\x86" + tlv_len(len(point)) + point
+        p7f49 = b"\x7f\x49" + tlv_len(len(p86)) + p86
+        return b"\xa6" + tlv_len(len(p7f49)) + p7f49
+
+    def card_status(self):
+        """GET DATA as gpg --card-status does."""
+        for tag in (0x004f, 0x5f52, 0x006e, 0x0065, 0x5f50, 0x007a, 0x00c4):
+            self.cmd(0xca, tag >> 8, tag & 0xff, what="GET DATA %04x" % tag)
+
+def percentile(sorted_values, p):
+    i = int(len(sorted_values) * p / 100.0 + 0.5) - 1
+    return sorted_values[max(0, min(i, len(sorted_values) - 1))]
+
+class perf_recorder(object):
+    """Record latency of operations, compare with baseline."""
+    def __init__(self, iterations, baseline, threshold, results):
+        self.iterations = iterations
+        self.threshold = threshold
+        self.results_file = results
+        self.results = {}
+        self.baseline = {}
+        if baseline:
+            with open(baseline) as f:
+                self.baseline = json.load(f)['results']
+
+    def measure(self, name, func, iterations=None, setup=None):
+        """Run FUNC, and return the stats of NAME.  SETUP is called
+        before each, out of measurement."""
+        n = iterations or self.iterations
+        latency = []
+        start = time.perf_counter()
+        total = 0.0
+        for i in range(n):
+            arg = setup() if setup else None
+            t0 = time.perf_counter()
+            func(arg) if setup else func()
+            t = time.perf_counter() - t0
+            latency.append(t * 1000)
+            total += t
+        latency.sort()
+        stats = { 'count': n,
+                  'p50': percentile(latency, 50),
+                  'p90': percentile(latency, 90),
+                  'p99': percentile(latency, 99),
+                  'max': latency[-1],
+                  'ops_per_sec': n / total if total else 0 }
+        self.results[name] = stats
+        return stats
+
+    def check(self, name):
+        """Return a message if NAME regresses from the baseline."""
+        if name not in self.baseline or name not in self.results:
+            return None
+        msgs = []
+        for key in ('p50', 'p90'):
+            b = self.baseline[name][key]
+            n = self.results[name][key]
+            if b > 0 and (n - b) * 100.0 / b > self.threshold:
+                msgs.append("%s %s: %.3fms -> %.3fms (+%.1f%%)"
+                            % (name, key, b, n, (n - b) * 100.0 / b))
+        return "; ".join(msgs) or None
+
+    def report(self):
+        lines = [ "%-28s %6s %9s %9s %9s %9s %9s"
+                  % ("operation", "count", "p50(ms)", "p90(ms)", "p99(ms)",
+                     "max(ms)", "ops/sec") ]
+        for name in sorted(self.results):
+            s = self.results[name]
+            lines.append("%-28s %6d %9.3f %9.3f %9.3f %9.3f %9.1f"
+                         % (name, s['count'], s['p50'], s['p90'], s['p99'],
+                            s['max'], s['ops_per_sec']))
+        return "\n".join(lines)
+
+    def write(self):
+        if not self.results_file or not self.results:
+            return
+        with open(self.results_file, "w") as f:
+            json.dump({ 'version': 1, 'results': self.results }, f,
+                      indent=2, sort_keys=True)
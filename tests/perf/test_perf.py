@@ -0,0 +1,79 @@
+"""
+test_perf.py - latency and throughput of commands on emulated token
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# For each algorithm, a token is started from a scratch flash image,
+# and personalized with generated keys.  Each test measures an
+# operation, and fails when it regresses from the baseline.
+
+def check(perf, name):
+    msg = perf.check(name)
+    assert msg is None, msg
+
+def test_verify(perf, token, algo):
+    name = "VERIFY/" + algo.name
+    perf.measure(name, token.verify_pw1)
+    check(perf, name)
+
+def test_pso_cds(perf, token, algo):
+    name = "PSO:CDS/" + algo.name
+    def sign(data):
+        token.cmd(0x2a, 0x9e, 0x9a, data, what="PSO:CDS")
+    def setup():
+        # PW1 for signing is valid for a single signature
+        token.verify_pw1(1)
+        return token.digest_input()
+    perf.measure(name, sign, setup=setup)
+    check(perf, name)
+
+def test_pso_dec(perf, token, algo):
+    name = "PSO:DEC/" + algo.name
+    token.verify_pw1(2)
+    data = token.decrypt_input()
+    perf.measure(name, lambda: token.cmd(0x2a, 0x80, 0x86, data,
+                                         what="PSO:DEC"))
+    check(perf, name)
+
+def test_internal_authenticate(perf, token, algo):
+    name = "INTERNAL AUTHENTICATE/" + algo.name
+    token.verify_pw1(2)
+    data = token.digest_input()
+    perf.measure(name, lambda: token.cmd(0x88, 0x00, 0x00, data,
+                                         what="INTERNAL AUTHENTICATE"))
+    check(perf, name)
+
+def test_card_status(perf, token, algo):
+    name = "card-status/" + algo.name
+    perf.measure(name, token.card_status)
+    check(perf, name)
+
+def test_key_import(perf, token, algo, request):
+    name = "key import/" + algo.name
+    token.verify_pw3()
+    perf.measure(name, lambda: token.import_key(2),
+                 iterations=request.config.getoption("keygen_iterations"))
+    check(perf, name)
+
+def test_generate(perf, token, algo, request):
+    name = "GENERATE/" + algo.name
+    token.verify_pw3()
+    perf.measure(name, lambda: token.generate(2),
+                 iterations=request.config.getoption("keygen_iterations"))
+    check(perf, name)
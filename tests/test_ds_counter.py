@@ -0,0 +1,85 @@
+"""
+test_ds_counter.py - test digital signature counter over its flash page
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# The counter has its own flash page, a halfword for each signature.
+# When the page is full, it's erased and the counter is rebased.  Run
+# on the card engine of the emulation (libgnuk-core), so that it can
+# be powered off and on again to read the counter from flash.
+
+from struct import pack
+from hashlib import sha256
+from util import *
+
+FACTORY_PASSPHRASE_PW1=b"123456"
+FACTORY_PASSPHRASE_PW3=b"12345678"
+
+OID_ED25519=b"\x2b\x06\x01\x04\x01\xda\x47\x0f\x01"
+
+# More than a page (1024 bytes) of halfwords holds
+NUM_SIGNATURES=600
+
+def ds_counter(card):
+    c = get_data_object(card, 0x93)
+    return int.from_bytes(c, 'big')
+
+def sign(card, n):
+    for i in range(n):
+        card.cmd_verify(1, FACTORY_PASSPHRASE_PW1)
+        card.cmd_pso(0x9e, 0x9a, sha256(pack('>I', i)).digest())
+
+def test_verify_pw3(core_card):
+    v = core_card.cmd_verify(3, FACTORY_PASSPHRASE_PW3)
+    assert v
+
+def test_algorithm_attr_sig(core_card):
+    r = core_card.cmd_put_data(0x00, 0xc1, b"\x16" + OID_ED25519)
+    assert r
+
+def test_keygen_sig(core_card):
+    core_card.cmd_genkey(1)
+    pk = core_card.cmd_get_public_key(1)
+    assert pk[0:2] == b"\x7f\x49"
+
+def test_ds_counter_0(core_card):
+    c = get_data_object(core_card, 0x7a)
+    assert c == b'\x93\x03\x00\x00\x00'
+
+def test_sign_over_page(core_card):
+    sign(core_card, NUM_SIGNATURES)
+    assert ds_counter(core_card) == NUM_SIGNATURES
+
+def test_ds_counter_reinit(core_reader, core_card):
+    core_reader.reinit()
+    core_card.cmd_select_openpgp()
+    assert ds_counter(core_card) == NUM_SIGNATURES
+
+def test_sign_after_reinit(core_reader, core_card):
+    sign(core_card, 1)
+    assert ds_counter(core_card) == NUM_SIGNATURES + 1
+    core_reader.reinit()
+    core_card.cmd_select_openpgp()
+    assert ds_counter(core_card) == NUM_SIGNATURES + 1
+
+def test_sign_over_page_again(core_reader, core_card):
+    sign(core_card, NUM_SIGNATURES)
+    core_reader.reinit()
+    core_card.cmd_select_openpgp()
+    assert ds_counter(core_card) == NUM_SIGNATURES * 2 + 1
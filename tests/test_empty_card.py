@@ -66,6 +66,14 @@ def test_app_data(card):
     assert app_data[0:8] == b"\x4f\x10\xd2\x76\x00\x01\x24\x01" and \
            app_data[18:18+2] == b"\x5f\x52"
 
+def test_get_data_bulk(card):
+    tags = [0x6e, 0x65, 0x5f52, 0xc4, 0x7a, 0xb6, 0xb8, 0xa4]
+    values = card.cmd_get_data_bulk(tags)
+    assert len(values) == len(tags)
+    for (tag, v) in zip(tags[0:5], values[0:5]):
+        assert v == get_data_object(card, tag)
+    assert values[5:] == [b"", b"", b""]
+
 def test_url(card):
     url = get_data_object(card, 0x5f50)
     assert check_null(url)
@@ -0,0 +1,145 @@
+"""
+test_key_storage.py - test keys in the shared key storage
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# Keys of different sizes share the key storage, and a replaced key is
+# reclaimed when space runs out.  The flash image is personalized by
+# tool/gnuk_image_personalize.py, by the library under test, or by
+# the library of an older version given by --legacy-core (an image in
+# the old layout, with a page for each key).  Run on the card engine
+# of the emulation, powered off and on again to read keys from flash.
+
+import os, sys, subprocess, pytest
+from binascii import hexlify
+from util import *
+import rsa_keys
+
+FACTORY_PASSPHRASE_PW1=b"123456"
+FACTORY_PASSPHRASE_PW3=b"12345678"
+
+RSA2K_ATTR=b"\x01\x08\x00\x00\x20\x00"
+
+PERSONALIZE = os.path.join(os.path.dirname(__file__),
+                           "..", "tool", "gnuk_image_personalize.py")
+
+# Times to replace the authentication key; more than the key storage
+# (three pages) holds without reclaim.
+NUM_REPLACE=6
+
+# Public keys to be read, for SIG, DEC, and AUT
+public_key = [ None, None, None ]
+
+@pytest.fixture(scope="module", params=["current", "legacy"])
+def core_image(request, tmpdir_factory):
+    if request.param == "legacy":
+        lib = request.config.getoption("legacy_core")
+        if not lib:
+            pytest.skip("No --legacy-core")
+    else:
+        lib = request.config.getoption("core")
+        if not os.path.exists(lib):
+            pytest.skip("No libgnuk-core: %s" % lib)
+    d = tmpdir_factory.mktemp("key-storage")
+    d.join("dec.key").write(hexlify(os.urandom(32)).decode('ascii') + "\n")
+    d.join("aut.key").write(hexlify(os.urandom(32)).decode('ascii') + "\n")
+    spec = d.join("spec")
+    spec.write("sig.attr = rsa2048\n"
+               "sig.key = %s\n"
+               "dec.attr = cv25519\n"
+               "dec.key = %s\n"
+               "aut.attr = ed25519\n"
+               "aut.key = %s\n"
+               % (os.path.abspath("rsa-sig.key"), d.join("dec.key"),
+                  d.join("aut.key")))
+    image = d.join("flash-image")
+    subprocess.check_call([sys.executable, PERSONALIZE, "-l", lib,
+                           "-o", str(image), str(spec)])
+    public_key[0] = public_key[1] = public_key[2] = None
+    return image.read_binary()
+
+def reinit(reader, card):
+    reader.reinit()
+    card.cmd_select_openpgp()
+
+def check_public_keys(card):
+    for i in range(3):
+        pk = card.cmd_get_public_key(i + 1)
+        assert pk == public_key[i]
+
+def check_sign(card):
+    digestinfo = rsa_keys.compute_digestinfo(b"key storage")
+    card.cmd_verify(1, FACTORY_PASSPHRASE_PW1)
+    r = card.cmd_pso(0x9e, 0x9a, digestinfo)
+    sig = rsa_keys.compute_signature(0, digestinfo)
+    assert r == sig.to_bytes(256, byteorder='big')
+
+def test_public_key_1(core_card):
+    pk = core_card.cmd_get_public_key(1)
+    assert rsa_keys.key[0][0] == pk[9:9+256]
+    public_key[0] = pk
+
+def test_public_key_2(core_card):
+    pk = core_card.cmd_get_public_key(2)
+    assert pk[0:5] == b"\x7f\x49\x22\x86\x20"
+    public_key[1] = pk
+
+def test_public_key_3(core_card):
+    pk = core_card.cmd_get_public_key(3)
+    assert pk[0:5] == b"\x7f\x49\x22\x86\x20"
+    public_key[2] = pk
+
+def test_public_keys_reinit(core_reader, core_card):
+    reinit(core_reader, core_card)
+    check_public_keys(core_card)
+
+def test_sign_0(core_card):
+    check_sign(core_card)
+
+def test_verify_pw3(core_card):
+    v = core_card.cmd_verify(3, FACTORY_PASSPHRASE_PW3)
+    assert v
+
+def test_algorithm_attr_aut(core_card):
+    r = core_card.cmd_put_data(0x00, 0xc3, RSA2K_ATTR)
+    assert r
+
+def test_replace_key_3(core_reader, core_card):
+    for i in range(NUM_REPLACE):
+        keyno = 2 - (i % 2)     # AUT key, then DEC key, and so on
+        t = rsa_keys.build_privkey_template(3, keyno)
+        core_card.cmd_verify(3, FACTORY_PASSPHRASE_PW3)
+        r = core_card.cmd_put_data_odd(0x3f, 0xff, t)
+        assert r
+        pk = core_card.cmd_get_public_key(3)
+        assert rsa_keys.key[keyno][0] == pk[9:9+256]
+        public_key[2] = pk
+        reinit(core_reader, core_card)
+        check_public_keys(core_card)
+
+def test_sign_1(core_card):
+    check_sign(core_card)
+
+def test_internal_authenticate(core_card):
+    digestinfo = rsa_keys.compute_digestinfo(b"key storage")
+    core_card.cmd_verify(2, FACTORY_PASSPHRASE_PW1)
+    r = core_card.cmd_internal_authenticate(digestinfo)
+    keyno = 2 - ((NUM_REPLACE - 1) % 2)
+    sig = rsa_keys.compute_signature(keyno, digestinfo)
+    assert r == sig.to_bytes(256, byteorder='big')
@@ -163,6 +163,14 @@ def test_public_key_3(card):
     pk = card.cmd_get_public_key(3)
     assert rsa_keys.key[2][0] == pk[9:9+256]
 
+def test_get_data_bulk(card):
+    tags = [0xb6, 0xb8, 0xa4, 0xc4, 0x6e]
+    values = card.cmd_get_data_bulk(tags)
+    for i in range(3):
+        assert rsa_keys.key[i][0] == values[i][4:4+256]
+    assert values[3] == get_data_object(card, 0xc4)
+    assert values[4] == get_data_object(card, 0x6e)
+
 def test_setup_pw1_0(card):
     r = card.cmd_change_reference_data(1, FACTORY_PASSPHRASE_PW1 + PW1_TEST0)
     assert r
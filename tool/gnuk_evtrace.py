@@ -0,0 +1,240 @@
+#! /usr/bin/python3
+
+"""
+gnuk_evtrace.py - decode event trace of Gnuk Token into a timeline
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# Gnuk should be built with --enable-event-trace.  The trace is read
+# by GET DATA, or from the output of dump_mem.py, dumping the memory
+# at the address of event_trace_buf (see: nm gnuk.elf).
+#
+# The timeline of events is printed, followed by the breakdown of each
+# command into stages:
+#
+#   usb-in:  reception of the CCID message
+#   ccid:    CCID layer, until it's given to the OpenPGP thread
+#   sched:   until the OpenPGP thread wakes up
+#   exec:    execution, including crypto, flash write and flash GC
+#   return:  until the CCID thread receives the result
+#   usb-out: transmission of the response
+
+import sys, re
+
+DEFAULT_PW3 = "12345678"
+
+# Keep in sync with enum trace_event in src/gnuk.h
+TRACE_USB_RX_START = 1
+TRACE_USB_RX_DONE = 2
+TRACE_CCID_CMD = 3
+TRACE_GPG_WAKEUP = 4
+TRACE_CRYPTO_START = 5
+TRACE_CRYPTO_END = 6
+TRACE_FLASH_WRITE = 7
+TRACE_FLASH_WRITE_END = 8
+TRACE_FLASH_GC = 9
+TRACE_FLASH_GC_END = 10
+TRACE_GPG_DONE = 11
+TRACE_CCID_RES = 12
+TRACE_USB_TX_DONE = 13
+
+EVENT_NAME = {
+    TRACE_USB_RX_START: "usb-rx-start",
+    TRACE_USB_RX_DONE: "usb-rx-done",
+    TRACE_CCID_CMD: "ccid-cmd",
+    TRACE_GPG_WAKEUP: "gpg-wakeup",
+    TRACE_CRYPTO_START: "crypto-start",
+    TRACE_CRYPTO_END: "crypto-end",
+    TRACE_FLASH_WRITE: "flash-write",
+    TRACE_FLASH_WRITE_END: "flash-write-end",
+    TRACE_FLASH_GC: "flash-gc",
+    TRACE_FLASH_GC_END: "flash-gc-end",
+    TRACE_GPG_DONE: "gpg-done",
+    TRACE_CCID_RES: "ccid-res",
+    TRACE_USB_TX_DONE: "usb-tx-done",
+}
+
+ALG_NAME = {
+    0x00: "RSA4K",
+    0x01: "NIST P-256",
+    0x02: "secp256k1",
+    0x03: "Ed25519",
+    0x04: "Curve25519",
+    0xff: "RSA2K",
+}
+
+EVENT_TRACE_MAGIC = b"EVTR"
+
+def arg_str(ev, arg):
+    if ev == TRACE_CCID_CMD:
+        return "INS=%02x" % arg
+    elif ev == TRACE_CRYPTO_START:
+        return ALG_NAME.get(arg, "algo=%d" % arg)
+    elif ev == TRACE_CRYPTO_END:
+        return "r=%d" % (arg - 0x10000 if arg >= 0x8000 else arg)
+    elif ev == TRACE_GPG_DONE:
+        return "SW=%04x" % arg
+    elif ev in (TRACE_USB_RX_START, TRACE_USB_RX_DONE, TRACE_CCID_RES,
+                TRACE_FLASH_WRITE):
+        return "len=%d" % arg
+    elif ev == TRACE_GPG_WAKEUP:
+        return "ev=%d" % arg
+    return ""
+
+def read_dump(filename):
+    """Parse output of dump_mem.py.  Return (TIMESTAMP_PER_USEC, COUNT,
+    records) as gnuk_token.cmd_get_event_trace does."""
+    data = bytearray()
+    with open(filename) as f:
+        for line in f:
+            words = line.split()
+            if words and all([re.match("^[0-9a-f]{2}$", w) for w in words]):
+                data += bytearray([int(w, 16) for w in words])
+    i = bytes(data).find(EVENT_TRACE_MAGIC)
+    if i < 0:
+        raise ValueError("No event trace found in %s" % filename)
+    le16 = lambda j: data[j] | (data[j+1] << 8)
+    le32 = lambda j: le16(j) | (le16(j+2) << 16)
+    per_usec = le16(i + 4)
+    size = le16(i + 6)
+    count = le32(i + 8)
+    num = min(count, size)
+    records = []
+    for k in range(count - num, count):
+        j = i + 12 + (k % size) * 8
+        if j + 8 > len(data):
+            raise ValueError("Dump is too short")
+        records.append((le32(j), data[j+4], data[j+5], le16(j+6)))
+    return (per_usec, count, records)
+
+def print_timeline(per_usec, records):
+    t0 = prev = records[0][0]
+    print("    time(us)   delta(us)  event")
+    for (t, ev, seq, arg) in records:
+        print("%12.1f %11.1f  %-16s %s"
+              % (((t - t0) & 0xffffffff) / per_usec,
+                 ((t - prev) & 0xffffffff) / per_usec,
+                 EVENT_NAME.get(ev, "event %d" % ev), arg_str(ev, arg)))
+        prev = t
+
+def breakdown(per_usec, records):
+    """Split records into commands, return list of (INS, stages)."""
+    t0 = records[0][0]
+    times = [ ((t - t0) & 0xffffffff) / per_usec
+              for (t, ev, seq, arg) in records ]
+    commands = []
+    rx_start = rx_done = None
+    cmd = None
+    for i, (t, ev, seq, arg) in enumerate(records):
+        now = times[i]
+        if ev == TRACE_USB_RX_START:
+            rx_start = now
+        elif ev == TRACE_USB_RX_DONE:
+            rx_done = now
+        elif ev == TRACE_CCID_CMD:
+            cmd = { 'ins': arg, 'cmd': now, 'crypto': 0.0, 'flash': 0.0,
+                    'gc': 0.0, 'open': {} }
+            if rx_start is not None and rx_done is not None:
+                cmd['usb-in'] = rx_done - rx_start
+                cmd['ccid'] = now - rx_done
+            rx_start = rx_done = None
+        elif cmd is None:
+            continue
+        elif ev == TRACE_GPG_WAKEUP:
+            cmd['sched'] = now - cmd['cmd']
+            cmd['wakeup'] = now
+        elif ev in (TRACE_CRYPTO_START, TRACE_FLASH_WRITE, TRACE_FLASH_GC):
+            cmd['open'][ev] = now
+        elif ev in (TRACE_CRYPTO_END, TRACE_FLASH_WRITE_END,
+                    TRACE_FLASH_GC_END):
+            start = cmd['open'].pop(ev - 1, None)
+            if start is not None:
+                key = { TRACE_CRYPTO_END: 'crypto',
+                        TRACE_FLASH_WRITE_END: 'flash',
+                        TRACE_FLASH_GC_END: 'gc' }[ev]
+                cmd[key] += now - start
+        elif ev == TRACE_GPG_DONE and 'wakeup' in cmd:
+            cmd['exec'] = now - cmd['wakeup']
+            cmd['done'] = now
+        elif ev == TRACE_CCID_RES and 'done' in cmd:
+            cmd['return'] = now - cmd['done']
+            cmd['res'] = now
+        elif ev == TRACE_USB_TX_DONE and 'res' in cmd:
+            cmd['usb-out'] = now - cmd['res']
+            commands.append(cmd)
+            cmd = None
+    return commands
+
+STAGES = [ 'usb-in', 'ccid', 'sched', 'exec', 'crypto', 'flash', 'gc',
+           'return', 'usb-out' ]
+
+def print_breakdown(commands):
+    print("INS " + "".join([ "%10s" % s for s in STAGES ]) + "   (us)")
+    for cmd in commands:
+        print(" %02x " % cmd['ins']
+              + "".join([ "%10.1f" % cmd[s] if s in cmd else "%10s" % "-"
+                          for s in STAGES ]))
+
+def main(filename, passwd):
+    if filename:
+        per_usec, count, records = read_dump(filename)
+    else:
+        from gnuk_token import get_gnuk_device
+        gnuk = get_gnuk_device()
+        gnuk.cmd_select_openpgp()
+        if passwd:
+            gnuk.cmd_verify(3, passwd.encode('UTF-8'))
+        clear = passwd is not None
+        per_usec, count, records = gnuk.cmd_get_event_trace(clear)
+    print("%d events recorded, last %d shown" % (count, len(records)))
+    if not records:
+        return 0
+    print_timeline(per_usec, records)
+    print()
+    print_breakdown(breakdown(per_usec, records))
+    return 0
+
+if __name__ == '__main__':
+    clear = False
+    ask = False
+    filename = None
+    args = sys.argv[1:]
+    while args:
+        if args[0] == '-c':
+            clear = True
+            args.pop(0)
+        elif args[0] == '-p':
+            ask = True
+            args.pop(0)
+        elif args[0] == '-f' and len(args) > 1:
+            filename = args[1]
+            args = args[2:]
+        else:
+            print("Usage: %s [-c [-p]] [-f DUMP-FILE]" % sys.argv[0])
+            print("  -c  clear the trace after reading")
+            print("  -p  ask the admin password, instead of the default")
+            print("  -f  decode the output of dump_mem.py, instead")
+            sys.exit(1)
+    passwd = None
+    if clear and ask:
+        from getpass import getpass
+        passwd = getpass("Admin password: ")
+    elif clear:
+        passwd = DEFAULT_PW3
+    sys.exit(main(filename, passwd))
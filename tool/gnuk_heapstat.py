@@ -0,0 +1,67 @@
+#! /usr/bin/python3
+
+"""
+gnuk_heapstat.py - show statistics of heap on Gnuk Token
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# Gnuk should be built with --enable-heap-stats.  Sizes are in bytes,
+# including headers of chunks.  Free lists are by size class; the
+# first eight classes are exact, and others are by power of two.
+
+import sys
+
+from gnuk_token import get_gnuk_device
+
+DEFAULT_PW3 = "12345678"
+
+def main(passwd):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    if passwd:
+        gnuk.cmd_verify(3, passwd.encode('UTF-8'))
+    stat = gnuk.cmd_get_heap_stat(passwd is not None)
+    print("heap size:          %6d" % stat['size'])
+    print("used (brk):         %6d  (peak %d)" % (stat['brk'],
+                                                 stat['peak_brk']))
+    print("in use:             %6d  (peak %d)" % (stat['in_use'],
+                                                 stat['peak_in_use']))
+    print("free in lists:      %6d  (largest %d)" % (stat['free'],
+                                                    stat['largest_free']))
+    print("allocations:        %6d  (failed %d)" % (stat['num_alloc'],
+                                                   stat['num_fail']))
+    print("free list lengths: ", " ".join([ "%d" % n
+                                             for n in stat['free_lists'] ]))
+    return 0
+
+if __name__ == '__main__':
+    passwd = None
+    if len(sys.argv) > 1 and sys.argv[1] == '-c':
+        passwd = DEFAULT_PW3
+        sys.argv.pop(1)
+        if len(sys.argv) > 1 and sys.argv[1] == '-p':
+            from getpass import getpass
+            passwd = getpass("Admin password: ")
+            sys.argv.pop(1)
+    if len(sys.argv) > 1:
+        print("Usage: %s [-c [-p]]" % sys.argv[0])
+        print("  -c  reset peaks and counters after reading")
+        print("  -p  ask the admin password, instead of the default")
+        sys.exit(1)
+    sys.exit(main(passwd))
@@ -0,0 +1,305 @@
+#! /usr/bin/python3
+
+"""
+gnuk_image_personalize.py - build a personalized flash image of Gnuk
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# The image is personalized offline by the card engine itself
+# (libgnuk-core, built in ../core), so the layout of keys and data
+# objects is exactly same as the one the token writes.  The result
+# can be used by the emulation as a template:
+#
+#   $ ./gnuk_image_personalize.py -o template.img SPEC
+#   $ ../src/build/gnuk --template=template.img [flash-image-file]
+#
+# SPEC has a line of "NAME = VALUE" for each item; "#" starts a comment.
+#
+#   pw1 = 123456             user password (factory setting: 123456)
+#   pw3 = 12345678           admin password (factory setting: 12345678)
+#   resetcode = 12345678     resetting code
+#   name = Gnuk Taro         cardholder name (5B)
+#   login = taro             login data (5E)
+#   url = https://...        URL of public key (5F50)
+#   lang = ja                language preference (5F2D)
+#   sex = 1                  sex (5F35), 1 for male, 2 for female, 9
+#
+# and for each key of sig, dec and aut:
+#
+#   sig.attr = rsa2048       rsa2048, rsa4096, p256, secp256k1,
+#                            ed25519 or cv25519
+#   sig.key = FILE           import the key from FILE, or "generate"
+#   sig.fpr = HEX            fingerprint (40 hex digits)
+#   sig.date = SECONDS       generation time
+#
+# An RSA key file has four lines of N, E, P and Q in hex, as
+# ../tests/rsa-sig.key.  An ECC key file has a line of the private
+# key in hex.
+
+import sys, os, ctypes
+from struct import pack
+from binascii import unhexlify
+
+FLASH_IMAGE_SIZE = 8192
+FLASH_PAGE_SIZE = 1024
+RES_APDU_MAX = 5+9+512+2
+
+FACTORY_PW1 = b"123456"
+FACTORY_PW3 = b"12345678"
+
+OID_NISTP256 = b"\x2a\x86\x48\xce\x3d\x03\x01\x07"
+OID_SECP256K1 = b"\x2b\x81\x04\x00\x0a"
+OID_ED25519 = b"\x2b\x06\x01\x04\x01\xda\x47\x0f\x01"
+OID_CV25519 = b"\x2b\x06\x01\x04\x01\x97\x55\x01\x05\x01"
+
+# Algorithm attributes; ECDSA is 0x13 and ECDH is 0x12.
+def algo_attr(algo, keyno):
+    ec = b"\x12" if keyno == 1 else b"\x13"
+    if algo == 'rsa2048':
+        return b"\x01\x08\x00\x00\x20\x00"
+    elif algo == 'rsa4096':
+        return b"\x01\x10\x00\x00\x20\x00"
+    elif algo == 'p256':
+        return ec + OID_NISTP256
+    elif algo == 'secp256k1':
+        return ec + OID_SECP256K1
+    elif algo == 'ed25519':
+        return b"\x16" + OID_ED25519
+    elif algo == 'cv25519':
+        return b"\x12" + OID_CV25519
+    raise ValueError("Unknown algorithm: %s" % algo)
+
+KEY_NAME = [ 'sig', 'dec', 'aut' ]
+KEY_SPEC = [ b"\xb6\x00", b"\xb8\x00", b"\xa4\x00" ]
+
+DO_TAG = { 'name': 0x005b, 'login': 0x005e, 'url': 0x5f50,
+           'lang': 0x5f2d, 'sex': 0x5f35 }
+
+def usage():
+    print("Usage: %s [-o OUTPUT] [-i INPUT] [-l LIBRARY]" % sys.argv[0])
+    print("          [--pw1 PW1] [--pw3 PW3] SPEC")
+    print("  -o  output flash image [gnuk-flash-image]")
+    print("  -i  start from INPUT instead of an empty image")
+    print("  -l  libgnuk-core.so [../core/libgnuk-core.so]")
+    print("  --pw1  user password of INPUT [123456]")
+    print("  --pw3  admin password of INPUT [12345678]")
+
+def tlv_len(l):
+    if l < 128:
+        return pack('>B', l)
+    elif l < 256:
+        return b"\x81" + pack('>B', l)
+    else:
+        return b"\x82" + pack('>H', l)
+
+def empty_image():
+    """Same as the output of gnuk-emulation-setup."""
+    return b"\xff" * 4096 + b"\x00\x00" + b"\xff" * 4094
+
+def read_spec(file):
+    spec = {}
+    with open(file) as f:
+        for line in f:
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            name, sep, value = line.partition('=')
+            if not sep:
+                raise ValueError("Wrong spec line: %s" % line)
+            spec[name.strip()] = value.strip()
+    return spec
+
+def read_key(file, algo):
+    with open(file) as f:
+        lines = [ l.strip() for l in f if l.strip() ]
+    if algo.startswith('rsa'):
+        n, e, p, q = [ int(l, 16) for l in lines[0:4] ]
+        if n != p * q:
+            raise ValueError("Wrong key: %s" % file)
+        plen = (n.bit_length() + 15) // 16
+        template = b"\x91\x04\x92" + tlv_len(plen) + b"\x93" + tlv_len(plen)
+        data = pack('>I', e) + p.to_bytes(plen, 'big') + q.to_bytes(plen, 'big')
+    else:
+        d = unhexlify(lines[0])
+        template = b"\x92" + tlv_len(len(d))
+        data = d
+    return (template, data)
+
+PROGRAM_HALFWORD = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p,
+                                    ctypes.c_void_p, ctypes.c_uint16)
+ERASE_PAGE = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p)
+RNG = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p,
+                       ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t)
+
+class gnuk_core_flash(ctypes.Structure):
+    _fields_ = [ ('image', ctypes.c_void_p),
+                 ('arg', ctypes.c_void_p),
+                 ('program_halfword', PROGRAM_HALFWORD),
+                 ('erase_page', ERASE_PAGE) ]
+
+class card_engine(object):
+    """The card engine of libgnuk-core on an image in memory."""
+    def __init__(self, lib, image):
+        self.lib = ctypes.CDLL(lib)
+        self.lib.gnuk_core_apdu.argtypes = [ ctypes.c_char_p, ctypes.c_size_t,
+                                             ctypes.c_char_p,
+                                             ctypes.POINTER(ctypes.c_size_t) ]
+        self.image = ctypes.create_string_buffer(image, FLASH_IMAGE_SIZE)
+        self.base = ctypes.addressof(self.image)
+        # Keep references to callbacks, so that they are not collected.
+        self.cb_program = PROGRAM_HALFWORD(self.program_halfword)
+        self.cb_erase = ERASE_PAGE(self.erase_page)
+        self.cb_rng = RNG(self.rng)
+        self.flash = gnuk_core_flash(self.base, None,
+                                     self.cb_program, self.cb_erase)
+        if self.lib.gnuk_core_init(ctypes.byref(self.flash), self.cb_rng,
+                                   None, None) != 0:
+            raise ValueError("gnuk_core_init failed")
+
+    def program_halfword(self, arg, addr, data):
+        if not 0 <= addr - self.base < FLASH_IMAGE_SIZE:
+            return 1
+        # Native byte order, as the emulation does
+        ctypes.memmove(addr, data.to_bytes(2, sys.byteorder), 2)
+        return 0
+
+    def erase_page(self, arg, addr):
+        ctypes.memset(addr, 0xff, FLASH_PAGE_SIZE)
+        return 0
+
+    def rng(self, arg, buf, len):
+        ctypes.memmove(buf, os.urandom(len), len)
+        return 0
+
+    def fini(self):
+        self.lib.gnuk_core_fini()
+        return self.image.raw
+
+    def cmd(self, ins, p1, p2, data=b"", what=None):
+        res = ctypes.create_string_buffer(RES_APDU_MAX)
+        res_len = ctypes.c_size_t(0)
+        while True:
+            chunk, data = data[:255], data[255:]
+            c = pack('>BBBB', 0x10 if data else 0x00, ins, p1, p2)
+            if chunk:
+                c += pack('>B', len(chunk)) + chunk
+            else:
+                c += b"\x00"
+            if self.lib.gnuk_core_apdu(c, len(c), res,
+                                       ctypes.byref(res_len)) != 0:
+                raise ValueError("%s: malformed or fatal"
+                                 % (what or "INS %02x" % ins))
+            r = res.raw[:res_len.value]
+            if not data:
+                break
+        sw = (r[-2] << 8) | r[-1]
+        if sw != 0x9000:
+            raise ValueError("%s: SW %04x" % (what or "INS %02x" % ins, sw))
+        return r[:-2]
+
+def personalize(card, spec, pw1, pw3):
+    card.cmd(0xa4, 0x04, 0x00, b"\xd2\x76\x00\x01\x24\x01", "SELECT")
+    card.cmd(0x20, 0x00, 0x83, pw3, "VERIFY PW3")
+
+    for keyno in range(3):
+        k = KEY_NAME[keyno]
+        algo = spec.get(k + '.attr')
+        if algo:
+            card.cmd(0xda, 0x00, 0xc1 + keyno, algo_attr(algo, keyno),
+                     "attributes of " + k)
+        key = spec.get(k + '.key')
+        if key == 'generate':
+            card.cmd(0x47, 0x80, 0x00, KEY_SPEC[keyno], "GENERATE " + k)
+        elif key:
+            template, data = read_key(key, algo or 'rsa2048')
+            exthdr = KEY_SPEC[keyno] + b"\x7f\x48" + tlv_len(len(template)) \
+                + template + b"\x5f\x48" + tlv_len(len(data))
+            body = b"\x4d" + tlv_len(len(exthdr) + len(data)) + exthdr + data
+            card.cmd(0xdb, 0x3f, 0xff, body, "key import of " + k)
+        fpr = spec.get(k + '.fpr')
+        if fpr:
+            card.cmd(0xda, 0x00, 0xc7 + keyno, unhexlify(fpr),
+                     "fingerprint of " + k)
+        date = spec.get(k + '.date')
+        if date:
+            card.cmd(0xda, 0x00, 0xce + keyno, pack('>I', int(date)),
+                     "generation time of " + k)
+
+    for name, tag in DO_TAG.items():
+        if name in spec:
+            card.cmd(0xda, tag >> 8, tag & 0xff, spec[name].encode('utf-8'),
+                     name)
+
+    if 'resetcode' in spec:
+        card.cmd(0xda, 0x00, 0xd3, spec['resetcode'].encode('utf-8'),
+                 "resetcode")
+    if 'pw1' in spec:
+        card.cmd(0x24, 0x00, 0x81, pw1 + spec['pw1'].encode('utf-8'),
+                 "change of PW1")
+    if 'pw3' in spec:
+        card.cmd(0x24, 0x00, 0x83, pw3 + spec['pw3'].encode('utf-8'),
+                 "change of PW3")
+
+def main(argv):
+    output = "gnuk-flash-image"
+    input = None
+    lib = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                       "../core/libgnuk-core.so")
+    pw1 = FACTORY_PW1
+    pw3 = FACTORY_PW3
+    while len(argv) > 2:
+        if argv[1] == '-o':
+            output = argv[2]
+        elif argv[1] == '-i':
+            input = argv[2]
+        elif argv[1] == '-l':
+            lib = argv[2]
+        elif argv[1] == '--pw1':
+            pw1 = argv[2].encode('utf-8')
+        elif argv[1] == '--pw3':
+            pw3 = argv[2].encode('utf-8')
+        else:
+            break
+        argv = [ argv[0] ] + argv[3:]
+    if len(argv) != 2 or argv[1] == '--help':
+        usage()
+        return 1
+
+    spec = read_spec(argv[1])
+    if input:
+        with open(input, 'rb') as f:
+            image = f.read()
+        if len(image) != FLASH_IMAGE_SIZE:
+            raise ValueError("Wrong size of flash image: %s" % input)
+    else:
+        image = empty_image()
+
+    card = card_engine(lib, image)
+    try:
+        personalize(card, spec, pw1, pw3)
+    finally:
+        image = card.fini()
+
+    fd = os.open(output, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o600)
+    with os.fdopen(fd, 'wb') as f:
+        f.write(image)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,110 @@
+#! /usr/bin/python3
+
+"""
+gnuk_latency.py - show latency histograms kept on Gnuk Token
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# Gnuk should be built with --enable-latency-stats.  Bucket N counts
+# latency in [2^N, 2^(N+1)) microseconds, the last one counts longer.
+
+import sys
+
+from gnuk_token import get_gnuk_device, LATENCY_BUCKETS
+
+DEFAULT_PW3 = "12345678"
+
+INS_NAME = {
+    0x00: "(others)",
+    0x20: "VERIFY",
+    0x24: "CHANGE REFERENCE DATA",
+    0x2a: "PSO",
+    0x2c: "RESET RETRY COUNTER",
+    0x44: "ACTIVATE FILE",
+    0x47: "GENERATE ASYMMETRIC KEY PAIR",
+    0x82: "EXTERNAL AUTHENTICATE",
+    0x84: "GET CHALLENGE",
+    0x88: "INTERNAL AUTHENTICATE",
+    0xa4: "SELECT FILE",
+    0xb0: "READ BINARY",
+    0xca: "GET DATA",
+    0xcb: "GET DATA BULK",
+    0xd0: "WRITE BINARY",
+    0xd6: "UPDATE BINARY",
+    0xda: "PUT DATA",
+    0xdb: "PUT DATA (key import)",
+    0xe6: "TERMINATE DF",
+}
+
+ALG_NAME = {
+    0x80: "RSA4K",
+    0x81: "NIST P-256",
+    0x82: "secp256k1",
+    0x83: "Ed25519",
+    0x84: "Curve25519",
+    0xff: "RSA2K",
+}
+
+def usec_str(n):
+    v = 1 << n
+    if v >= 1000000:
+        return "%gs" % (v / 1000000.0)
+    elif v >= 1000:
+        return "%gms" % (v / 1000.0)
+    else:
+        return "%dus" % v
+
+def print_histogram(ins, alg, counts):
+    name = INS_NAME.get(ins, "INS %02x" % ins)
+    if alg:
+        name += " (%s)" % ALG_NAME.get(alg, "%02x" % alg)
+    print("%s: %d" % (name, sum(counts)))
+    for n in range(LATENCY_BUCKETS):
+        if counts[n] == 0:
+            continue
+        if n == LATENCY_BUCKETS - 1:
+            label = ">= %s" % usec_str(n)
+        else:
+            label = "< %s" % usec_str(n + 1)
+        print("  %10s %6d" % (label, counts[n]))
+
+def main(passwd):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    if passwd:
+        gnuk.cmd_verify(3, passwd.encode('UTF-8'))
+    for (ins, alg, counts) in gnuk.cmd_get_latency(passwd is not None):
+        print_histogram(ins, alg, counts)
+    return 0
+
+if __name__ == '__main__':
+    passwd = None
+    if len(sys.argv) > 1 and sys.argv[1] == '-c':
+        passwd = DEFAULT_PW3
+        sys.argv.pop(1)
+        if len(sys.argv) > 1 and sys.argv[1] == '-p':
+            from getpass import getpass
+            passwd = getpass("Admin password: ")
+            sys.argv.pop(1)
+    if len(sys.argv) > 1:
+        print("Usage: %s [-c [-p]]" % sys.argv[0])
+        print("  -c  clear the histograms after reading")
+        print("  -p  ask the admin password, instead of the default")
+        sys.exit(1)
+    sys.exit(main(passwd))
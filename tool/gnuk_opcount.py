@@ -0,0 +1,65 @@
+#! /usr/bin/python3
+
+"""
+gnuk_opcount.py - show field operation counts of commands on Gnuk Token
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# Gnuk should be built with --enable-op-count.  For each class of
+# command, the average number of each operation per command is shown.
+# Reductions by mul and sqr are included in "reduce".
+
+import sys
+
+from gnuk_token import get_gnuk_device, OPCOUNT_KINDS
+from gnuk_latency import INS_NAME, ALG_NAME
+
+DEFAULT_PW3 = "12345678"
+
+def main(passwd):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    if passwd:
+        gnuk.cmd_verify(3, passwd.encode('UTF-8'))
+    for (ins, alg, count, totals) in gnuk.cmd_get_opcount(passwd is not None):
+        cmd = INS_NAME.get(ins, "INS %02x" % ins)
+        if alg:
+            cmd += " (%s)" % ALG_NAME.get(alg, "%02x" % alg)
+        print("%s: %d" % (cmd, count))
+        for (kind, total) in zip(OPCOUNT_KINDS, totals):
+            if total == 0:
+                continue
+            print("  %-10s %10d" % (kind, total // count))
+    return 0
+
+if __name__ == '__main__':
+    passwd = None
+    if len(sys.argv) > 1 and sys.argv[1] == '-c':
+        passwd = DEFAULT_PW3
+        sys.argv.pop(1)
+        if len(sys.argv) > 1 and sys.argv[1] == '-p':
+            from getpass import getpass
+            passwd = getpass("Admin password: ")
+            sys.argv.pop(1)
+    if len(sys.argv) > 1:
+        print("Usage: %s [-c [-p]]" % sys.argv[0])
+        print("  -c  clear the counts after reading")
+        print("  -p  ask the admin password, instead of the default")
+        sys.exit(1)
+    sys.exit(main(passwd))
@@ -0,0 +1,72 @@
+#! /usr/bin/python3
+
+"""
+gnuk_profile.py - dump samples of the profiler of Gnuk emulation
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# The emulation should be built with --enable-profiler and run with
+# --profile=FILE.  This asks it to write FILE now.  With FILE, folded
+# stacks are shown with names of commands, to be fed to flamegraph.pl:
+#
+#   $ ./gnuk_profile.py /tmp/gnuk.folded | flamegraph.pl > gnuk.svg
+
+import sys, re
+
+from gnuk_token import get_gnuk_device
+from gnuk_latency import INS_NAME, ALG_NAME
+
+DEFAULT_PW3 = "12345678"
+
+def class_name(m):
+    ins, alg = int(m.group(1), 16), int(m.group(2), 16)
+    name = INS_NAME.get(ins, "INS %02x" % ins)
+    if alg:
+        name += " (%s)" % ALG_NAME.get(alg, "%02x" % alg)
+    return name
+
+def main(passwd, folded):
+    gnuk = get_gnuk_device()
+    gnuk.cmd_select_openpgp()
+    if passwd:
+        gnuk.cmd_verify(3, passwd.encode('UTF-8'))
+    samples, dropped = gnuk.cmd_get_profile(passwd is not None)
+    print("%d samples, %d dropped" % (samples, dropped), file=sys.stderr)
+    if folded:
+        with open(folded) as f:
+            for line in f:
+                sys.stdout.write(re.sub(r'^ins_([0-9a-f]+)-alg_([0-9a-f]+)',
+                                        class_name, line))
+    return 0
+
+if __name__ == '__main__':
+    passwd = None
+    if len(sys.argv) > 1 and sys.argv[1] == '-c':
+        passwd = DEFAULT_PW3
+        sys.argv.pop(1)
+        if len(sys.argv) > 1 and sys.argv[1] == '-p':
+            from getpass import getpass
+            passwd = getpass("Admin password: ")
+            sys.argv.pop(1)
+    if len(sys.argv) > 2:
+        print("Usage: %s [-c [-p]] [FILE]" % sys.argv[0])
+        print("  -c  clear the samples after writing")
+        print("  -p  ask the admin password, instead of the default")
+        sys.exit(1)
+    sys.exit(main(passwd, sys.argv[1] if len(sys.argv) > 1 else None))
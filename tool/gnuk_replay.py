@@ -0,0 +1,236 @@
+#! /usr/bin/python3
+
+"""
+gnuk_replay.py - replay APDU trace to Gnuk Tokens, for load testing
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# The trace is recorded by the emulation with --apdu-trace=FILE.  Each
+# token (typically, an emulated token attached by usbip) replays the
+# whole trace in its own thread.  Latency is measured as round trip
+# from the host, and reported for each INS.
+#
+# Masked data of VERIFY is replaced by PW1 or PW3.  Other masked
+# commands (password change, key import) are skipped.
+
+import sys, time, threading, binascii
+from struct import pack
+
+from gnuk_token import gnuk_token, gnuk_devices
+
+DEFAULT_PW1 = b"123456"
+DEFAULT_PW3 = b"12345678"
+
+def usage():
+    print("Usage: %s [-c CONCURRENCY] [-n REPEAT] [-s SPEED] [-k]" % sys.argv[0])
+    print("          [--pw1 PW1] [--pw3 PW3] TRACE-FILE")
+    print("  -c  number of tokens used at the same time [all]")
+    print("  -n  number of times to replay the trace [1]")
+    print("  -s  speed relative to the trace, 0 for no wait [0]")
+    print("  -k  keep going when SW differs from the trace")
+
+class trace_entry(object):
+    def __init__(self, line):
+        f = line.split()
+        if len(f) != 7:
+            raise ValueError("Wrong trace line: %s" % line)
+        self.time = int(f[0])
+        self.latency = int(f[1])
+        self.head = binascii.unhexlify(f[2])
+        self.data = f[3] if f[3] != '-' else ''
+        self.le = int(f[4])
+        self.sw = int(f[6], 16)
+        self.ins = self.head[1]
+
+def read_trace(filename):
+    entries = []
+    with open(filename) as f:
+        for line in f:
+            if line.startswith('#') or not line.strip():
+                continue
+            entries.append(trace_entry(line))
+    return entries
+
+def command_data(e, pw1, pw3):
+    """Return data of command, or None if it should be skipped."""
+    if 'x' not in e.data:
+        return binascii.unhexlify(e.data)
+    if e.ins == 0x20:
+        if e.head[3] == 0x83:
+            return pw3
+        else:
+            return pw1
+    return None
+
+def transmit(icc, head, data, le):
+    """Send a command with command chaining, receive response with
+    GET RESPONSE.  Return (response data, SW)."""
+    cla, ins, p1, p2 = head
+    while True:
+        chunk, data = data[:255], data[255:]
+        c = pack('>BBBB', cla | (0x10 if data else 0), ins, p1, p2)
+        if chunk:
+            c += pack('>B', len(chunk)) + chunk
+        if not data and le:
+            c += pack('>B', le & 0xff)
+        r = icc.icc_send_cmd(c)
+        if not data:
+            break
+    res = bytes(r[:-2])
+    while r[-2] == 0x61:
+        r = icc.icc_send_cmd(pack('>BBBBB', 0x00, 0xc0, 0x00, 0x00, r[-1]))
+        res += bytes(r[:-2])
+    return res, (r[-2] << 8) | r[-1]
+
+class replayer(threading.Thread):
+    def __init__(self, icc, entries, repeat, speed, pw1, pw3, keep_going):
+        threading.Thread.__init__(self)
+        self.icc = icc
+        self.entries = entries
+        self.repeat = repeat
+        self.speed = speed
+        self.pw1 = pw1
+        self.pw3 = pw3
+        self.keep_going = keep_going
+        self.latency = {}
+        self.skipped = 0
+        self.mismatch = 0
+        self.error = None
+
+    def run(self):
+        try:
+            for i in range(self.repeat):
+                self.replay()
+        except Exception as e:
+            self.error = e
+
+    def replay(self):
+        start = time.perf_counter()
+        for e in self.entries:
+            data = command_data(e, self.pw1, self.pw3)
+            if data is None:
+                self.skipped += 1
+                continue
+            if self.speed:
+                delay = start + e.time / 1000000.0 / self.speed \
+                    - time.perf_counter()
+                if delay > 0:
+                    time.sleep(delay)
+            t0 = time.perf_counter()
+            res, sw = transmit(self.icc, e.head, data, e.le)
+            t1 = time.perf_counter()
+            self.latency.setdefault(e.ins, []).append(t1 - t0)
+            if sw != e.sw:
+                self.mismatch += 1
+                if not self.keep_going:
+                    raise ValueError("INS %02x: SW %04x, expected %04x"
+                                     % (e.ins, sw, e.sw))
+
+def percentile(sorted_values, p):
+    i = int(len(sorted_values) * p / 100.0 + 0.5) - 1
+    return sorted_values[max(0, min(i, len(sorted_values) - 1))]
+
+def report(threads, elapsed):
+    latency = {}
+    total = 0
+    for t in threads:
+        for ins, l in t.latency.items():
+            latency.setdefault(ins, []).extend(l)
+            total += len(l)
+    print("INS  count     p50(ms)   p90(ms)   p99(ms)   max(ms)")
+    for ins in sorted(latency.keys()):
+        l = sorted(latency[ins])
+        print("%02x  %6d  %9.3f %9.3f %9.3f %9.3f"
+              % (ins, len(l), percentile(l, 50) * 1000,
+                 percentile(l, 90) * 1000, percentile(l, 99) * 1000,
+                 l[-1] * 1000))
+    print("%d commands in %.3f sec (%.1f/sec), %d skipped, %d SW mismatch"
+          % (total, elapsed, total / elapsed if elapsed else 0,
+             sum([t.skipped for t in threads]),
+             sum([t.mismatch for t in threads])))
+
+def open_tokens(max_num):
+    tokens = []
+    for (dev, config, intf) in gnuk_devices():
+        if max_num and len(tokens) >= max_num:
+            break
+        try:
+            icc = gnuk_token(dev, config, intf)
+        except:
+            continue
+        status = icc.icc_get_status()
+        if status == 1:
+            icc.icc_power_on()
+        elif status != 0:
+            continue
+        tokens.append(icc)
+    return tokens
+
+def main(filename, concurrency, repeat, speed, pw1, pw3, keep_going):
+    entries = read_trace(filename)
+    tokens = open_tokens(concurrency)
+    if not tokens:
+        raise ValueError("No ICC present")
+    print("%d entries, %d token(s)" % (len(entries), len(tokens)))
+    threads = [ replayer(icc, entries, repeat, speed, pw1, pw3, keep_going)
+                for icc in tokens ]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+    for t in threads:
+        if t.error:
+            print("Error: %s" % t.error)
+    report(threads, elapsed)
+    for icc in tokens:
+        icc.release_gnuk()
+    return 0 if not any([t.error for t in threads]) else 1
+
+if __name__ == '__main__':
+    concurrency = 0
+    repeat = 1
+    speed = 0
+    pw1 = DEFAULT_PW1
+    pw3 = DEFAULT_PW3
+    keep_going = False
+    args = sys.argv[1:]
+    while len(args) > 1:
+        if args[0] == '-c':
+            concurrency = int(args[1])
+        elif args[0] == '-n':
+            repeat = int(args[1])
+        elif args[0] == '-s':
+            speed = float(args[1])
+        elif args[0] == '--pw1':
+            pw1 = args[1].encode('UTF-8')
+        elif args[0] == '--pw3':
+            pw3 = args[1].encode('UTF-8')
+        elif args[0] == '-k':
+            keep_going = True
+            args.pop(0)
+            continue
+        else:
+            break
+        args = args[2:]
+    if len(args) != 1:
+        usage()
+        sys.exit(1)
+    sys.exit(main(args[0], concurrency, repeat, speed, pw1, pw3, keep_going))
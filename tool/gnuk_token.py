@@ -44,6 +44,31 @@ HID_PROTOCOL_0 = 0x00
 def icc_compose(msg_type, data_len, slot, seq, param, data):
     return pack('<BiBBBH', msg_type, data_len, slot, seq, 0, param) + data
 
+LATENCY_BUCKETS = 24
+OPCOUNT_KINDS = [ 'mul', 'sqr', 'add', 'reduce', 'inv', 'mod_reduce',
+                  'montmul' ]
+
+def parse_tlv_list(data):
+    values = []
+    i = 0
+    while i < len(data):
+        if data[i] & 0x1f == 0x1f:
+            i += 2
+        else:
+            i += 1
+        if data[i] == 0x81:
+            l = data[i+1]
+            i += 2
+        elif data[i] == 0x82:
+            l = (data[i+1] << 8) | data[i+2]
+            i += 3
+        else:
+            l = data[i]
+            i += 1
+        values.append(data[i:i+l])
+        i += l
+    return values
+
 def iso7816_compose(ins, p1, p2, data, cls=0x00, le=None):
     data_len = len(data)
     if data_len == 0:
@@ -320,6 +345,135 @@ class gnuk_token(object):
             raise ValueError("%02x%02x" % (sw[0], sw[1]))
         return self.cmd_get_response(sw[1])
 
+    def cmd_get_data_bulk(self, tags):
+        """Get DOs of TAGS by the vendor command (CLA=0x80, INS=0xCB).
+        Return the list of values; it's empty when the DO is not available.
+        Tag B6, B8, or A4 means its public key (7F49).  Tag 7F21
+        (cardholder certificate) is not supported."""
+        values = []
+        while len(values) < len(tags):
+            data = b"".join([pack('>H', t) for t in tags[len(values):]])
+            cmd_data = iso7816_compose(0xcb, 0x00, 0x00, data, cls=0x80) \
+                       + b"\x00"
+            r = self.icc_send_cmd(cmd_data)
+            if len(r) < 2:
+                raise ValueError(r)
+            res = r[:-2]
+            sw = r[-2:]
+            while sw[0] == 0x61:
+                cmd_data = iso7816_compose(0xc0, 0x00, 0x00, b'') \
+                           + pack('>B', sw[1])
+                r = self.icc_send_cmd(cmd_data)
+                res += r[:-2]
+                sw = r[-2:]
+            if not ((sw[0] == 0x90 and sw[1] == 0x00)
+                    or (sw[0] == 0x63 and sw[1] == 0x10)):
+                raise ValueError("%02x%02x" % (sw[0], sw[1]))
+            values += parse_tlv_list(bytes(res))
+            if sw[0] == 0x90:
+                break
+        return values
+
+    def cmd_get_latency(self, clear=False):
+        """Get latency histograms (when built with --enable-latency-stats).
+        Return list of (INS, ALG, counts).  If CLEAR, clear them by PUT
+        DATA after reading; it needs admin authorization."""
+        data = self.cmd_get_data(0x01, 0x10)
+        if clear:
+            self.cmd_put_data(0x01, 0x10, b"")
+        n = 2 + LATENCY_BUCKETS * 2
+        result = []
+        for i in range(0, len(data), n):
+            counts = [ (data[i+2+j*2] << 8) | data[i+3+j*2]
+                       for j in range(LATENCY_BUCKETS) ]
+            result.append((data[i], data[i+1], counts))
+        return result
+
+    def cmd_get_event_trace(self, clear=False):
+        """Get event trace (when built with --enable-event-trace).
+        Return (TIMESTAMP_PER_USEC, COUNT, list of (TIME, EVENT, SEQ, ARG))
+        from the oldest.  If CLEAR, clear it by PUT DATA after reading; it
+        needs admin authorization."""
+        data = self.cmd_get_data(0x01, 0x12)
+        if clear:
+            self.cmd_put_data(0x01, 0x12, b"")
+        per_usec = (data[0] << 8) | data[1]
+        count = (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7]
+        records = []
+        for i in range(8, len(data), 8):
+            t = (data[i] << 24) | (data[i+1] << 16) | (data[i+2] << 8) \
+                | data[i+3]
+            records.append((t, data[i+4], data[i+5],
+                            (data[i+6] << 8) | data[i+7]))
+        return (per_usec, count, records)
+
+    def cmd_get_heap_stat(self, clear=False):
+        """Get statistics of heap (when built with --enable-heap-stats).
+        Return dictionary of values, with 'free_lists' for lengths of
+        free lists by size class.  If CLEAR, reset peaks and counters by
+        PUT DATA after reading; it needs admin authorization."""
+        data = self.cmd_get_data(0x01, 0x14)
+        if clear:
+            self.cmd_put_data(0x01, 0x14, b"")
+        names = [ 'size', 'brk', 'peak_brk', 'in_use', 'peak_in_use',
+                  'free', 'largest_free', 'num_alloc', 'num_fail' ]
+        stat = {}
+        for i in range(len(names)):
+            stat[names[i]] = unpack('>I', data[i*4:i*4+4])[0]
+        n = len(names) * 4
+        stat['free_lists'] = [ unpack('>H', data[j:j+2])[0]
+                               for j in range(n, len(data), 2) ]
+        return stat
+
+    def cmd_get_stack_stat(self, clear=False):
+        """Get high-water marks of stacks (when built with
+        --enable-stack-stats).  Return (list of (NAME, SIZE, USED) for
+        threads, list of (INS, ALG, USED) for commands).  If CLEAR,
+        clear the records of commands by PUT DATA after reading; it needs
+        admin authorization."""
+        data = self.cmd_get_data(0x01, 0x16)
+        if clear:
+            self.cmd_put_data(0x01, 0x16, b"")
+        num_threads, num_classes = data[0], data[1]
+        threads = []
+        i = 2
+        for n in range(num_threads):
+            name = data[i:i+8].rstrip(b'\0').decode('ascii')
+            size, used = unpack('>HH', data[i+8:i+12])
+            threads.append((name, size, used))
+            i += 12
+        classes = []
+        for n in range(num_classes):
+            classes.append((data[i], data[i+1],
+                            unpack('>H', data[i+2:i+4])[0]))
+            i += 4
+        return (threads, classes)
+
+    def cmd_get_profile(self, clear=False):
+        """Let the emulation write folded stacks of its profiler (when
+        built with --enable-profiler).  Return (SAMPLES, DROPPED).  If
+        CLEAR, clear the samples by PUT DATA after writing; it needs admin
+        authorization."""
+        data = self.cmd_get_data(0x01, 0x18)
+        if clear:
+            self.cmd_put_data(0x01, 0x18, b"")
+        return unpack('>II', data)
+
+    def cmd_get_opcount(self, clear=False):
+        """Get field operation counts (when built with --enable-op-count).
+        Return list of (INS, ALG, COUNT, totals), totals in order of
+        OPCOUNT_KINDS.  If CLEAR, clear them by PUT DATA after reading; it
+        needs admin authorization."""
+        data = self.cmd_get_data(0x01, 0x1a)
+        if clear:
+            self.cmd_put_data(0x01, 0x1a, b"")
+        n = 2 + 4 + len(OPCOUNT_KINDS) * 4
+        result = []
+        for i in range(0, len(data), n):
+            v = unpack('>%dI' % (1 + len(OPCOUNT_KINDS)), data[i+2:i+n])
+            result.append((data[i], data[i+1], v[0], list(v[1:])))
+        return result
+
     def cmd_change_reference_data(self, who, data):
         cmd_data = iso7816_compose(0x24, 0x00, 0x80+who, data)
         sw = self.icc_send_cmd(cmd_data)
@@ -0,0 +1,167 @@
+#! /usr/bin/python3
+
+"""
+gnuk_token_async.py - asynchronous access to many Gnuk Tokens
+
+Copyright (C) 2026 Free Software Initiative of Japan
+
+This file is a part of Gnuk, a GnuPG USB Token implementation.
+
+Gnuk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Gnuk is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+
+# PyUSB transfers are blocking, so each token has its own worker
+# thread, which keeps the handle opened by gnuk_token.  Commands to a
+# token are serialized by the thread (CCID has a single slot, a token
+# can't have two commands in flight), while tokens run concurrently
+# on the event loop.
+#
+# Any method of gnuk_token is available as a coroutine:
+#
+#     async def provision(t):
+#         await t.cmd_select_openpgp()
+#         await t.cmd_verify(3, b"12345678")
+#         ...
+#
+#     tokens = open_gnuk_tokens()
+#     results = asyncio.run(fan_out(tokens, provision))
+#
+# Use batch() to run several commands in a row on the worker thread,
+# without going back to the event loop for each, and get_data() to
+# read many DOs at once.
+
+import asyncio
+from concurrent.futures import ThreadPoolExecutor
+from struct import pack
+
+from gnuk_token import gnuk_token, gnuk_devices, iso7816_compose, parse_tlv_list
+
+class gnuk_token_async(object):
+    def __init__(self, token, name=None):
+        """
+        __init__(token, name) -> None
+        token: gnuk_token object, already powered on.
+        name: name of the token to show, filename of the device.
+        """
+        self.token = token
+        self.name = name
+        self.__executor = ThreadPoolExecutor(max_workers=1)
+        self.__bulk = True
+
+    def __getattr__(self, attr):
+        method = getattr(self.token, attr)
+        if not callable(method):
+            return method
+        async def call(*args, **kwargs):
+            return await self.run(method, *args, **kwargs)
+        return call
+
+    async def run(self, func, *args, **kwargs):
+        """Run FUNC in the worker thread of the token."""
+        loop = asyncio.get_running_loop()
+        return await loop.run_in_executor(self.__executor,
+                                          lambda: func(*args, **kwargs))
+
+    async def batch(self, cmds):
+        """Run CMDS, a list of (method name, args...), in a row.
+        Return the list of results."""
+        def run_all():
+            return [getattr(self.token, c[0])(*c[1:]) for c in cmds]
+        return await self.run(run_all)
+
+    def __get_data_one(self, tag):
+        """Get a DO of TAG by GET DATA, or a public key by GENERATE
+        ASYMMETRIC KEY PAIR for B6, B8, or A4, like GET DATA BULK.
+        Return empty value when it's not available."""
+        try:
+            if tag in (0x00b6, 0x00b8, 0x00a4):
+                cmd_data = iso7816_compose(0x47, 0x81, 0x00,
+                                           pack('>BB', tag, 0x00))
+                sw = self.token.icc_send_cmd(cmd_data)
+                if len(sw) != 2:
+                    raise ValueError(sw)
+                elif sw[0] != 0x61:
+                    raise ValueError("%02x%02x" % (sw[0], sw[1]))
+                pk = self.token.cmd_get_response(sw[1])
+                return parse_tlv_list(bytes(pk))[0]
+            return bytes(self.token.cmd_get_data(tag >> 8, tag & 0xff))
+        except ValueError as e:
+            if str(e) in ("6a88", "6a82"):
+                return b""
+            raise
+
+    async def get_data(self, tags):
+        """Get DOs of TAGS by a single request (GET DATA BULK).
+        For a token which doesn't support it (6D00 or 6E00), get each
+        DO.  Return the list of values; it's empty when the DO is not
+        available."""
+        def get_all():
+            if self.__bulk:
+                try:
+                    return self.token.cmd_get_data_bulk(tags)
+                except ValueError as e:
+                    if str(e) not in ("6d00", "6e00"):
+                        raise
+                    self.__bulk = False
+            return [self.__get_data_one(t) for t in tags]
+        return await self.run(get_all)
+
+    def close(self):
+        try:
+            self.token.release_gnuk()
+        except:
+            pass
+        self.__executor.shutdown()
+
+def open_gnuk_tokens():
+    """Open all Gnuk Tokens, power on, and return the list of
+    gnuk_token_async objects."""
+    tokens = []
+    for (dev, config, intf) in gnuk_devices():
+        try:
+            icc = gnuk_token(dev, config, intf)
+        except:
+            continue
+        status = icc.icc_get_status()
+        if status == 1:
+            icc.icc_power_on()
+        elif status != 0:
+            icc.release_gnuk()
+            continue
+        tokens.append(gnuk_token_async(icc, dev.filename))
+    return tokens
+
+async def fan_out(tokens, func, *args):
+    """Run FUNC(token, *ARGS) as a task for each of TOKENS.  Return
+    the list of results in the order of TOKENS; it is an exception
+    object for a token which failed."""
+    return await asyncio.gather(*[func(t, *args) for t in tokens],
+                                return_exceptions=True)
+
+async def show_token(t):
+    await t.cmd_select_openpgp()
+    aid, ver = await t.get_data([0x004f, 0x5f52])
+    return "AID %s  historical bytes %s" % (bytes(aid).hex(), bytes(ver).hex())
+
+def main():
+    tokens = open_gnuk_tokens()
+    if not tokens:
+        raise ValueError("No ICC present")
+    results = asyncio.run(fan_out(tokens, show_token))
+    for t, r in zip(tokens, results):
+        print("%s: %s" % (t.name, r))
+        t.close()
+
+if __name__ == '__main__':
+    main()